@@ -0,0 +1,406 @@
+/*============================================================================*/
+/* ANEL DE QUADROS EM MEMRIA COMPARTILHADA                                   */
+/*============================================================================*/
+/** Anel de quadros de 8 bits entre dois processos, com shm_open. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "anel.h"
+#include "pool.h"
+
+/*============================================================================*/
+
+#define ANEL_MAGICO 0x4c454e41 /* "ANEL". Escrito por ltimo, quando o anel est pronto. */
+#define ANEL_ESPERA_MAX 5000 /* Quanto tempo (em ms) anelAbre espera o anel ser criado. */
+
+/* O incio da memria compartilhada. Fica em pginas separadas das posies,
+ * que o consumidor mapeia s para leitura. */
+typedef struct
+{
+    volatile uint32_t magico;
+    uint32_t n_posicoes;
+    uint32_t largura_max;
+    uint32_t altura_max;
+    uint64_t bytes_posicao; /* Cabealho mais pixels, mltiplo do alinhamento. */
+    sem_t livres; /* Posies que o produtor pode usar. */
+    sem_t prontos; /* Posies publicadas e ainda no recebidas. */
+} CabecalhoAnel;
+
+/* O incio de cada posio. Os pixels vm depois, alinhados. */
+typedef struct
+{
+    uint32_t largura; /* 0 marca o fim dos quadros. */
+    uint32_t altura;
+    uint32_t passo; /* Bytes entre o incio de duas linhas. */
+    uint32_t reservado;
+    uint64_t sequencia;
+} CabecalhoPosicao;
+
+struct _Anel
+{
+    char* nome;
+    int criador; /* Se != 0, este processo criou o anel (e o remove no fim). */
+    CabecalhoAnel* cabecalho;
+    size_t bytes_cabecalho; /* J arredondado para pginas inteiras. */
+    unsigned char* posicoes;
+    size_t bytes_posicoes;
+    uint64_t proxima; /* Nmero da prxima posio a usar (produtor) ou receber (consumidor). */
+    int fim; /* Consumidor: a marca de fim j foi recebida. */
+};
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Endereo de uma posio do anel.
+ *
+ * Parmetros: Anel* anel: o anel.
+ *             uint64_t n: o nmero da posio, contando desde o incio (
+ *               tomado mdulo o nmero de posies).
+ *
+ * Valor de retorno: ponteiro para o cabealho da posio. */
+
+CabecalhoPosicao* _anelPosicao (Anel* anel, uint64_t n)
+{
+    return ((CabecalhoPosicao*) (anel->posicoes + (n % anel->cabecalho->n_posicoes) * anel->cabecalho->bytes_posicao));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Espera em um semforo, repetindo se a espera for interrompida.
+ *
+ * Parmetros: sem_t* sem: o semforo.
+ *
+ * Valor de retorno: NENHUM */
+
+void _anelEspera (sem_t* sem)
+{
+    while (sem_wait (sem) != 0 && errno == EINTR);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Mapeia as duas regies do anel: o cabealho (sempre para leitura e
+ * escrita, por causa dos semforos) e as posies.
+ *
+ * Parmetros: Anel* anel: o anel, com bytes_cabecalho e bytes_posicoes.
+ *             int fd: o descritor da memria compartilhada.
+ *             int protecao_posicoes: PROT_READ ou PROT_READ|PROT_WRITE.
+ *
+ * Valor de retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int _anelMapeia (Anel* anel, int fd, int protecao_posicoes)
+{
+    void* cabecalho = mmap (NULL, anel->bytes_cabecalho, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    void* posicoes = mmap (NULL, anel->bytes_posicoes, protecao_posicoes, MAP_SHARED, fd, (off_t) anel->bytes_cabecalho);
+
+    if (cabecalho == MAP_FAILED || posicoes == MAP_FAILED)
+    {
+        if (cabecalho != MAP_FAILED)
+            munmap (cabecalho, anel->bytes_cabecalho);
+        if (posicoes != MAP_FAILED)
+            munmap (posicoes, anel->bytes_posicoes);
+        return (0);
+    }
+
+    anel->cabecalho = (CabecalhoAnel*) cabecalho;
+    anel->posicoes = (unsigned char*) posicoes;
+    return (1);
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Cria um anel (lado do produtor). Um anel antigo com o mesmo nome 
+ * substitudo.
+ *
+ * Parmetros: const char* nome: nome da memria compartilhada, como
+ *               "/arroz" (ver shm_open).
+ *             int n_posicoes: nmero de quadros que cabem no anel.
+ *             int largura_max, altura_max: dimenses mximas dos quadros.
+ *
+ * Valor de retorno: o anel, ou NULL se no foi possvel cri-lo. Termine com
+ *                   anelTermina e anelFecha. */
+
+Anel* anelCria (const char* nome, int n_posicoes, int largura_max, int altura_max)
+{
+    Anel* anel;
+    int fd;
+    long pagina = sysconf (_SC_PAGESIZE);
+
+    if (n_posicoes <= 0 || largura_max <= 0 || altura_max <= 0)
+    {
+        printf ("anelCria: dimensoes invalidas.\n");
+        return (NULL);
+    }
+
+    anel = (Anel*) calloc (1, sizeof (Anel));
+    anel->nome = strdup (nome);
+    anel->criador = 1;
+    anel->bytes_cabecalho = ((sizeof (CabecalhoAnel) + pagina - 1) / pagina) * pagina;
+    anel->bytes_posicoes = (_alinhaBytes (sizeof (CabecalhoPosicao)) + _alinhaBytes (largura_max) * (size_t) altura_max) * n_posicoes;
+
+    shm_unlink (nome);
+    fd = shm_open (nome, O_RDWR|O_CREAT|O_EXCL, 0600);
+    if (fd < 0 || ftruncate (fd, (off_t) (anel->bytes_cabecalho + anel->bytes_posicoes)) != 0 ||
+        !_anelMapeia (anel, fd, PROT_READ|PROT_WRITE))
+    {
+        printf ("anelCria: nao foi possivel criar a memoria compartilhada %s.\n", nome);
+        if (fd >= 0)
+        {
+            close (fd);
+            shm_unlink (nome);
+        }
+        free (anel->nome);
+        free (anel);
+        return (NULL);
+    }
+    close (fd);
+
+    anel->cabecalho->n_posicoes = n_posicoes;
+    anel->cabecalho->largura_max = largura_max;
+    anel->cabecalho->altura_max = altura_max;
+    anel->cabecalho->bytes_posicao = anel->bytes_posicoes / n_posicoes;
+    sem_init (&anel->cabecalho->livres, 1, n_posicoes);
+    sem_init (&anel->cabecalho->prontos, 1, 0);
+
+    /* S agora o consumidor pode usar o anel. */
+    __sync_synchronize ();
+    anel->cabecalho->magico = ANEL_MAGICO;
+    return (anel);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Reserva a prxima posio do anel para um quadro, esperando enquanto
+ * todas esto ocupadas. O quadro deve ser escrito na posio e publicado
+ * com anelPublica antes da prxima reserva.
+ *
+ * Parmetros: Anel* anel: o anel.
+ *             int largura, altura: dimenses do quadro. No podem passar das
+ *               dadas em anelCria.
+ *             int* passo: sada. A distncia (em bytes) entre o incio de
+ *               duas linhas do quadro.
+ *
+ * Valor de retorno: ponteiro para a primeira linha do quadro, ou NULL se as
+ *                   dimenses forem invlidas. */
+
+unsigned char* anelReserva (Anel* anel, int largura, int altura, int* passo)
+{
+    CabecalhoPosicao* posicao;
+
+    if (largura <= 0 || altura <= 0 || (uint32_t) largura > anel->cabecalho->largura_max || (uint32_t) altura > anel->cabecalho->altura_max)
+    {
+        printf ("anelReserva: o quadro precisa caber nas posicoes do anel.\n");
+        return (NULL);
+    }
+
+    _anelEspera (&anel->cabecalho->livres);
+
+    posicao = _anelPosicao (anel, anel->proxima);
+    posicao->largura = largura;
+    posicao->altura = altura;
+    posicao->passo = (uint32_t) _alinhaBytes (largura);
+    posicao->sequencia = anel->proxima;
+
+    *passo = (int) posicao->passo;
+    return ((unsigned char*) posicao + _alinhaBytes (sizeof (CabecalhoPosicao)));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Publica o quadro da ltima posio reservada, que passa a ser do
+ * consumidor.
+ *
+ * Parmetros: Anel* anel: o anel.
+ *
+ * Valor de retorno: NENHUM */
+
+void anelPublica (Anel* anel)
+{
+    anel->proxima++;
+    sem_post (&anel->cabecalho->prontos);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Avisa o consumidor que no h mais quadros.
+ *
+ * Parmetros: Anel* anel: o anel.
+ *
+ * Valor de retorno: NENHUM */
+
+void anelTermina (Anel* anel)
+{
+    _anelEspera (&anel->cabecalho->livres);
+    _anelPosicao (anel, anel->proxima)->largura = 0;
+    anelPublica (anel);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Abre um anel criado por outro processo (lado do consumidor). Se o anel
+ * ainda no existe, espera alguns segundos por ele.
+ *
+ * Parmetros: const char* nome: nome dado em anelCria.
+ *
+ * Valor de retorno: o anel, ou NULL se no foi possvel abri-lo. Termine com
+ *                   anelFecha. */
+
+Anel* anelAbre (const char* nome)
+{
+    Anel* anel;
+    CabecalhoAnel* cabecalho;
+    struct stat info;
+    int fd = -1, espera;
+    long pagina = sysconf (_SC_PAGESIZE);
+
+    /* Espera o produtor criar o anel e terminar de preparar o cabealho. */
+    for (espera = 0; espera <= ANEL_ESPERA_MAX; espera += 10)
+    {
+        fd = shm_open (nome, O_RDWR, 0);
+        if (fd >= 0 && fstat (fd, &info) == 0 && info.st_size >= pagina)
+        {
+            cabecalho = (CabecalhoAnel*) mmap (NULL, sizeof (CabecalhoAnel), PROT_READ, MAP_SHARED, fd, 0);
+            if (cabecalho != MAP_FAILED)
+            {
+                int pronto = (cabecalho->magico == ANEL_MAGICO);
+                munmap (cabecalho, sizeof (CabecalhoAnel));
+                if (pronto)
+                    break;
+            }
+        }
+        if (fd >= 0)
+            close (fd);
+        fd = -1;
+        usleep (10000);
+    }
+
+    if (fd < 0)
+    {
+        printf ("anelAbre: nao foi possivel abrir a memoria compartilhada %s.\n", nome);
+        return (NULL);
+    }
+
+    anel = (Anel*) calloc (1, sizeof (Anel));
+    anel->nome = strdup (nome);
+    anel->bytes_cabecalho = ((sizeof (CabecalhoAnel) + pagina - 1) / pagina) * pagina;
+    anel->bytes_posicoes = (size_t) info.st_size - anel->bytes_cabecalho;
+
+    /* As posies ficam somente para leitura: os quadros so do produtor. */
+    if (!_anelMapeia (anel, fd, PROT_READ))
+    {
+        printf ("anelAbre: nao foi possivel mapear a memoria compartilhada %s.\n", nome);
+        close (fd);
+        free (anel->nome);
+        free (anel);
+        return (NULL);
+    }
+    close (fd);
+
+    return (anel);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Recebe o prximo quadro, esperando enquanto ele no  publicado. O quadro
+ * no  copiado: a imagem  uma viso da posio do anel, e os pixels no
+ * podem ser alterados. A posio fica reservada at anelLibera.
+ *
+ * Parmetros: Anel* anel: o anel.
+ *             uint64_t* sequencia: sada. O nmero de sequncia do quadro,
+ *               dado pelo produtor (pode ser NULL).
+ *
+ * Valor de retorno: o quadro, ou NULL se o produtor terminou. Deve ser
+ *                   devolvido com anelLibera, e no com destroiImagemU8. */
+
+ImagemU8* anelProximo (Anel* anel, uint64_t* sequencia)
+{
+    int i;
+    size_t bytes_cabecalho;
+    CabecalhoPosicao* posicao;
+    unsigned char* pixels;
+    ImagemU8* quadro;
+
+    if (anel->fim)
+        return (NULL);
+
+    _anelEspera (&anel->cabecalho->prontos);
+    posicao = _anelPosicao (anel, anel->proxima);
+
+    if (posicao->largura == 0)
+    {
+        /* A posio da marca de fim volta logo para o produtor. */
+        anel->fim = 1;
+        sem_post (&anel->cabecalho->livres);
+        return (NULL);
+    }
+
+    /* A viso  criada como em criaVisaoU8: s a estrutura e os ponteiros
+      das linhas ficam no pool. */
+    bytes_cabecalho = _alinhaBytes (sizeof (ImagemU8));
+    quadro = (ImagemU8*) poolAloca (bytes_cabecalho + sizeof (unsigned char*) * posicao->altura);
+    pixels = (unsigned char*) posicao + _alinhaBytes (sizeof (CabecalhoPosicao));
+
+    quadro->largura = posicao->largura;
+    quadro->altura = posicao->altura;
+    quadro->passo = posicao->passo;
+    quadro->bloco = pixels;
+    quadro->visao = 1;
+    quadro->dados = (unsigned char**) ((char*) quadro + bytes_cabecalho);
+    for (i = 0; i < quadro->altura; i++)
+        quadro->dados [i] = pixels + (size_t) i * quadro->passo;
+
+    if (sequencia)
+        *sequencia = posicao->sequencia;
+    anel->proxima++;
+    return (quadro);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Devolve um quadro recebido com anelProximo. A posio volta para o
+ * produtor, e a imagem no pode mais ser usada. Os quadros devem ser
+ * devolvidos na ordem em que foram recebidos.
+ *
+ * Parmetros: Anel* anel: o anel.
+ *             ImagemU8* quadro: o quadro.
+ *
+ * Valor de retorno: NENHUM */
+
+void anelLibera (Anel* anel, ImagemU8* quadro)
+{
+    destroiImagemU8 (quadro);
+    sem_post (&anel->cabecalho->livres);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Fecha um anel. Do lado do produtor, espera o consumidor devolver todas as
+ * posies (inclusive a da marca de fim) e remove a memria compartilhada.
+ *
+ * Parmetros: Anel* anel: o anel. Pode ser NULL.
+ *
+ * Valor de retorno: NENHUM */
+
+void anelFecha (Anel* anel)
+{
+    uint32_t i;
+
+    if (!anel)
+        return;
+
+    if (anel->criador)
+    {
+        for (i = 0; i < anel->cabecalho->n_posicoes; i++)
+            _anelEspera (&anel->cabecalho->livres);
+        sem_destroy (&anel->cabecalho->livres);
+        sem_destroy (&anel->cabecalho->prontos);
+        shm_unlink (anel->nome);
+    }
+
+    munmap (anel->cabecalho, anel->bytes_cabecalho);
+    munmap (anel->posicoes, anel->bytes_posicoes);
+    free (anel->nome);
+    free (anel);
+}
+
+/*============================================================================*/
@@ -0,0 +1,43 @@
+/*============================================================================*/
+/* ANEL DE QUADROS EM MEMRIA COMPARTILHADA                                   */
+/*============================================================================*/
+/** Passagem de quadros de 8 bits entre dois processos da mesma mquina (o da
+ * aquisio e o da contagem), sem arquivos e sem cpias. O produtor cria um
+ * anel com um nmero fixo de posies em memria compartilhada (shm_open),
+ * escreve cada quadro direto em uma posio livre e a publica; o consumidor
+ * recebe cada posio como uma ImagemU8 (uma viso somente de leitura, que
+ * aponta para a memria compartilhada) e a libera quando termina de us-la.
+ *
+ * Cada posio tem um cabealho com a largura, a altura, o passo das linhas e
+ * o nmero de sequncia do quadro. Os quadros so entregues em ordem, e o
+ * produtor espera quando todas as posies esto ocupadas. H um nico
+ * produtor e um nico consumidor por anel. */
+/*============================================================================*/
+
+#ifndef __ANEL_H
+#define __ANEL_H
+
+/*============================================================================*/
+
+#include <stdint.h>
+#include "imagem.h"
+
+/*============================================================================*/
+
+typedef struct _Anel Anel;
+
+/* Produtor. */
+Anel* anelCria (const char* nome, int n_posicoes, int largura_max, int altura_max);
+unsigned char* anelReserva (Anel* anel, int largura, int altura, int* passo);
+void anelPublica (Anel* anel);
+void anelTermina (Anel* anel);
+
+/* Consumidor. */
+Anel* anelAbre (const char* nome);
+ImagemU8* anelProximo (Anel* anel, uint64_t* sequencia);
+void anelLibera (Anel* anel, ImagemU8* quadro);
+
+void anelFecha (Anel* anel);
+
+/*============================================================================*/
+#endif /* __ANEL_H */
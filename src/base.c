@@ -36,7 +36,7 @@ unsigned char float2uchar (float x)
  *             float mul1: multiplicador para a primeira imagem.
  *             float mul2: multiplicador para a segunda imagem.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *
  * Valor de retorno: nenhum. */
 
@@ -49,11 +49,17 @@ void soma (Imagem* in1, Imagem* in2, float mul1, float mul2, Imagem* out)
         exit (1);
     }
 
+    // Percorre as linhas com ponteiros diretos, para que o lao interno seja vetorizvel.
     int channel, row, col;
     for (channel = 0; channel < in1->n_canais; channel++)
         for (row = 0; row < in1->altura; row++)
+        {
+            const float* lin1 = in1->dados [channel][row];
+            const float* lin2 = in2->dados [channel][row];
+            float* lin_out = out->dados [channel][row];
             for (col = 0; col < in1->largura; col++)
-                out->dados [channel][row][col] = in1->dados [channel][row][col]*mul1 + in2->dados [channel][row][col]*mul2;
+                lin_out [col] = lin1 [col]*mul1 + lin2 [col]*mul2;
+        }
 }
 
 /*============================================================================*/
@@ -64,7 +70,7 @@ void soma (Imagem* in1, Imagem* in2, float mul1, float mul2, Imagem* out)
  *
  * Parmetros: Imagem* in: imagem de entrada.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *             float min: valor inferior da faixa desejada.
  *             float max: valor superior da faixa desejada.
  *
@@ -206,7 +212,7 @@ void normLocalSimples (Imagem* in, Imagem* out, float min, float max, int largur
  * Parmetros: Imagem* in: imagem de entrada. Se tiver mais que 1 canal,
  *               processa cada canal independentemente.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *             float min: valor inferior da faixa desejada.
  *             float max: valor superior da faixa desejada.
  *             float descartados: proporo de pixels descartados. Precisa ser
@@ -235,49 +241,144 @@ void normalizaSemExtremos8bpp (Imagem* in, Imagem* out, float min, float max, fl
     }
 
     int histograma [256];
-    int channel, row, col, i;
-    float min_in, max_in, intervalo_in, intervalo_out = max - min;
+    int channel, row;
+    float min_in, max_in;
     int n_descartados = (int) (descartados * in->largura * in->altura); // Nmero de pixels "descartados" (ignorados).
-    int n_passados;
 
     // Normaliza os canais da imagem de forma independente.
     for (channel = 0; channel < in->n_canais; channel++)
     {
         criaHistograma8bpp1c (in, channel, histograma); // Cria o histograma para este canal.
+        _faixaSemExtremos8bpp (histograma, n_descartados, &min_in, &max_in);
+
+        for (row = 0; row < in->altura; row++)
+            _normalizaLinha (in->dados [channel][row], in->largura, min_in, max_in, min, max, out->dados [channel][row]);
+    }
+}
 
-        // Agora, procura a faixa de interesse para os valores.
-        n_passados = 0;
-        for (i = 0; i < 256 && n_passados <= n_descartados; i++)
-            n_passados += histograma [i];
-        min_in = (i-1)/255.0f;
+/*----------------------------------------------------------------------------*/
+/* O ncleo da normalizaSemExtremos8bpp, separado em duas partes: a busca da
+ * faixa no histograma e a normalizao de uma linha. Tambm  usado pelo
+ * processamento em fluxo (ver fluxo.h), que monta o histograma antes. */
 
-        n_passados = 0;
-        for (i = 255; i >= 0 && n_passados <= n_descartados; i--)
-            n_passados += histograma [i];
-        max_in = (i+1)/255.0f;
+// Procura a faixa de interesse para os valores, ignorando n_descartados pixels em cada extremo do histograma.
+void _faixaSemExtremos8bpp (const int histograma [256], int n_descartados, float* min_in, float* max_in)
+{
+    int i, n_passados;
 
-        // Normaliza.
-        intervalo_in = max_in - min_in;
+    n_passados = 0;
+    for (i = 0; i < 256 && n_passados <= n_descartados; i++)
+        n_passados += histograma [i];
+    *min_in = (i-1)/255.0f;
+
+    n_passados = 0;
+    for (i = 255; i >= 0 && n_passados <= n_descartados; i--)
+        n_passados += histograma [i];
+    *max_in = (i+1)/255.0f;
+}
+
+// Leva uma linha da faixa [min_in,max_in] para [min,max], saturando o que estiver fora.
+void _normalizaLinha (const float* in, int largura, float min_in, float max_in, float min, float max, float* out)
+{
+    int col;
+    float intervalo_in = max_in - min_in, intervalo_out = max - min;
+
+    if (intervalo_in < 0.0001f || intervalo_in == intervalo_out)
+    {
+        for (col = 0; col < largura; col++)
+            out [col] = in [col]; // Imagem homognea ou j normalizada. Fica como est.
+        return;
+    }
+
+    for (col = 0; col < largura; col++)
+    {
+        float val = in [col];
+        if (val <= min_in)
+            out [col] = min;
+        else if (val >= max_in)
+            out [col] = max;
+        else
+            out [col] = (val - min_in) / intervalo_in * intervalo_out + min; // Normaliza.
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Verso da normalizaSemExtremos8bpp para imagens de 8 bits. Como a entrada
+ * s tem 256 valores possveis, a normalizao  feita com uma tabela de
+ * consulta calculada com as mesmas contas da verso float.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *             float min: valor inferior da faixa desejada, em [0,1].
+ *             float max: valor superior da faixa desejada, em [0,1].
+ *             float descartados: proporo de pixels descartados. Precisa ser
+ *               menor que 0.5.
+ *
+ * Valor de retorno: nenhum. */
+
+void normalizaSemExtremosU8 (ImagemU8* in, ImagemU8* out, float min, float max, float descartados)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: normalizaSemExtremosU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    if (max <= min)
+    {
+        printf ("ERRO: normalizaSemExtremosU8: max deve ser maior que min.\n");
+        exit (1);
+    }
+
+    if (descartados <= 0 || descartados >= 0.5f)
+    {
+        printf ("ERRO: normalizaSemExtremosU8: a proporo de pixels descartados deve ficar no intervalo (0,0.5).\n");
+        exit (1);
+    }
+
+    int histograma [256];
+    unsigned char tabela [256];
+    int row, col, i;
+    float min_in, max_in, intervalo_in, intervalo_out = max - min;
+    int n_descartados = (int) (descartados * in->largura * in->altura);
+    int n_passados;
+
+    criaHistogramaU8 (in, histograma);
+
+    // Procura a faixa de interesse para os valores.
+    n_passados = 0;
+    for (i = 0; i < 256 && n_passados <= n_descartados; i++)
+        n_passados += histograma [i];
+    min_in = (i-1)/255.0f;
+
+    n_passados = 0;
+    for (i = 255; i >= 0 && n_passados <= n_descartados; i--)
+        n_passados += histograma [i];
+    max_in = (i+1)/255.0f;
+
+    // Monta a tabela.
+    intervalo_in = max_in - min_in;
+    for (i = 0; i < 256; i++)
+    {
+        float val = i/255.0f;
         if (intervalo_in < 0.0001f || intervalo_in == intervalo_out)
-        {
-            for (row = 0; row < in->altura; row++)
-                for (col = 0; col < in->largura; col++)
-                    out->dados [channel][row][col] = in->dados [channel][row][col]; // Imagem homognea ou j normalizada. Fica como est.
-        }
+            tabela [i] = (unsigned char) i;
+        else if (val <= min_in)
+            tabela [i] = float2uchar (min);
+        else if (val >= max_in)
+            tabela [i] = float2uchar (max);
         else
-        {
-            for (row = 0; row < in->altura; row++)
-                for (col = 0; col < in->largura; col++)
-                {
-                    float val = in->dados [channel][row][col];
-                    if (val <= min_in)
-                        out->dados [channel][row][col] = min;
-                    else if (val >= max_in)
-                        out->dados [channel][row][col] = max;
-                    else
-                        out->dados [channel][row][col] = (val - min_in) / intervalo_in * intervalo_out + min; // Normaliza.
-                }
-        }
+            tabela [i] = float2uchar ((val - min_in) / intervalo_in * intervalo_out + min);
+    }
+
+    // Aplica.
+    for (row = 0; row < in->altura; row++)
+    {
+        const unsigned char* lin_in = in->dados [row];
+        unsigned char* lin_out = out->dados [row];
+        for (col = 0; col < in->largura; col++)
+            lin_out [col] = tabela [lin_in [col]];
     }
 }
 
@@ -340,4 +441,26 @@ void criaHistograma8bpp1cNorm (Imagem* in, int canal, float histograma [256])
         histograma [i] = ((float) hist_int [i]) * norm;
 }
 
+/*----------------------------------------------------------------------------*/
+/** Cria um histograma de 256 faixas para uma imagem de 8 bits.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             int histograma [256]: histograma de sada.
+ *
+ * Valor de retorno: nenhum (o histograma  preenchido). */
+
+void criaHistogramaU8 (ImagemU8* in, int histograma [256])
+{
+    int i, row, col;
+    for (i = 0; i < 256; i++)
+        histograma [i] = 0;
+
+    for (row = 0; row < in->altura; row++)
+    {
+        const unsigned char* lin = in->dados [row];
+        for (col = 0; col < in->largura; col++)
+            histograma [lin [col]]++;
+    }
+}
+
 /*============================================================================*/
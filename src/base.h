@@ -25,10 +25,14 @@ void soma (Imagem* in1, Imagem* in2, float mul1, float mul2, Imagem* out);
 void normaliza (Imagem* in, Imagem* out, float min, float max);
 void normalizaSemExtremos8bpp (Imagem* in, Imagem* out, float min, float max, float descartados);
 void normLocalSimples (Imagem* in, Imagem* out, float min, float max, int largura);
+void normalizaSemExtremosU8 (ImagemU8* in, ImagemU8* out, float min, float max, float descartados);
+void _faixaSemExtremos8bpp (const int histograma [256], int n_descartados, float* min_in, float* max_in); /* Para o processamento em fluxo. */
+void _normalizaLinha (const float* in, int largura, float min_in, float max_in, float min, float max, float* out);
 
 /* Histogramas */
 void criaHistograma8bpp1c (Imagem* in, int canal, int histograma [256]);
 void criaHistograma8bpp1cNorm (Imagem* in, int canal, float histograma [256]);
+void criaHistogramaU8 (ImagemU8* in, int histograma [256]);
 
 /*============================================================================*/
 #endif /* __BASE_H */
@@ -0,0 +1,541 @@
+/*============================================================================*/
+/* IMAGENS BINRIAS COMPACTAS                                                 */
+/*============================================================================*/
+/** Tipo e funes para imagens binrias com 1 bit por pixel. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "base.h"
+#include "binaria.h"
+#include "pool.h"
+
+/*============================================================================*/
+/* CRIAO E CPIA                                                            */
+/*============================================================================*/
+/** Cria uma imagem binria vazia (todos os pixels em 0).
+ *
+ * Parmetros: int largura: largura da imagem.
+ *             int altura: altura da imagem.
+ *
+ * Valor de retorno: a imagem alocada. A responsabilidade por desaloc-la  do
+ *                   chamador. */
+
+ImagemBin* criaImagemBin (int largura, int altura)
+{
+    int i;
+    size_t bytes_cabecalho, bytes_indices, bytes_pixels;
+    char* memoria;
+    ImagemBin* img;
+
+    if (largura <= 0 || altura <= 0)
+    {
+        printf ("criaImagemBin: imagens devem ter altura e largura maiores que 0.\n");
+        return (NULL);
+    }
+
+    /* Mesmo esquema da criaImagem: estrutura, ponteiros e pixels em um s bloco. */
+    bytes_cabecalho = _alinhaBytes (sizeof (ImagemBin));
+    bytes_indices = _alinhaBytes (sizeof (uint64_t*) * altura);
+    bytes_pixels = sizeof (uint64_t) * ((largura + 63) / 64) * altura;
+
+    memoria = (char*) poolAloca (bytes_cabecalho + bytes_indices + bytes_pixels);
+    if (!memoria)
+    {
+        printf ("criaImagemBin: memoria insuficiente.\n");
+        return (NULL);
+    }
+
+    img = (ImagemBin*) memoria;
+    img->largura = largura;
+    img->altura = altura;
+    img->palavras = (largura + 63) / 64;
+    img->bloco = (uint64_t*) (memoria + bytes_cabecalho + bytes_indices);
+    memset (img->bloco, 0, bytes_pixels);
+
+    img->dados = (uint64_t**) (memoria + bytes_cabecalho);
+    for (i = 0; i < altura; i++)
+        img->dados [i] = img->bloco + (size_t) i * img->palavras;
+
+    return (img);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Destroi uma imagem binria.
+ *
+ * Parmetros: ImagemBin* img: a imagem a destruir.
+ *
+ * Valor de retorno: nenhum. */
+
+void destroiImagemBin (ImagemBin* img)
+{
+    poolLibera (img);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Copia o contedo de uma imagem binria para outra.
+ *
+ * Parmetros: ImagemBin* in: copia desta imagem...
+ *             ImagemBin* out: ... para esta.
+ *
+ * Valor de retorno: nenhum. */
+
+void copiaConteudoBin (ImagemBin* in, ImagemBin* out)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: copiaConteudoBin: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    if (in != out)
+        memcpy (out->bloco, in->bloco, sizeof (uint64_t) * in->palavras * in->altura);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Troca duas imagens binrias de lugar, sem copiar nenhum pixel. Ver
+ * trocaImagens.
+ *
+ * Parmetros: ImagemBin** a: ponteiro para a primeira imagem...
+ *             ImagemBin** b: ... e para a segunda. Devem ter o mesmo tamanho.
+ *
+ * Valor de retorno: nenhum (os ponteiros so trocados). */
+
+void trocaImagensBin (ImagemBin** a, ImagemBin** b)
+{
+    if ((*a)->largura != (*b)->largura || (*a)->altura != (*b)->altura)
+    {
+        printf ("ERRO: trocaImagensBin: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    ImagemBin* aux = *a;
+    *a = *b;
+    *b = aux;
+}
+
+/*============================================================================*/
+/* CONVERSES                                                                 */
+/*============================================================================*/
+/** Binariza um canal de uma imagem float, colocando o resultado em uma imagem
+ * binria. Para converter mscaras com valores 0 e 1, use threshold = 0.5.
+ *
+ * Parmetros: Imagem* in: imagem de entrada.
+ *             int canal: canal da imagem de entrada a usar.
+ *             float threshold: pixels com valor maior que este ficam em 1.
+ *             ImagemBin* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void imagemParaBin (Imagem* in, int canal, float threshold, ImagemBin* out)
+{
+    int row;
+
+    if (in->largura != out->largura || in->altura != out->altura || canal < 0 || canal >= in->n_canais)
+    {
+        printf ("ERRO: imagemParaBin: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    for (row = 0; row < in->altura; row++)
+        _linhaParaBin (in->dados [canal][row], in->largura, threshold, out->dados [row]);
+}
+
+// Funo auxiliar: limiariza uma linha, empacotando os bits. Tambm usada pelo processamento em fluxo.
+void _linhaParaBin (const float* lin, int largura, float threshold, uint64_t* out)
+{
+    int col, bit;
+    uint64_t palavra;
+
+    for (col = 0; col < largura; col += 64)
+    {
+        palavra = 0;
+        for (bit = 0; bit < 64 && col+bit < largura; bit++)
+            palavra |= ((uint64_t) (lin [col+bit] > threshold)) << bit;
+        out [col >> 6] = palavra;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Converte uma imagem binria para float (0 ou 1). Se a imagem de sada
+ * tiver mais de 1 canal, o valor  replicado em todos eles.
+ *
+ * Parmetros: ImagemBin* in: imagem de entrada.
+ *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void binParaImagem (ImagemBin* in, Imagem* out)
+{
+    int channel, row, col;
+
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: binParaImagem: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    for (channel = 0; channel < out->n_canais; channel++)
+        for (row = 0; row < in->altura; row++)
+            for (col = 0; col < in->largura; col++)
+                out->dados [channel][row][col] = (float) PIXEL_BIN (in, col, row);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Converte uma imagem de 8 bits para binria. Pixels com valor maior que 127
+ * ficam em 1.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             ImagemBin* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void U8ParaBin (ImagemU8* in, ImagemBin* out)
+{
+    int row, col, bit;
+    uint64_t palavra;
+
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: U8ParaBin: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    for (row = 0; row < in->altura; row++)
+    {
+        const unsigned char* lin = in->dados [row];
+        for (col = 0; col < in->largura; col += 64)
+        {
+            palavra = 0;
+            for (bit = 0; bit < 64 && col+bit < in->largura; bit++)
+                palavra |= ((uint64_t) (lin [col+bit] >> 7)) << bit;
+            out->dados [row][col >> 6] = palavra;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Converte uma imagem binria para 8 bits (0 ou 255).
+ *
+ * Parmetros: ImagemBin* in: imagem de entrada.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void binParaU8 (ImagemBin* in, ImagemU8* out)
+{
+    int row, col;
+
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: binParaU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    for (row = 0; row < in->altura; row++)
+    {
+        unsigned char* lin = out->dados [row];
+        for (col = 0; col < in->largura; col++)
+            lin [col] = (unsigned char) (0 - PIXEL_BIN (in, col, row)); /* 0 ou 255. */
+    }
+}
+
+/*============================================================================*/
+/* ARQUIVOS                                                                   */
+/*============================================================================*/
+/** Salva uma imagem binria em um arquivo BMP com 1 bit por pixel (paleta com
+ * preto e branco). O arquivo tem 1/24 do tamanho de um BMP de 24 bits.
+ *
+ * Parmetros: ImagemBin* img: imagem a salvar.
+ *             char* arquivo: caminho do arquivo a salvar.
+ *
+ * Valor de retorno: 0 se ocorreu algum erro, 1 do contrrio. */
+
+int salvaImagemBin (ImagemBin* img, char* arquivo)
+{
+    FILE* stream;
+    unsigned char invertido [256];
+    unsigned char* linha;
+    size_t bytes_linha = ((size_t) img->largura + 31) / 32 * 4; /* Mltiplo de 4 bytes. */
+    size_t bytes_dados = ((size_t) img->largura + 7) / 8;
+    size_t k;
+    int i, b, row;
+
+    stream = fopen (arquivo, "wb");
+    if (!stream)
+        return (0);
+
+    if (!salvaHeaderBitmap (stream, img->largura, img->altura, 1) ||
+        !salvaHeaderDIB (stream, img->largura, img->altura, 1) ||
+        !salvaPaleta (stream, 1))
+    {
+        fclose (stream);
+        return (0);
+    }
+
+    /* No BMP, o pixel mais  esquerda  o bit mais significativo de cada byte;
+     * aqui  o menos significativo. Cada byte  invertido com uma tabela. */
+    for (i = 0; i < 256; i++)
+    {
+        invertido [i] = 0;
+        for (b = 0; b < 8; b++)
+            if (i & (1 << b))
+                invertido [i] |= (unsigned char) (0x80 >> b);
+    }
+
+    linha = poolAloca (bytes_linha);
+    memset (linha, 0, bytes_linha); /* O padding fica zerado. */
+
+    /* As linhas vo de baixo para cima. Os bits alm da largura j so 0. */
+    for (row = img->altura-1; row >= 0; row--)
+    {
+        const uint64_t* lin = img->dados [row];
+        for (k = 0; k < bytes_dados; k++)
+            linha [k] = invertido [(lin [k/8] >> (8*(k%8))) & 0xFF];
+
+        if (fwrite (linha, 1, bytes_linha, stream) != bytes_linha)
+        {
+            printf ("salvaImagemBin: erro escrevendo dados da imagem.\n");
+            poolLibera (linha);
+            fclose (stream);
+            return (0);
+        }
+    }
+
+    poolLibera (linha);
+    fclose (stream);
+    return (1);
+}
+
+/*============================================================================*/
+/* MORFOLOGIA                                                                 */
+/*============================================================================*/
+/** Desloca uma linha inteira de bits: o bit x da sada recebe o bit x+d da
+ * entrada. Posies que caem fora da linha recebem o valor de preenchimento
+ * (0 para a dilatao, 1 para a eroso - assim, posies fora da imagem no
+ * influenciam o resultado).
+ *
+ * Parmetros: const uint64_t* src: linha de entrada.
+ *             int palavras: nmero de palavras da linha.
+ *             int largura: nmero de pixels vlidos na linha.
+ *             int d: deslocamento, pode ser negativo.
+ *             uint64_t preenchimento: 0 ou ~0.
+ *             uint64_t* dst: linha de sada.
+ *
+ * Valor de retorno: nenhum. */
+
+// Funo auxiliar: pega a palavra q da linha, completando com o preenchimento o que estiver fora dela.
+uint64_t _palavraBin (const uint64_t* src, int palavras, int q, uint64_t mascara_ultima, uint64_t preenchimento)
+{
+    if (q < 0 || q >= palavras)
+        return (preenchimento);
+    if (q == palavras-1)
+        return ((src [q] & mascara_ultima) | (preenchimento & ~mascara_ultima));
+    return (src [q]);
+}
+
+void _deslocaLinhaBin (const uint64_t* src, int palavras, int largura, int d, uint64_t preenchimento, uint64_t* dst)
+{
+    int i, q, s;
+    long p;
+    uint64_t mascara_ultima = (largura % 64)? (((uint64_t) 1) << (largura % 64)) - 1 : ~((uint64_t) 0);
+
+    for (i = 0; i < palavras; i++)
+    {
+        p = 64L*i + d; /* Primeiro bit da entrada que vai para esta palavra. */
+        q = (int) ((p >= 0)? p/64 : -((-p+63)/64));
+        s = (int) (p - 64L*q);
+
+        dst [i] = _palavraBin (src, palavras, q, mascara_ultima, preenchimento) >> s;
+        if (s)
+            dst [i] |= _palavraBin (src, palavras, q+1, mascara_ultima, preenchimento) << (64-s);
+    }
+}
+
+// Funo auxiliar para dilataBin e erodeBin: combina na linha de sada as linhas deslocadas pelo kernel.
+void _morfologiaBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out, int dilatacao)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: %s: as imagens precisam ter o mesmo tamanho.\n", (dilatacao)? "dilataBin" : "erodeBin");
+        exit (1);
+    }
+
+    int row, krow, dy;
+    uint64_t* deslocada = poolAloca (sizeof (uint64_t) * in->palavras);
+    const uint64_t** linhas = poolAloca (sizeof (uint64_t*) * kernel->altura);
+    uint64_t* lin_out;
+
+    // Se a sada for a prpria entrada, cada linha  montada em um buffer, e
+    // as linhas originais acima dela (j sobrescritas) ficam guardadas em um anel.
+    int n_anel = (in == out)? MAX (1, centro.y) : 0;
+    uint64_t* linha = (n_anel)? poolAloca (sizeof (uint64_t) * in->palavras) : NULL;
+    uint64_t* anel = (n_anel)? poolAloca (sizeof (uint64_t) * in->palavras * n_anel) : NULL;
+
+    for (row = 0; row < in->altura; row++)
+    {
+        lin_out = (n_anel)? linha : out->dados [row];
+
+        for (krow = 0; krow < kernel->altura; krow++)
+        {
+            dy = krow - centro.y;
+            if (row+dy < 0 || row+dy >= in->altura)
+                linhas [krow] = NULL; // Linhas fora da imagem so ignoradas.
+            else
+                linhas [krow] = (n_anel && dy < 0)? anel + (size_t) ((row+dy) % n_anel) * in->palavras : in->dados [row+dy];
+        }
+
+        _morfologiaLinhaBin (linhas, in->palavras, in->largura, kernel, centro, dilatacao, deslocada, lin_out);
+
+        if (n_anel)
+        {
+            memcpy (anel + (size_t) (row % n_anel) * in->palavras, in->dados [row], sizeof (uint64_t) * in->palavras);
+            memcpy (out->dados [row], linha, sizeof (uint64_t) * in->palavras);
+        }
+    }
+
+    poolLibera (deslocada);
+    poolLibera (linhas);
+    if (n_anel)
+    {
+        poolLibera (linha);
+        poolLibera (anel);
+    }
+}
+
+// Funo auxiliar: monta uma linha de sada da morfologia a partir das linhas de entrada que ficam sob cada linha do kernel (NULL para as que esto fora da imagem). Tambm usada pelo processamento em fluxo.
+void _morfologiaLinhaBin (const uint64_t** linhas, int palavras, int largura, Imagem* kernel, Coordenada centro, int dilatacao, uint64_t* deslocada, uint64_t* lin_out)
+{
+    int krow, kcol, i;
+    uint64_t preenchimento = (dilatacao)? 0 : ~((uint64_t) 0);
+    uint64_t mascara_ultima = (largura % 64)? (((uint64_t) 1) << (largura % 64)) - 1 : ~((uint64_t) 0);
+
+    for (i = 0; i < palavras; i++)
+        lin_out [i] = preenchimento;
+
+    for (krow = 0; krow < kernel->altura; krow++)
+    {
+        if (!linhas [krow])
+            continue;
+
+        for (kcol = 0; kcol < kernel->largura; kcol++)
+        {
+            if (kernel->dados [0][krow][kcol] <= 0.5f)
+                continue;
+
+            _deslocaLinhaBin (linhas [krow], palavras, largura, kcol - centro.x, preenchimento, deslocada);
+
+            if (dilatacao)
+                for (i = 0; i < palavras; i++)
+                    lin_out [i] |= deslocada [i];
+            else
+                for (i = 0; i < palavras; i++)
+                    lin_out [i] &= deslocada [i];
+        }
+    }
+
+    lin_out [palavras-1] &= mascara_ultima; // Mantm zerados os bits alm da largura.
+}
+
+/*----------------------------------------------------------------------------*/
+/** Dilatao morfolgica. Cada posio branca do kernel desloca uma linha
+ * inteira da entrada, e a sada  o OR dos deslocamentos. D o mesmo
+ * resultado que a dilata para imagens float.
+ *
+ * Parmetros: ImagemBin* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a dilatao.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemBin* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void dilataBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out)
+{
+    _morfologiaBin (in, kernel, centro, out, 1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Eroso morfolgica. Como a dilataBin, mas com o AND dos deslocamentos.
+ *
+ * Parmetros: ImagemBin* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a eroso.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemBin* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void erodeBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out)
+{
+    _morfologiaBin (in, kernel, centro, out, 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Abertura morfolgica: eroso seguida de dilatao.
+ *
+ * Parmetros: ImagemBin* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a dilatao/eroso.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemBin* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *             ImagemBin* buffer: uma imagem com o mesmo tamanho da imagem de
+ *               entrada. Pode ser usada quando se quer evitar a alocao do
+ *               buffer interno. Use NULL se quiser usar o buffer interno.
+ *
+ * Valor de retorno: nenhum. */
+
+void aberturaBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out, ImagemBin* buffer)
+{
+    if (buffer && (in->largura != buffer->largura || in->altura != buffer->altura))
+    {
+        printf ("ERRO: aberturaBin: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    ImagemBin* img_aux = (buffer)? buffer : criaImagemBin (in->largura, in->altura);
+
+    erodeBin (in, kernel, centro, img_aux);
+    dilataBin (img_aux, kernel, centro, out);
+
+    if (!buffer)
+        destroiImagemBin (img_aux);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Fechamento morfolgico: dilatao seguida de eroso.
+ *
+ * Parmetros: ImagemBin* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a dilatao/eroso.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemBin* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *             ImagemBin* buffer: uma imagem com o mesmo tamanho da imagem de
+ *               entrada. Pode ser usada quando se quer evitar a alocao do
+ *               buffer interno. Use NULL se quiser usar o buffer interno.
+ *
+ * Valor de retorno: nenhum. */
+
+void fechamentoBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out, ImagemBin* buffer)
+{
+    if (buffer && (in->largura != buffer->largura || in->altura != buffer->altura))
+    {
+        printf ("ERRO: fechamentoBin: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    ImagemBin* img_aux = (buffer)? buffer : criaImagemBin (in->largura, in->altura);
+
+    dilataBin (in, kernel, centro, img_aux);
+    erodeBin (img_aux, kernel, centro, out);
+
+    if (!buffer)
+        destroiImagemBin (img_aux);
+}
+
+/*============================================================================*/
@@ -0,0 +1,61 @@
+/*============================================================================*/
+/* IMAGENS BINRIAS COMPACTAS                                                 */
+/*============================================================================*/
+/** Tipo e funes para imagens binrias com 1 bit por pixel. Cada linha 
+ * guardada em palavras de 64 bits, e as operaes morfolgicas trabalham com
+ * palavras inteiras (deslocamentos, ORs e ANDs), processando 64 pixels de
+ * cada vez. Uma mscara ocupa 1/32 da memria de uma Imagem de 1 canal. */
+/*============================================================================*/
+
+#ifndef __BINARIA_H
+#define __BINARIA_H
+
+/*============================================================================*/
+
+#include <stdint.h>
+#include "imagem.h"
+#include "geometria.h"
+
+/*============================================================================*/
+
+typedef struct
+{
+	int largura;
+	int altura;
+	int palavras; /* Nmero de palavras de 64 bits por linha. */
+	uint64_t* bloco; /* Todas as linhas, em um nico bloco alinhado. */
+	uint64_t** dados; /* Ponteiros para as linhas. O pixel (x,y)  o bit x%64 de dados [y][x/64]. */
+} ImagemBin;
+
+/* L o pixel (x,y). No verifica os limites. */
+#define PIXEL_BIN(img,x,y) ((int) (((img)->dados [y][(x) >> 6] >> ((x) & 63)) & 1))
+
+/*----------------------------------------------------------------------------*/
+
+ImagemBin* criaImagemBin (int largura, int altura);
+void destroiImagemBin (ImagemBin* img);
+void copiaConteudoBin (ImagemBin* in, ImagemBin* out);
+void trocaImagensBin (ImagemBin** a, ImagemBin** b);
+
+/* Converses. */
+void imagemParaBin (Imagem* in, int canal, float threshold, ImagemBin* out);
+void binParaImagem (ImagemBin* in, Imagem* out);
+void U8ParaBin (ImagemU8* in, ImagemBin* out);
+void binParaU8 (ImagemBin* in, ImagemU8* out);
+
+/* Arquivos. */
+int salvaImagemBin (ImagemBin* img, char* arquivo);
+
+/* Morfologia. */
+void dilataBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out);
+void erodeBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out);
+void aberturaBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out, ImagemBin* buffer);
+void fechamentoBin (ImagemBin* in, Imagem* kernel, Coordenada centro, ImagemBin* out, ImagemBin* buffer);
+
+/* Ncleos da imagemParaBin e da morfologia, uma linha por vez. Para o
+ * processamento em fluxo (ver fluxo.h). */
+void _linhaParaBin (const float* lin, int largura, float threshold, uint64_t* out);
+void _morfologiaLinhaBin (const uint64_t** linhas, int palavras, int largura, Imagem* kernel, Coordenada centro, int dilatacao, uint64_t* deslocada, uint64_t* lin_out);
+
+/*============================================================================*/
+#endif /* __BINARIA_H */
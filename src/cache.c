@@ -0,0 +1,431 @@
+/*============================================================================*/
+/* CACHE DE RESULTADOS                                                        */
+/*============================================================================*/
+/** Cache em disco de resultados, com chave pelo contedo da entrada. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+/*============================================================================*/
+
+#define CACHE_MAX_DIRETORIO 512
+#define CACHE_MAX_CAMINHO 1024 /* O diretrio, mais o nome de um arquivo. */
+#define CACHE_MAGICO 0x435a5241 /* "ARZC". */
+#define CACHE_VERSAO 1
+#define CACHE_FRACAO_LIMPEZA 10 /* Limpa depois de escrever 1/10 do limite. */
+#define CACHE_IDADE_TEMPORARIO 3600 /* Temporrios mais velhos (em s) so restos de processos que morreram. */
+
+/* O incio de cada arquivo do cache. */
+typedef struct
+{
+    uint32_t magico;
+    uint32_t versao;
+    ChaveCache chave;
+    uint64_t tamanho; /* Bytes do resultado, que vm logo depois. */
+} CabecalhoCache;
+
+/* Um arquivo do cache, para a limpeza. */
+typedef struct
+{
+    char nome [64];
+    time_t uso;
+    size_t bytes;
+} ArquivoCache;
+
+/* Estado global do cache. */
+int cache_ativo = 0;
+char cache_diretorio [CACHE_MAX_DIRETORIO];
+size_t cache_limite = 0;
+size_t cache_escritos = 0; /* Bytes guardados desde a ltima limpeza. */
+unsigned long cache_temporarios = 0; /* Para nomes nicos dos temporrios. */
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER; /* Protege cache_escritos e cache_temporarios. */
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Mistura final de um hash de 64 bits (a do MurmurHash3), para que cada bit
+ * da entrada afete todos os bits da sada. */
+
+uint64_t _cacheMistura (uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (h);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Hash de 128 bits de um bloco de bytes: duas sequncias independentes de
+ * 64 bits, que consomem 8 bytes por passo.  rpido, mas no criptogrfico:
+ * serve para reconhecer arquivos iguais, e no para resistir a ataques.
+ *
+ * Parmetros: const unsigned char* dados: os bytes.
+ *             size_t n: nmero de bytes.
+ *             ChaveCache* chave: entrada e sada. O valor inicial funciona
+ *               como semente, e recebe o hash.
+ *
+ * Valor de retorno: NENHUM */
+
+void _cacheHash (const unsigned char* dados, size_t n, ChaveCache* chave)
+{
+    uint64_t h1 = chave->h [0] ^ n, h2 = chave->h [1], palavra;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        memcpy (&palavra, dados + i, 8);
+        h1 = (h1 ^ palavra) * 0x9e3779b97f4a7c15ULL;
+        h1 ^= h1 >> 32;
+        h2 = (h2 + palavra) * 0xc2b2ae3d27d4eb4fULL;
+        h2 = (h2 << 31) | (h2 >> 33);
+    }
+
+    /* Os bytes que sobraram, completados com zeros. */
+    palavra = 0;
+    if (n > i)
+        memcpy (&palavra, dados + i, n - i);
+    h1 = (h1 ^ palavra) * 0x9e3779b97f4a7c15ULL;
+    h2 = (h2 + palavra) * 0xc2b2ae3d27d4eb4fULL;
+
+    chave->h [0] = _cacheMistura (h1 ^ (h2 >> 17));
+    chave->h [1] = _cacheMistura (h2 ^ (h1 << 13));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Monta o caminho do arquivo de uma chave.
+ *
+ * Parmetros: const ChaveCache* chave: a chave.
+ *             char* caminho: sada, com CACHE_MAX_CAMINHO posies.
+ *
+ * Valor de retorno: NENHUM */
+
+void _cacheCaminho (const ChaveCache* chave, char* caminho)
+{
+    snprintf (caminho, CACHE_MAX_CAMINHO, "%s/%016llx%016llx", cache_diretorio,
+              (unsigned long long) chave->h [0], (unsigned long long) chave->h [1]);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Funo de comparao para ordenar os arquivos do mais velho para o mais
+ * novo uso. */
+
+int _cacheComparaUso (const void* a, const void* b)
+{
+    time_t ua = ((const ArquivoCache*) a)->uso, ub = ((const ArquivoCache*) b)->uso;
+    return ((ua > ub) - (ua < ub));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Confere o tamanho total do cache e, se ele passou do limite, remove os
+ * resultados usados h mais tempo, at ficar em 90% do limite. Remove
+ * tambm os temporrios abandonados. S um processo limpa de cada vez.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: NENHUM */
+
+void _cacheLimpa (void)
+{
+    char caminho [CACHE_MAX_CAMINHO];
+    ArquivoCache* arquivos = NULL;
+    size_t n = 0, capacidade = 0, total = 0, i;
+    struct dirent* entrada;
+    struct stat info;
+    time_t agora = time (NULL);
+    DIR* dir;
+    int trava;
+
+    snprintf (caminho, sizeof (caminho), "%s/.trava", cache_diretorio);
+    trava = open (caminho, O_RDWR|O_CREAT, 0644);
+    if (trava < 0)
+        return;
+    if (flock (trava, LOCK_EX) != 0 || !(dir = opendir (cache_diretorio)))
+    {
+        close (trava);
+        return;
+    }
+
+    while ((entrada = readdir (dir)))
+    {
+        int temporario = (strncmp (entrada->d_name, ".tmp.", 5) == 0);
+
+        if ((entrada->d_name [0] == '.' && !temporario) || strlen (entrada->d_name) >= sizeof (arquivos->nome))
+            continue;
+
+        snprintf (caminho, sizeof (caminho), "%s/%s", cache_diretorio, entrada->d_name);
+        if (stat (caminho, &info) != 0 || !S_ISREG (info.st_mode))
+            continue;
+
+        if (temporario)
+        {
+            if (agora - info.st_mtime > CACHE_IDADE_TEMPORARIO)
+                unlink (caminho);
+            continue;
+        }
+
+        if (n == capacidade)
+        {
+            capacidade = capacidade? capacidade*2 : 256;
+            arquivos = (ArquivoCache*) realloc (arquivos, sizeof (ArquivoCache) * capacidade);
+        }
+        strcpy (arquivos [n].nome, entrada->d_name);
+        arquivos [n].uso = info.st_mtime;
+        arquivos [n].bytes = (size_t) info.st_size;
+        total += arquivos [n].bytes;
+        n++;
+    }
+    closedir (dir);
+
+    if (total > cache_limite)
+    {
+        qsort (arquivos, n, sizeof (ArquivoCache), _cacheComparaUso);
+        for (i = 0; i < n && total > cache_limite / 10 * 9; i++)
+        {
+            snprintf (caminho, sizeof (caminho), "%s/%s", cache_diretorio, arquivos [i].nome);
+            if (unlink (caminho) == 0)
+                total -= arquivos [i].bytes;
+        }
+    }
+
+    free (arquivos);
+    flock (trava, LOCK_UN);
+    close (trava);
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Inicia o cache em um diretrio, que  criado se no existir. Se o
+ * diretrio j tiver mais que o limite, os resultados mais velhos so
+ * removidos.
+ *
+ * Parmetros: const char* diretorio: o diretrio do cache.
+ *             size_t limite_bytes: tamanho mximo do cache. O limite pode
+ *               ser ultrapassado em at 1/10 entre uma limpeza e outra (por
+ *               processo usando o cache).
+ *
+ * Valor de retorno: 1 se o cache pode ser usado, 0 do contrrio. */
+
+int cacheInicia (const char* diretorio, size_t limite_bytes)
+{
+    struct stat info;
+
+    if (strlen (diretorio) >= CACHE_MAX_DIRETORIO)
+    {
+        printf ("cacheInicia: caminho longo demais.\n");
+        return (0);
+    }
+
+    mkdir (diretorio, 0755);
+    if (stat (diretorio, &info) != 0 || !S_ISDIR (info.st_mode) || access (diretorio, R_OK|W_OK|X_OK) != 0)
+    {
+        printf ("cacheInicia: nao foi possivel usar o diretorio %s.\n", diretorio);
+        return (0);
+    }
+
+    strcpy (cache_diretorio, diretorio);
+    cache_limite = limite_bytes;
+    cache_escritos = 0;
+    _cacheLimpa ();
+    cache_ativo = 1;
+    return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Termina o uso do cache. O contedo continua no diretrio.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: NENHUM */
+
+void cacheFinaliza (void)
+{
+    cache_ativo = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Calcula a chave de um arquivo de entrada: o hash dos bytes do arquivo
+ * (que no  decodificado) e dos parmetros.
+ *
+ * Parmetros: const char* caminho: o arquivo.
+ *             const char* parametros: descrio dos parmetros que afetam o
+ *               resultado. Qualquer texto que mude quando eles mudam.
+ *             ChaveCache* chave: sada.
+ *
+ * Valor de retorno: 1 se no ocorreram erros, 0 se o arquivo no pde ser
+ *                   lido. */
+
+int cacheChaveArquivo (const char* caminho, const char* parametros, ChaveCache* chave)
+{
+    struct stat info;
+    unsigned char* dados = NULL;
+    int fd = open (caminho, O_RDONLY);
+
+    if (fd < 0)
+        return (0);
+    if (fstat (fd, &info) != 0 || !S_ISREG (info.st_mode))
+    {
+        close (fd);
+        return (0);
+    }
+
+    if (info.st_size > 0)
+    {
+        dados = (unsigned char*) mmap (NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (dados == MAP_FAILED)
+        {
+            close (fd);
+            return (0);
+        }
+        madvise (dados, (size_t) info.st_size, MADV_SEQUENTIAL);
+    }
+    close (fd);
+
+    /* Os parmetros viram a semente do hash do arquivo. */
+    chave->h [0] = 0x243f6a8885a308d3ULL;
+    chave->h [1] = 0x13198a2e03707344ULL;
+    _cacheHash ((const unsigned char*) parametros, strlen (parametros), chave);
+    _cacheHash (dados, (size_t) info.st_size, chave);
+
+    if (dados)
+        munmap (dados, (size_t) info.st_size);
+    return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Deriva uma chave de outra e de um texto, como a chave de uma etapa a
+ * partir da chave da entrada e dos parmetros da etapa.
+ *
+ * Parmetros: ChaveCache* chave: entrada e sada. A chave original, que
+ *               recebe a nova.
+ *             const char* texto: o texto.
+ *
+ * Valor de retorno: NENHUM */
+
+void cacheCombinaChave (ChaveCache* chave, const char* texto)
+{
+    _cacheHash ((const unsigned char*) texto, strlen (texto), chave);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Procura um resultado no cache. Se ele for encontrado, passa a ser o
+ * usado mais recentemente.
+ *
+ * Parmetros: const ChaveCache* chave: a chave.
+ *             size_t* tamanho: sada. O nmero de bytes do resultado.
+ *
+ * Valor de retorno: uma cpia do resultado (alocada com malloc; a
+ *                   responsabilidade por desaloc-la  do chamador), ou NULL
+ *                   se ele no est no cache. */
+
+void* cacheBusca (const ChaveCache* chave, size_t* tamanho)
+{
+    char caminho [CACHE_MAX_CAMINHO];
+    CabecalhoCache cabecalho;
+    void* dados;
+    int fd;
+
+    if (!cache_ativo)
+        return (NULL);
+
+    _cacheCaminho (chave, caminho);
+    fd = open (caminho, O_RDONLY);
+    if (fd < 0)
+        return (NULL);
+
+    if (read (fd, &cabecalho, sizeof (cabecalho)) != (ssize_t) sizeof (cabecalho) ||
+        cabecalho.magico != CACHE_MAGICO || cabecalho.versao != CACHE_VERSAO ||
+        memcmp (&cabecalho.chave, chave, sizeof (ChaveCache)) != 0 || cabecalho.tamanho > ((size_t) 1 << 30))
+    {
+        close (fd);
+        return (NULL);
+    }
+
+    dados = malloc (cabecalho.tamanho? cabecalho.tamanho : 1);
+    if (read (fd, dados, cabecalho.tamanho) != (ssize_t) cabecalho.tamanho)
+    {
+        free (dados);
+        close (fd);
+        return (NULL);
+    }
+
+    /* Marca o uso, para a remoo dos mais velhos. */
+    futimens (fd, NULL);
+    close (fd);
+
+    *tamanho = cabecalho.tamanho;
+    return (dados);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Guarda um resultado no cache, substituindo o que houver com a mesma
+ * chave. Erros de escrita so ignorados: o resultado s no fica guardado.
+ *
+ * Parmetros: const ChaveCache* chave: a chave.
+ *             const void* dados: o resultado.
+ *             size_t tamanho: nmero de bytes do resultado.
+ *
+ * Valor de retorno: NENHUM */
+
+void cacheGuarda (const ChaveCache* chave, const void* dados, size_t tamanho)
+{
+    char caminho [CACHE_MAX_CAMINHO], temporario [CACHE_MAX_CAMINHO];
+    CabecalhoCache cabecalho;
+    unsigned long n;
+    int fd, ok, limpar;
+
+    if (!cache_ativo)
+        return;
+
+    pthread_mutex_lock (&cache_mutex);
+    n = cache_temporarios++;
+    pthread_mutex_unlock (&cache_mutex);
+
+    _cacheCaminho (chave, caminho);
+    snprintf (temporario, sizeof (temporario), "%s/.tmp.%ld.%lu", cache_diretorio, (long) getpid (), n);
+
+    fd = open (temporario, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    memset (&cabecalho, 0, sizeof (cabecalho));
+    cabecalho.magico = CACHE_MAGICO;
+    cabecalho.versao = CACHE_VERSAO;
+    cabecalho.chave = *chave;
+    cabecalho.tamanho = tamanho;
+    ok = (write (fd, &cabecalho, sizeof (cabecalho)) == (ssize_t) sizeof (cabecalho) &&
+          write (fd, dados, tamanho) == (ssize_t) tamanho);
+    ok = (close (fd) == 0) && ok;
+
+    /* S aparece com o nome final quando est completo. */
+    if (!ok || rename (temporario, caminho) != 0)
+    {
+        unlink (temporario);
+        return;
+    }
+
+    pthread_mutex_lock (&cache_mutex);
+    cache_escritos += sizeof (cabecalho) + tamanho;
+    limpar = (cache_escritos >= cache_limite / CACHE_FRACAO_LIMPEZA);
+    if (limpar)
+        cache_escritos = 0;
+    pthread_mutex_unlock (&cache_mutex);
+
+    if (limpar)
+        _cacheLimpa ();
+}
+
+/*============================================================================*/
@@ -0,0 +1,44 @@
+/*============================================================================*/
+/* CACHE DE RESULTADOS                                                        */
+/*============================================================================*/
+/** Cache persistente, em disco, de resultados por imagem. A chave  um hash
+ * rpido dos bytes do arquivo de entrada, combinado com uma descrio dos
+ * parmetros do processamento: se o arquivo ou os parmetros mudam, a chave
+ * muda. Os resultados so blocos de bytes, cujo formato  de quem chama.
+ *
+ * Cada resultado fica em um arquivo do diretrio do cache. Os arquivos so
+ * escritos com outro nome e renomeados no fim, ento um leitor nunca v um
+ * resultado pela metade, e vrios processos podem usar o mesmo diretrio ao
+ * mesmo tempo. O tamanho total tem um limite: quando ele  ultrapassado, os
+ * resultados usados h mais tempo so removidos (a data de modificao de
+ * cada arquivo  atualizada a cada uso). A limpeza  feita por um processo
+ * de cada vez, com uma trava (flock) no diretrio.
+ *
+ * As funes podem ser chamadas de vrias threads ao mesmo tempo. Enquanto o
+ * cache no for iniciado (cacheInicia), nada  encontrado nem guardado. */
+/*============================================================================*/
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*============================================================================*/
+
+typedef struct
+{
+    uint64_t h [2];
+} ChaveCache;
+
+int cacheInicia (const char* diretorio, size_t limite_bytes);
+void cacheFinaliza (void);
+int cacheChaveArquivo (const char* caminho, const char* parametros, ChaveCache* chave);
+void cacheCombinaChave (ChaveCache* chave, const char* texto);
+void* cacheBusca (const ChaveCache* chave, size_t* tamanho);
+void cacheGuarda (const ChaveCache* chave, const void* dados, size_t tamanho);
+
+/*============================================================================*/
+#endif /* __CACHE_H */
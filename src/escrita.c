@@ -0,0 +1,306 @@
+/*============================================================================*/
+/* ESCRITA ASSNCRONA DE IMAGENS                                              */
+/*============================================================================*/
+/** Fila de imagens a salvar, atendida por uma thread de E/S. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "escrita.h"
+#include "pool.h"
+
+/*============================================================================*/
+
+#define ESCRITA_IMAGEM 0
+#define ESCRITA_U8 1
+#define ESCRITA_BIN 2
+
+/* Um pedido de escrita: uma cpia da imagem, que pertence  fila. */
+typedef struct _PedidoEscrita
+{
+    int tipo; /* ESCRITA_IMAGEM, ESCRITA_U8 ou ESCRITA_BIN. */
+    void* img;
+    char* arquivo;
+    size_t bytes; /* Memria ocupada pela cpia, para o limite da fila. */
+    struct _PedidoEscrita* proximo;
+} PedidoEscrita;
+
+/* Estado global da escrita. */
+int escrita_ativa = 0;
+size_t escrita_limite = 0;
+size_t escrita_bytes_na_fila = 0;
+int escrita_pendentes = 0; /* Pedidos na fila ou sendo escritos. */
+int escrita_erros = 0;
+int escrita_terminar = 0;
+PedidoEscrita* escrita_primeiro = NULL;
+PedidoEscrita* escrita_ultimo = NULL;
+pthread_t escrita_thread;
+pthread_mutex_t escrita_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t escrita_tem_pedido = PTHREAD_COND_INITIALIZER; /* Sinalizada quando entra um pedido (ou ao terminar). */
+pthread_cond_t escrita_tem_espaco = PTHREAD_COND_INITIALIZER; /* Sinalizada quando um pedido termina. */
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Salva a imagem de um pedido e libera a cpia.
+ *
+ * Parmetros: PedidoEscrita* pedido: o pedido.
+ *
+ * Valor de retorno: 0 se ocorreu algum erro, 1 do contrrio. */
+
+int _escritaSalva (PedidoEscrita* pedido)
+{
+    int ok;
+
+    if (pedido->tipo == ESCRITA_IMAGEM)
+    {
+        ok = salvaImagem ((Imagem*) pedido->img, pedido->arquivo);
+        destroiImagem ((Imagem*) pedido->img);
+    }
+    else if (pedido->tipo == ESCRITA_U8)
+    {
+        ok = salvaImagemU8 ((ImagemU8*) pedido->img, pedido->arquivo);
+        destroiImagemU8 ((ImagemU8*) pedido->img);
+    }
+    else
+    {
+        ok = salvaImagemBin ((ImagemBin*) pedido->img, pedido->arquivo);
+        destroiImagemBin ((ImagemBin*) pedido->img);
+    }
+
+    if (!ok)
+        printf ("ERRO: escrita: nao foi possivel salvar %s.\n", pedido->arquivo);
+    return (ok);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Lao da thread de E/S: tira pedidos da fila e os salva, at que a escrita
+ * seja finalizada e a fila esvazie.
+ *
+ * Parmetros: void* arg: no usado.
+ *
+ * Valor de retorno: NULL. */
+
+void* _escritaThread (void* arg)
+{
+    PedidoEscrita* pedido;
+    int ok;
+    (void) arg;
+
+    pthread_mutex_lock (&escrita_mutex);
+    for (;;)
+    {
+        while (!escrita_primeiro && !escrita_terminar)
+            pthread_cond_wait (&escrita_tem_pedido, &escrita_mutex);
+        if (!escrita_primeiro)
+            break; // Terminou e a fila est vazia.
+
+        pedido = escrita_primeiro;
+        escrita_primeiro = pedido->proximo;
+        if (!escrita_primeiro)
+            escrita_ultimo = NULL;
+
+        // A escrita em si acontece fora da regio crtica.
+        pthread_mutex_unlock (&escrita_mutex);
+        ok = _escritaSalva (pedido);
+        pthread_mutex_lock (&escrita_mutex);
+
+        if (!ok)
+            escrita_erros++;
+        escrita_bytes_na_fila -= pedido->bytes;
+        escrita_pendentes--;
+        pthread_cond_broadcast (&escrita_tem_espaco);
+
+        free (pedido->arquivo);
+        free (pedido);
+    }
+    pthread_mutex_unlock (&escrita_mutex);
+
+    return (NULL);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Coloca um pedido na fila. Se a fila estiver cheia, espera at ter espao
+ * (um pedido maior que o limite entra quando a fila estiver vazia).
+ *
+ * Parmetros: int tipo: tipo da imagem.
+ *             void* img: cpia da imagem. Passa a pertencer  fila.
+ *             size_t bytes: memria ocupada pela cpia.
+ *             char* arquivo: caminho do arquivo a salvar.
+ *
+ * Valor de retorno: nenhum. */
+
+void _escritaEnfileira (int tipo, void* img, size_t bytes, char* arquivo)
+{
+    PedidoEscrita* pedido = (PedidoEscrita*) malloc (sizeof (PedidoEscrita));
+    pedido->tipo = tipo;
+    pedido->img = img;
+    pedido->arquivo = (char*) malloc (strlen (arquivo) + 1);
+    strcpy (pedido->arquivo, arquivo);
+    pedido->bytes = bytes;
+    pedido->proximo = NULL;
+
+    pthread_mutex_lock (&escrita_mutex);
+    while (escrita_pendentes > 0 && escrita_bytes_na_fila + bytes > escrita_limite)
+        pthread_cond_wait (&escrita_tem_espaco, &escrita_mutex);
+
+    if (escrita_ultimo)
+        escrita_ultimo->proximo = pedido;
+    else
+        escrita_primeiro = pedido;
+    escrita_ultimo = pedido;
+    escrita_bytes_na_fila += bytes;
+    escrita_pendentes++;
+
+    pthread_cond_signal (&escrita_tem_pedido);
+    pthread_mutex_unlock (&escrita_mutex);
+}
+
+/*============================================================================*/
+/* INCIO E FIM                                                               */
+/*============================================================================*/
+/** Inicia a thread de E/S. A partir daqui, as funes escritaImagem* apenas
+ * copiam a imagem e a colocam na fila.
+ *
+ * Parmetros: size_t limite_bytes: memria mxima ocupada pelas cpias que
+ *               esto esperando na fila. Quando o limite  atingido, quem
+ *               pede uma escrita espera.
+ *
+ * Valor de retorno: nenhum. */
+
+void escritaInicia (size_t limite_bytes)
+{
+    if (escrita_ativa)
+        return;
+
+    escrita_limite = limite_bytes;
+    escrita_terminar = 0;
+    escrita_erros = 0;
+
+    if (pthread_create (&escrita_thread, NULL, _escritaThread, NULL) != 0)
+    {
+        printf ("ERRO: escritaInicia: nao foi possivel criar a thread de E/S. Usando escrita sincrona.\n");
+        return;
+    }
+
+    escrita_ativa = 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Espera todos os pedidos pendentes serem escritos, e termina a thread de
+ * E/S. Depois disso, as escritas voltam a ser sncronas.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: o nmero de imagens que no puderam ser salvas. */
+
+int escritaFinaliza (void)
+{
+    int erros;
+
+    if (!escrita_ativa)
+        return (0);
+
+    pthread_mutex_lock (&escrita_mutex);
+    escrita_terminar = 1;
+    pthread_cond_signal (&escrita_tem_pedido);
+    pthread_mutex_unlock (&escrita_mutex);
+
+    pthread_join (escrita_thread, NULL);
+    escrita_ativa = 0;
+
+    erros = escrita_erros;
+    escrita_erros = 0;
+    return (erros);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Espera todos os pedidos pendentes serem escritos, sem terminar a thread.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: nenhum. */
+
+void escritaEspera (void)
+{
+    if (!escrita_ativa)
+        return;
+
+    pthread_mutex_lock (&escrita_mutex);
+    while (escrita_pendentes > 0)
+        pthread_cond_wait (&escrita_tem_espaco, &escrita_mutex);
+    pthread_mutex_unlock (&escrita_mutex);
+}
+
+/*============================================================================*/
+/* PEDIDOS                                                                    */
+/*============================================================================*/
+/** Salva uma imagem em um arquivo dado (ver salvaImagem). Com a escrita
+ * assncrona ativa, a imagem  copiada e pode ser alterada logo em seguida.
+ *
+ * Parmetros: Imagem* img: imagem a salvar.
+ *             char* arquivo: caminho do arquivo a salvar.
+ *
+ * Valor de retorno: nenhum. Erros so informados na sada padro e contados
+ *                   em escritaFinaliza. */
+
+void escritaImagem (Imagem* img, char* arquivo)
+{
+    if (!escrita_ativa)
+    {
+        if (!salvaImagem (img, arquivo))
+            printf ("ERRO: escrita: nao foi possivel salvar %s.\n", arquivo);
+        return;
+    }
+
+    _escritaEnfileira (ESCRITA_IMAGEM, clonaImagem (img),
+                       sizeof (float) * img->largura * img->altura * img->n_canais, arquivo);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Salva uma imagem de 8 bits em um arquivo dado. Ver escritaImagem.
+ *
+ * Parmetros: ImagemU8* img: imagem a salvar.
+ *             char* arquivo: caminho do arquivo a salvar.
+ *
+ * Valor de retorno: nenhum. */
+
+void escritaImagemU8 (ImagemU8* img, char* arquivo)
+{
+    if (!escrita_ativa)
+    {
+        if (!salvaImagemU8 (img, arquivo))
+            printf ("ERRO: escrita: nao foi possivel salvar %s.\n", arquivo);
+        return;
+    }
+
+    _escritaEnfileira (ESCRITA_U8, clonaImagemU8 (img), (size_t) img->largura * img->altura, arquivo);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Salva uma imagem binria em um arquivo dado. Ver escritaImagem.
+ *
+ * Parmetros: ImagemBin* img: imagem a salvar.
+ *             char* arquivo: caminho do arquivo a salvar.
+ *
+ * Valor de retorno: nenhum. */
+
+void escritaImagemBin (ImagemBin* img, char* arquivo)
+{
+    ImagemBin* copia;
+
+    if (!escrita_ativa)
+    {
+        if (!salvaImagemBin (img, arquivo))
+            printf ("ERRO: escrita: nao foi possivel salvar %s.\n", arquivo);
+        return;
+    }
+
+    copia = criaImagemBin (img->largura, img->altura);
+    copiaConteudoBin (img, copia);
+    _escritaEnfileira (ESCRITA_BIN, copia, sizeof (uint64_t) * img->palavras * img->altura, arquivo);
+}
+
+/*============================================================================*/
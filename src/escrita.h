@@ -0,0 +1,35 @@
+/*============================================================================*/
+/* ESCRITA ASSNCRONA DE IMAGENS                                              */
+/*============================================================================*/
+/** Fila de imagens a salvar, atendida por uma thread de E/S. Quem pede a
+ * escrita recebe o controle de volta logo depois de uma cpia da imagem
+ * (feita com o pool), e a codificao e a escrita no disco acontecem em
+ * paralelo com o processamento.
+ *
+ * A fila tem um limite de memria: se as cpias pendentes passarem do
+ * limite, o pedido espera a thread de E/S liberar espao. Enquanto a escrita
+ * assncrona no for iniciada (escritaInicia), os pedidos so atendidos na
+ * hora, com as funes salvaImagem* comuns. */
+/*============================================================================*/
+
+#ifndef __ESCRITA_H
+#define __ESCRITA_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+#include "imagem.h"
+#include "binaria.h"
+
+/*============================================================================*/
+
+void escritaInicia (size_t limite_bytes);
+int escritaFinaliza (void);
+void escritaEspera (void);
+
+void escritaImagem (Imagem* img, char* arquivo);
+void escritaImagemU8 (ImagemU8* img, char* arquivo);
+void escritaImagemBin (ImagemBin* img, char* arquivo);
+
+/*============================================================================*/
+#endif /* __ESCRITA_H */
@@ -0,0 +1,215 @@
+/*============================================================================*/
+/* ETAPAS INSPECIONVEIS                                                      */
+/*============================================================================*/
+/** Registro das etapas cujo resultado pode ser salvo para inspeo. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "etapas.h"
+#include "escrita.h"
+
+/*============================================================================*/
+
+#define ETAPAS_MAX_NOME 32
+
+/* Estado global do registro. Por padro, todas as etapas so salvas. */
+int etapas_n = 0;
+char etapas_nomes [ETAPAS_MAX][ETAPAS_MAX_NOME];
+int etapas_ativas [ETAPAS_MAX];
+int etapas_todas = 1; /* Se != 0, etapas registradas depois tambm ficam ativas. */
+char etapas_diretorio [256] = "../resultados";
+
+/*============================================================================*/
+/* REGISTRO E SELEO                                                         */
+/*============================================================================*/
+/** Registra uma etapa. Vrias etapas podem ter o mesmo nome (por exemplo, uma
+ * normalizao feita duas vezes); elas se diferenciam pelo nmero.
+ *
+ * Parmetros: const char* nome: nome da etapa, usado no nome do arquivo e na
+ *               seleo.
+ *
+ * Valor de retorno: o nmero da etapa (1, 2, ...), ou 0 se o registro estiver
+ *                   cheio. Uma etapa 0 nunca  salva. */
+
+int etapaRegistra (const char* nome)
+{
+    if (etapas_n >= ETAPAS_MAX)
+    {
+        printf ("ERRO: etapaRegistra: muitas etapas (maximo %d).\n", ETAPAS_MAX);
+        return (0);
+    }
+
+    strncpy (etapas_nomes [etapas_n], nome, ETAPAS_MAX_NOME-1);
+    etapas_nomes [etapas_n][ETAPAS_MAX_NOME-1] = 0;
+    etapas_ativas [etapas_n] = etapas_todas;
+    etapas_n++;
+    return (etapas_n);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Escolhe as etapas a salvar, substituindo a seleo anterior.
+ *
+ * Parmetros: const char* lista: "todas", "nenhuma", ou uma lista separada
+ *               por vrgulas com nomes e/ou nmeros de etapas. Um nome liga
+ *               todas as etapas com aquele nome; um nmero liga s a etapa
+ *               com aquele nmero. As etapas registradas depois da seleo
+ *               s ficam ligadas com "todas".
+ *
+ * Valor de retorno: 0 se algum item da lista no corresponde a nenhuma etapa
+ *                   registrada, 1 do contrrio. */
+
+int etapaSeleciona (const char* lista)
+{
+    char item [ETAPAS_MAX_NOME];
+    const char* fim;
+    size_t tamanho;
+    int i, numero, encontrou, ok = 1;
+
+    etapas_todas = (strcmp (lista, "todas") == 0);
+    for (i = 0; i < etapas_n; i++)
+        etapas_ativas [i] = etapas_todas;
+
+    if (etapas_todas || strcmp (lista, "nenhuma") == 0)
+        return (1);
+
+    while (*lista)
+    {
+        fim = strchr (lista, ',');
+        tamanho = (fim)? (size_t) (fim - lista) : strlen (lista);
+        if (tamanho >= ETAPAS_MAX_NOME)
+            tamanho = ETAPAS_MAX_NOME-1;
+        memcpy (item, lista, tamanho);
+        item [tamanho] = 0;
+
+        if (tamanho > 0)
+        {
+            numero = atoi (item);
+            encontrou = 0;
+            for (i = 0; i < etapas_n; i++)
+                if ((numero > 0 && numero == i+1) || strcmp (item, etapas_nomes [i]) == 0)
+                {
+                    etapas_ativas [i] = 1;
+                    encontrou = 1;
+                }
+
+            if (!encontrou)
+            {
+                printf ("ERRO: etapaSeleciona: etapa desconhecida: %s\n", item);
+                ok = 0;
+            }
+        }
+
+        lista += tamanho;
+        if (*lista == ',')
+            lista++;
+    }
+
+    return (ok);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Muda o diretrio onde os arquivos das etapas so salvos.
+ *
+ * Parmetros: const char* diretorio: o diretrio (sem a barra no final).
+ *
+ * Valor de retorno: nenhum. */
+
+void etapaDiretorio (const char* diretorio)
+{
+    strncpy (etapas_diretorio, diretorio, sizeof (etapas_diretorio)-1);
+    etapas_diretorio [sizeof (etapas_diretorio)-1] = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Verifica se uma etapa deve ser salva. til para evitar trabalho que s
+ * serve para a inspeo.
+ *
+ * Parmetros: int etapa: nmero da etapa.
+ *
+ * Valor de retorno: 1 se a etapa est ligada, 0 do contrrio. */
+
+int etapaAtiva (int etapa)
+{
+    return (etapa > 0 && etapa <= etapas_n && etapas_ativas [etapa-1]);
+}
+
+/*============================================================================*/
+/* ESCRITA                                                                    */
+/*============================================================================*/
+/** Monta o nome do arquivo de uma etapa.
+ *
+ * Parmetros: int etapa: nmero da etapa.
+ *             const char* imagem: identificao da imagem processada.
+ *             char* arquivo: sada, com pelo menos 320 posies.
+ *
+ * Valor de retorno: nenhum. */
+
+void _etapaArquivo (int etapa, const char* imagem, char* arquivo)
+{
+    snprintf (arquivo, 320, "%s/%s%d - %s.bmp", etapas_diretorio, imagem, etapa, etapas_nomes [etapa-1]);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Salva o resultado de uma etapa, se ela estiver ligada.
+ *
+ * Parmetros: int etapa: nmero da etapa.
+ *             const char* imagem: identificao da imagem processada (o
+ *               comeo do nome do arquivo, por exemplo "1" ou "bandeja7_").
+ *             Imagem* img: resultado da etapa.
+ *
+ * Valor de retorno: nenhum. */
+
+void etapaSalva (int etapa, const char* imagem, Imagem* img)
+{
+    char arquivo [320];
+
+    if (!etapaAtiva (etapa))
+        return;
+
+    _etapaArquivo (etapa, imagem, arquivo);
+    escritaImagem (img, arquivo);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Salva o resultado de uma etapa com imagem de 8 bits. Ver etapaSalva.
+ *
+ * Parmetros: int etapa: nmero da etapa.
+ *             const char* imagem: identificao da imagem processada.
+ *             ImagemU8* img: resultado da etapa.
+ *
+ * Valor de retorno: nenhum. */
+
+void etapaSalvaU8 (int etapa, const char* imagem, ImagemU8* img)
+{
+    char arquivo [320];
+
+    if (!etapaAtiva (etapa))
+        return;
+
+    _etapaArquivo (etapa, imagem, arquivo);
+    escritaImagemU8 (img, arquivo);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Salva o resultado de uma etapa com imagem binria. Ver etapaSalva.
+ *
+ * Parmetros: int etapa: nmero da etapa.
+ *             const char* imagem: identificao da imagem processada.
+ *             ImagemBin* img: resultado da etapa.
+ *
+ * Valor de retorno: nenhum. */
+
+void etapaSalvaBin (int etapa, const char* imagem, ImagemBin* img)
+{
+    char arquivo [320];
+
+    if (!etapaAtiva (etapa))
+        return;
+
+    _etapaArquivo (etapa, imagem, arquivo);
+    escritaImagemBin (img, arquivo);
+}
+
+/*============================================================================*/
@@ -0,0 +1,37 @@
+/*============================================================================*/
+/* ETAPAS INSPECIONVEIS                                                      */
+/*============================================================================*/
+/** Registro das etapas de um processamento cujo resultado pode ser salvo
+ * para inspeo. Cada etapa recebe um nome e um nmero (a ordem de
+ * registro); quais etapas so salvas  escolhido em tempo de execuo.
+ *
+ * As funes etapaSalva* no fazem nada para uma etapa desligada: a imagem
+ * no  copiada, convertida nem codificada. Para etapas ligadas, o arquivo 
+ * "<diretrio>/<imagem><etapa> - <nome>.bmp", onde <imagem>  um texto dado
+ * por quem salva. Ele  escrito com as funes escritaImagem* (ou seja, em
+ * segundo plano, se a escrita assncrona estiver ativa). */
+/*============================================================================*/
+
+#ifndef __ETAPAS_H
+#define __ETAPAS_H
+
+/*============================================================================*/
+
+#include "imagem.h"
+#include "binaria.h"
+
+/*============================================================================*/
+
+#define ETAPAS_MAX 32
+
+int etapaRegistra (const char* nome);
+int etapaSeleciona (const char* lista);
+void etapaDiretorio (const char* diretorio);
+int etapaAtiva (int etapa);
+
+void etapaSalva (int etapa, const char* imagem, Imagem* img);
+void etapaSalvaU8 (int etapa, const char* imagem, ImagemU8* img);
+void etapaSalvaBin (int etapa, const char* imagem, ImagemBin* img);
+
+/*============================================================================*/
+#endif /* __ETAPAS_H */
@@ -8,9 +8,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#endif
 #include "base.h"
 #include "filtros2d.h"
+#include "pool.h"
 
 /*============================================================================*/
 /* FILTRAGEM LINEAR GENRICA                                                  */
@@ -42,58 +48,329 @@ void filtro1D (Imagem* in, Imagem* out, float* coef, int n, int vertical)
         exit (1);
     }
 
-    int channel, row, col, i, pos;
-    float soma;
+    int channel, row, i;
     int centro = n/2;
+    const float** linhas = (vertical)? poolAloca (sizeof (float*) * n) : NULL;
 
-    // Para cada centro possvel...
+    // Para cada linha, filtra na horizontal, ou combina as linhas vizinhas.
     for (channel = 0; channel < in->n_canais; channel++)
     {
         for (row = 0; row < in->altura; row++)
         {
-            for (col = 0; col < in->largura; col++)
+            if (!vertical)
             {
-                soma = 0;
+                _filtro1DLinha (in->dados [channel][row], in->largura, coef, n, out->dados [channel][row]);
+                continue;
+            }
 
-                // Percorre o vetor de coeficientes.
-                for (i = -centro; i <= centro; i++)
-                {
-                    // Tratamento de margens com imagem espelhada.
-                    pos = ((vertical)? row : col) + i;
-
-                    if (pos < 0)
-                        pos = -pos;
-                    else if (!vertical && pos >= in->largura)
-                        pos = in->largura*2 - pos - 2;
-                    else if (vertical && pos >= in->altura)
-                        pos = in->altura*2 - pos - 2;
-
-                    if (vertical)
-                        soma += in->dados [channel][pos][col] * coef [centro + i];
-                    else
-                        soma += in->dados [channel][row][pos] * coef [centro + i];
-                }
+            for (i = 0; i < n; i++)
+                linhas [i] = in->dados [channel][_filtro1DEspelha (row - centro + i, in->altura)];
+            _filtro1DColunas (linhas, in->largura, coef, n, out->dados [channel][row]);
+        }
+    }
 
-                out->dados [channel][row][col] = soma;
-            }
+    if (linhas)
+        poolLibera (linhas);
+}
+
+/*----------------------------------------------------------------------------*/
+/* As funes abaixo so o ncleo da filtro1D, uma linha por vez. Elas tambm
+ * so usadas pelo processamento em fluxo (ver fluxo.h), que assim d
+ * exatamente o mesmo resultado.
+ *
+ * S as n/2 primeiras e as n/2 ltimas colunas de uma linha precisam tratar
+ * as margens. As outras (o interior) so calculadas sem desvios, vrias de
+ * uma vez, com instrues vetoriais (AVX2 ou AVX-512, escolhidas na primeira
+ * chamada, conforme o processador), ou com um lao simples nos outros
+ * processadores. Todas as verses somam os produtos na mesma ordem, ento o
+ * resultado no depende da verso usada. Com coeficientes simtricos (como
+ * os da Gaussiana), os pixels que usam o mesmo coeficiente so somados antes
+ * da multiplicao, o que corta metade das multiplicaes; o resultado muda
+ * s pelo arredondamento. */
+
+// Tratamento de margens com imagem espelhada: a posio de fato lida para a posio pos.
+int _filtro1DEspelha (int pos, int tamanho)
+{
+    if (pos < 0)
+        return (-pos);
+    if (pos >= tamanho)
+        return (tamanho*2 - pos - 2);
+    return (pos);
+}
+
+// Micro-funo que diz se o vetor de coeficientes  simtrico.
+int _filtro1DSimetrico (const float* coef, int n)
+{
+    int i;
+    for (i = 0; i < n/2; i++)
+        if (coef [i] != coef [n-1-i])
+            return (0);
+    return (1);
+}
+
+// Filtra na horizontal as colunas de inicio a fim-1 do interior de uma linha,
+// onde todos os vizinhos esto dentro da linha. Verso sem instrues vetoriais.
+void _filtro1DInterior (const float* in, int inicio, int fim, const float* coef, int n, int simetrico, float* out)
+{
+    int col, i;
+    int centro = n/2;
+    const float* c = coef + centro;
+    float soma;
+
+    for (col = inicio; col < fim; col++)
+    {
+        const float* p = in + col;
+        if (simetrico)
+        {
+            soma = p [0] * c [0];
+            for (i = 1; i <= centro; i++)
+                soma += (p [-i] + p [i]) * c [i];
         }
+        else
+        {
+            soma = 0;
+            for (i = -centro; i <= centro; i++)
+                soma += p [i] * c [i];
+        }
+        out [col] = soma;
     }
 }
 
+// Filtra na vertical as colunas de inicio a fim-1. Verso sem instrues vetoriais.
+void _filtro1DColunasIntervalo (const float** linhas, int inicio, int fim, const float* coef, int n, int simetrico, float* out)
+{
+    int col, i;
+    int centro = n/2;
+    float soma;
+
+    for (col = inicio; col < fim; col++)
+    {
+        if (simetrico)
+        {
+            soma = linhas [centro][col] * coef [centro];
+            for (i = 1; i <= centro; i++)
+                soma += (linhas [centro-i][col] + linhas [centro+i][col]) * coef [centro-i];
+        }
+        else
+        {
+            soma = 0;
+            for (i = 0; i < n; i++)
+                soma += linhas [i][col] * coef [i];
+        }
+        out [col] = soma;
+    }
+}
+
+#if defined (__x86_64__) || defined (__i386__)
+
+// Verses com AVX2 (8 colunas por vez) e AVX-512 (16 colunas por vez). As
+// colunas que sobram no fim ficam com a verso menor. As multiplicaes e
+// somas so separadas (sem FMA), para arredondar como a verso simples. (Com
+// -Ofast, o compilador pode reordenar as contas de qualquer verso, e ento o
+// arredondamento pode mudar.)
+
+__attribute__ ((target ("avx2")))
+void _filtro1DInteriorAVX2 (const float* in, int inicio, int fim, const float* coef, int n, int simetrico, float* out)
+{
+    int col, i;
+    int centro = n/2;
+    const float* c = coef + centro;
+    __m256 soma;
+
+    for (col = inicio; col + 8 <= fim; col += 8)
+    {
+        const float* p = in + col;
+        if (simetrico)
+        {
+            soma = _mm256_mul_ps (_mm256_loadu_ps (p), _mm256_set1_ps (c [0]));
+            for (i = 1; i <= centro; i++)
+                soma = _mm256_add_ps (soma, _mm256_mul_ps (_mm256_add_ps (_mm256_loadu_ps (p-i), _mm256_loadu_ps (p+i)),
+                                                           _mm256_set1_ps (c [i])));
+        }
+        else
+        {
+            soma = _mm256_setzero_ps ();
+            for (i = -centro; i <= centro; i++)
+                soma = _mm256_add_ps (soma, _mm256_mul_ps (_mm256_loadu_ps (p+i), _mm256_set1_ps (c [i])));
+        }
+        _mm256_storeu_ps (out + col, soma);
+    }
+
+    _filtro1DInterior (in, col, fim, coef, n, simetrico, out);
+}
+
+__attribute__ ((target ("avx2")))
+void _filtro1DColunasAVX2 (const float** linhas, int inicio, int fim, const float* coef, int n, int simetrico, float* out)
+{
+    int col, i;
+    int centro = n/2;
+    __m256 soma;
+
+    for (col = inicio; col + 8 <= fim; col += 8)
+    {
+        if (simetrico)
+        {
+            soma = _mm256_mul_ps (_mm256_loadu_ps (linhas [centro] + col), _mm256_set1_ps (coef [centro]));
+            for (i = 1; i <= centro; i++)
+                soma = _mm256_add_ps (soma, _mm256_mul_ps (_mm256_add_ps (_mm256_loadu_ps (linhas [centro-i] + col),
+                                                                          _mm256_loadu_ps (linhas [centro+i] + col)),
+                                                           _mm256_set1_ps (coef [centro-i])));
+        }
+        else
+        {
+            soma = _mm256_setzero_ps ();
+            for (i = 0; i < n; i++)
+                soma = _mm256_add_ps (soma, _mm256_mul_ps (_mm256_loadu_ps (linhas [i] + col), _mm256_set1_ps (coef [i])));
+        }
+        _mm256_storeu_ps (out + col, soma);
+    }
+
+    _filtro1DColunasIntervalo (linhas, col, fim, coef, n, simetrico, out);
+}
+
+__attribute__ ((target ("avx512f")))
+void _filtro1DInteriorAVX512 (const float* in, int inicio, int fim, const float* coef, int n, int simetrico, float* out)
+{
+    int col, i;
+    int centro = n/2;
+    const float* c = coef + centro;
+    __m512 soma;
+
+    for (col = inicio; col + 16 <= fim; col += 16)
+    {
+        const float* p = in + col;
+        if (simetrico)
+        {
+            soma = _mm512_mul_ps (_mm512_loadu_ps (p), _mm512_set1_ps (c [0]));
+            for (i = 1; i <= centro; i++)
+                soma = _mm512_add_ps (soma, _mm512_mul_ps (_mm512_add_ps (_mm512_loadu_ps (p-i), _mm512_loadu_ps (p+i)),
+                                                           _mm512_set1_ps (c [i])));
+        }
+        else
+        {
+            soma = _mm512_setzero_ps ();
+            for (i = -centro; i <= centro; i++)
+                soma = _mm512_add_ps (soma, _mm512_mul_ps (_mm512_loadu_ps (p+i), _mm512_set1_ps (c [i])));
+        }
+        _mm512_storeu_ps (out + col, soma);
+    }
+
+    _filtro1DInteriorAVX2 (in, col, fim, coef, n, simetrico, out);
+}
+
+__attribute__ ((target ("avx512f")))
+void _filtro1DColunasAVX512 (const float** linhas, int inicio, int fim, const float* coef, int n, int simetrico, float* out)
+{
+    int col, i;
+    int centro = n/2;
+    __m512 soma;
+
+    for (col = inicio; col + 16 <= fim; col += 16)
+    {
+        if (simetrico)
+        {
+            soma = _mm512_mul_ps (_mm512_loadu_ps (linhas [centro] + col), _mm512_set1_ps (coef [centro]));
+            for (i = 1; i <= centro; i++)
+                soma = _mm512_add_ps (soma, _mm512_mul_ps (_mm512_add_ps (_mm512_loadu_ps (linhas [centro-i] + col),
+                                                                          _mm512_loadu_ps (linhas [centro+i] + col)),
+                                                           _mm512_set1_ps (coef [centro-i])));
+        }
+        else
+        {
+            soma = _mm512_setzero_ps ();
+            for (i = 0; i < n; i++)
+                soma = _mm512_add_ps (soma, _mm512_mul_ps (_mm512_loadu_ps (linhas [i] + col), _mm512_set1_ps (coef [i])));
+        }
+        _mm512_storeu_ps (out + col, soma);
+    }
+
+    _filtro1DColunasAVX2 (linhas, col, fim, coef, n, simetrico, out);
+}
+
+#endif
+
+// As verses usadas, escolhidas uma vez s.
+void (*filtro1d_interior) (const float*, int, int, const float*, int, int, float*) = _filtro1DInterior;
+void (*filtro1d_colunas) (const float**, int, int, const float*, int, int, float*) = _filtro1DColunasIntervalo;
+pthread_once_t filtro1d_escolha = PTHREAD_ONCE_INIT;
+
+// Escolhe as verses conforme o processador.
+void _filtro1DEscolhe (void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
+    {
+        filtro1d_interior = _filtro1DInteriorAVX512;
+        filtro1d_colunas = _filtro1DColunasAVX512;
+    }
+    else if (__builtin_cpu_supports ("avx2"))
+    {
+        filtro1d_interior = _filtro1DInteriorAVX2;
+        filtro1d_colunas = _filtro1DColunasAVX2;
+    }
+#endif
+}
+
+// Filtra na horizontal as colunas de inicio a fim-1 de uma linha, espelhando as margens.
+void _filtro1DMargem (const float* in, int largura, const float* coef, int n, int inicio, int fim, float* out)
+{
+    int col, i;
+    float soma;
+    int centro = n/2;
+
+    for (col = inicio; col < fim; col++)
+    {
+        soma = 0;
+
+        // Percorre o vetor de coeficientes.
+        for (i = -centro; i <= centro; i++)
+            soma += in [_filtro1DEspelha (col + i, largura)] * coef [centro + i];
+
+        out [col] = soma;
+    }
+}
+
+// Filtra uma linha na horizontal.
+void _filtro1DLinha (const float* in, int largura, const float* coef, int n, float* out)
+{
+    int centro = n/2;
+    int inicio = MIN (centro, largura);
+    int fim = MAX (inicio, largura - centro);
+
+    pthread_once (&filtro1d_escolha, _filtro1DEscolhe);
+    _filtro1DMargem (in, largura, coef, n, 0, inicio, out);
+    filtro1d_interior (in, inicio, fim, coef, n, _filtro1DSimetrico (coef, n), out);
+    _filtro1DMargem (in, largura, coef, n, fim, largura, out);
+}
+
+// Filtra na vertical: combina as n linhas dadas (j com as margens tratadas), uma para cada coeficiente.
+void _filtro1DColunas (const float** linhas, int largura, const float* coef, int n, float* out)
+{
+    pthread_once (&filtro1d_escolha, _filtro1DEscolhe);
+    filtro1d_colunas (linhas, 0, largura, coef, n, _filtro1DSimetrico (coef, n), out);
+}
+
 /*============================================================================*/
 /* FILTRO DA MDIA                                                            */
 /*============================================================================*/
-/** Implementao de box blur usando uma imagem integral.
+/** Box blur com somas deslizantes. Mantemos a soma de cada coluna dentro da
+ * janela vertical (quando a janela desce uma linha, soma a linha que entra e
+ * subtrai a que sai) e deslizamos a janela horizontal sobre essas somas. O
+ * custo por pixel no depende do tamanho da janela, e no  preciso uma
+ * imagem integral. As somas so em double: com valores na faixa [0,1], elas
+ * no acumulam erro ao longo da imagem, como aconteceria com somas float
+ * (ou com uma imagem integral float) em imagens grandes. Nas margens, a
+ * janela  cortada pela imagem, e a mdia  s dos pixels dentro dela.
  *
  * Parmetros: Imagem* in: imagem de entrada. Se tiver mais que 1 canal,
  *               processa cada canal independentemente.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *             int altura: altura da janela.
  *             int largura: largura da janela.
- *             Imagem* buffer: uma imagem com o mesmo tamanho da imagem de
- *               entrada. Pode ser usada quando se quer evitar a alocao do
- *               buffer interno. Use NULL se quiser usar o buffer interno.
+ *             Imagem* buffer: no  mais usado (pode ser NULL). Se no for
+ *               NULL, deve ter o mesmo tamanho da imagem de entrada.
  *
  * Valor de retorno: nenhum (usa a imagem de sada). */
 
@@ -118,50 +395,179 @@ void blur (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
         return;
     }
 
-    // Primeiro calcula a imagem integral.
-    Imagem* integral = (buffer)? buffer : criaImagem (in->largura, in->altura, in->n_canais);
+    int channel, row, i;
+    int h = altura/2;
+    double* colunas = (double*) poolAloca (sizeof (double) * in->largura);
+
+    // Se a sada for a prpria entrada, as h+1 linhas originais mais recentes
+    // (a linha atual e as que ainda vo sair da janela) ficam guardadas em um anel.
+    int n_anel = (in == out)? h+1 : 0;
+    float* anel = (n_anel)? (float*) poolAloca (sizeof (float) * in->largura * n_anel) : NULL;
 
-    int channel, row, col;
     for (channel = 0; channel < in->n_canais; channel++)
     {
-        // Soma em linhas.
+        memset (colunas, 0, sizeof (double) * in->largura);
         for (row = 0; row < in->altura; row++)
         {
-            integral->dados [channel][row][0] = in->dados [channel][row][0];
+            // Atualiza as somas das colunas: entra a linha de baixo, sai a de cima.
+            if (row == 0)
+                for (i = 0; i <= MIN (h, in->altura-1); i++)
+                    _blurSomaColunas (in->dados [channel][i], NULL, in->largura, colunas);
+            else
+                _blurSomaColunas ((row+h < in->altura)? in->dados [channel][row+h] : NULL,
+                                  (row-h-1 < 0)? NULL : (n_anel)? anel + (size_t) ((row-h-1) % n_anel) * in->largura
+                                                                : in->dados [channel][row-h-1],
+                                  in->largura, colunas);
 
-            for (col = 1; col < in->largura; col++)
-                integral->dados [channel][row][col] = in->dados [channel][row][col] + integral->dados [channel][row][col-1];
+            if (n_anel)
+                memcpy (anel + (size_t) (row % n_anel) * in->largura, in->dados [channel][row], sizeof (float) * in->largura);
+
+            _blurMediasColunas (colunas, MIN (in->altura-1, row+h) - MAX (0, row-h) + 1, in->largura, largura,
+                                out->dados [channel][row]);
         }
+    }
 
-        // Agora soma na vertical.
-        for (row = 1; row < in->altura; row++)
-            for (col = 0; col < in->largura; col++)
-                integral->dados [channel][row][col] += integral->dados [channel][row-1][col];
+    poolLibera (colunas);
+    if (anel)
+        poolLibera (anel);
+}
+
+/*----------------------------------------------------------------------------*/
+/* O ncleo da blur, uma linha por vez. Tambm  usado pelo processamento em
+ * fluxo (ver fluxo.h). */
+
+// Atualiza as somas das colunas: soma a linha que entra e subtrai a que sai (qualquer uma pode ser NULL).
+void _blurSomaColunas (const float* entra, const float* sai, int largura, double* colunas)
+{
+    int col;
+
+    if (entra)
+        for (col = 0; col < largura; col++)
+            colunas [col] += entra [col];
+    if (sai)
+        for (col = 0; col < largura; col++)
+            colunas [col] -= sai [col];
+}
+
+// Calcula as mdias de uma linha, deslizando a janela horizontal sobre as somas das colunas de n_linhas linhas.
+void _blurMediasColunas (const double* colunas, int n_linhas, int largura, int largura_janela, float* out)
+{
+    int col, w = largura_janela/2;
+    int inicio = MIN (w+1, largura), fim = MAX (inicio, largura-w); // Entre inicio e fim-1, a janela inteira est dentro da imagem.
+    double soma = 0, area = (double) n_linhas * largura_janela;
+
+    for (col = 0; col <= MIN (w, largura-1); col++)
+        soma += colunas [col];
+
+    // Na margem esquerda, s entram colunas (e a janela  cortada).
+    for (col = 0; col < inicio; col++)
+    {
+        if (col > 0 && col+w < largura)
+            soma += colunas [col+w];
+        out [col] = (float) (soma / ((double) n_linhas * (MIN (largura-1, col+w) - MAX (0, col-w) + 1)));
     }
 
-    // Agora calcula as mdias.
-    int top, left, bottom, right;
-    float soma, area;
-    for (channel = 0; channel < in->n_canais; channel++)
-        for (row = 0; row < in->altura; row++)
-            for (col = 0; col < in->largura; col++)
+    // No meio, a diferena entre a coluna que entra e a que sai  calculada
+    // fora da cadeia de somas, para que cada coluna dependa de uma soma s.
+    for (; col < fim; col++)
+    {
+        soma += colunas [col+w] - colunas [col-w-1];
+        out [col] = (float) (soma / area);
+    }
+
+    // Na margem direita, s saem colunas.
+    for (; col < largura; col++)
+    {
+        soma -= colunas [col-w-1];
+        out [col] = (float) (soma / ((double) n_linhas * (largura - (col-w))));
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Box blur para imagens de 8 bits, como a blur, mas com somas inteiras e
+ * exatas. Cada mdia  arredondada para o inteiro mais prximo.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *             int altura: altura da janela.
+ *             int largura: largura da janela.
+ *
+ * Valor de retorno: nenhum (usa a imagem de sada). */
+
+void blurU8 (ImagemU8* in, ImagemU8* out, int altura, int largura)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: blurU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    if (altura % 2 == 0 || largura % 2 == 0)
+    {
+        printf ("ERRO: blurU8: a janela deve ter largura e altura impares.\n");
+        exit (1);
+    }
+
+    int row, col, i;
+    int h = altura/2, w = largura/2;
+    long long soma, area;
+    int* colunas = (int*) poolAloca (sizeof (int) * in->largura); // Soma de cada coluna, nas linhas da janela.
+    memset (colunas, 0, sizeof (int) * in->largura);
+
+    // Se a sada for a prpria entrada, guarda as linhas originais em um anel, como na blur.
+    int n_anel = (in == out)? h+1 : 0;
+    unsigned char* anel = (n_anel)? (unsigned char*) poolAloca ((size_t) in->largura * n_anel) : NULL;
+    const unsigned char* sai;
+
+    for (row = 0; row < in->altura; row++)
+    {
+        // Atualiza as somas das colunas: entra a linha de baixo, sai a de cima.
+        if (row == 0)
+        {
+            for (i = 0; i <= MIN (h, in->altura-1); i++)
+                for (col = 0; col < in->largura; col++)
+                    colunas [col] += in->dados [i][col];
+        }
+        else
+        {
+            if (row+h < in->altura)
+                for (col = 0; col < in->largura; col++)
+                    colunas [col] += in->dados [row+h][col];
+            if (row-h-1 >= 0)
             {
-                top = MAX (-1, row-altura/2-1);
-                left = MAX (-1, col-largura/2-1);
-                bottom = MIN (in->altura-1, row+altura/2);
-                right = MIN (in->largura-1, col+largura/2);
+                sai = (n_anel)? anel + (size_t) ((row-h-1) % n_anel) * in->largura : in->dados [row-h-1];
+                for (col = 0; col < in->largura; col++)
+                    colunas [col] -= sai [col];
+            }
+        }
 
-                soma = ((top >= 0 && left >= 0)? integral->dados [channel][top][left] : 0) +
-                        integral->dados [channel][bottom][right] -
-                        ((left >= 0)? integral->dados [channel][bottom][left] : 0) -
-                        ((top >= 0)? integral->dados [channel][top][right] : 0);
+        if (n_anel)
+            memcpy (anel + (size_t) (row % n_anel) * in->largura, in->dados [row], in->largura);
+        int n_linhas = MIN (in->altura-1, row+h) - MAX (0, row-h) + 1;
 
-                area = (right-left)*(bottom-top);
-                out->dados [channel][row][col] = soma/area;
+        // Desliza a janela na horizontal.
+        soma = 0;
+        for (col = 0; col <= MIN (w, in->largura-1); col++)
+            soma += colunas [col];
+
+        for (col = 0; col < in->largura; col++)
+        {
+            if (col > 0)
+            {
+                if (col+w < in->largura)
+                    soma += colunas [col+w];
+                if (col-w-1 >= 0)
+                    soma -= colunas [col-w-1];
             }
+            area = (long long) n_linhas * (MIN (in->largura-1, col+w) - MAX (0, col-w) + 1);
+            out->dados [row][col] = (unsigned char) ((soma + area/2) / area);
+        }
+    }
 
-    if (!buffer)
-        destroiImagem (integral);
+    poolLibera (colunas);
+    if (anel)
+        poolLibera (anel);
 }
 
 /*============================================================================*/
@@ -178,14 +584,16 @@ void blur (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
  * Parmetros: Imagem* in: imagem de entrada. Se tiver mais que 1 canal,
  *               processa cada canal independentemente.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *             float sigmax: desvio padro na horizontal. Deve ser positivo,
  *               ou um dos 3 valores especiais.
  *             float sigmay: desvio padro na vertical. Deve ser positivo,
  *               ou um dos 3 valores especiais.
  *             Imagem* buffer: uma imagem com o mesmo tamanho da imagem de
- *               entrada. Pode ser usada quando se quer evitar a alocao do
- *               buffer interno. Use NULL se quiser usar o buffer interno.
+ *               entrada, ou NULL. As duas passadas so feitas juntas, linha
+ *               a linha, sem imagem intermediria, ento o buffer s  usado
+ *               pelo filtro recursivo na vertical (ver filtroGaussianoMetodo);
+ *               com NULL, ele aloca o seu.
  *
  * Valor de retorno: nenhum (usa a imagem de sada). */
 
@@ -257,7 +665,82 @@ int _filtroGaussianoNCoef (float sigma)
     return (n);
 }
 
+// Coeficientes j calculados, um vetor por sigma. Ficam prontos durante toda
+// a execuo, e so compartilhados por todas as threads.
+typedef struct _CoefGaussiano
+{
+    float sigma;
+    int n;
+    float* coef;
+    struct _CoefGaussiano* proximo;
+} CoefGaussiano;
+
+CoefGaussiano* gaussiano_coefs = NULL;
+pthread_mutex_t gaussiano_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Retorna os coeficientes para um dado sigma, calculando s na primeira vez.
+// O vetor no pode ser alterado nem liberado.
+const float* _filtroGaussianoCoef (float sigma, int* n)
+{
+    CoefGaussiano* c;
+
+    pthread_mutex_lock (&gaussiano_mutex);
+    for (c = gaussiano_coefs; c; c = c->proximo)
+        if (c->sigma == sigma)
+            break;
+
+    if (!c)
+    {
+        c = (CoefGaussiano*) malloc (sizeof (CoefGaussiano));
+        c->sigma = sigma;
+        c->n = _filtroGaussianoNCoef (sigma);
+        c->coef = (float*) malloc (sizeof (float) * c->n);
+        _filtroGaussianoCalculaCoef (c->n, sigma, c->coef);
+        c->proximo = gaussiano_coefs;
+        gaussiano_coefs = c;
+    }
+    pthread_mutex_unlock (&gaussiano_mutex);
+
+    *n = c->n;
+    return (c->coef);
+}
+
 void filtroGaussiano (Imagem* in, Imagem* out, float sigmax, float sigmay, Imagem* buffer)
+{
+    filtroGaussianoMetodo (in, out, sigmax, sigmay, GAUSSIANO_DIRETO, buffer);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Filtro Gaussiano, como a filtroGaussiano, escolhendo como ele  calculado.
+ *
+ * GAUSSIANO_DIRETO  a convoluo com os coeficientes da filtroGaussiano,
+ * que tm por volta de sigma*4 valores: o custo cresce com o sigma.
+ *
+ * GAUSSIANO_RECURSIVO usa o filtro recursivo de Young e van Vliet ("Recursive
+ * implementation of the Gaussian filter", 1995): um filtro IIR de terceira
+ * ordem aplicado para frente e depois para trs, com um custo por pixel que
+ * no depende do sigma. Ele aproxima a Gaussiana inteira, e no a truncada
+ * em mais ou menos 2 sigmas da filtroGaussiano, ento os resultados so
+ * prximos, mas no iguais (veja o relatrio de preciso em main.c, opo
+ * -A). As margens so espelhadas, como na filtroGaussiano: antes de cada
+ * linha ou coluna, o filtro percorre uma margem espelhada de at 4 sigmas,
+ * limitada pelo tamanho da imagem. Sigmas menores que 0.5 e os valores
+ * especiais (-3, -5 e -7) usam a convoluo direta.
+ *
+ * GAUSSIANO_CAIXAS aplica 3 vezes a blur, com larguras escolhidas para que
+ * a varincia total seja a da Gaussiana. O custo por pixel tambm no
+ * depende do sigma, e as somas no acumulam erro, mas o resultado  uma
+ * aproximao mais grosseira que a do filtro recursivo, e as margens no
+ * so espelhadas: as janelas so cortadas pela imagem. Se algum dos sigmas
+ * for menor que 0.5 (ou um dos valores especiais), usa a convoluo direta.
+ *
+ * Parmetros: os mesmos da filtroGaussiano, e
+ *             int metodo: GAUSSIANO_DIRETO, GAUSSIANO_RECURSIVO ou
+ *               GAUSSIANO_CAIXAS.
+ *
+ * Valor de retorno: nenhum (usa a imagem de sada). */
+
+void filtroGaussianoMetodo (Imagem* in, Imagem* out, float sigmax, float sigmay, int metodo, Imagem* buffer)
 {
     if (in->largura != out->largura || in->altura != out->altura || in->n_canais != out->n_canais ||
         (buffer && (in->largura != buffer->largura || in->altura != buffer->altura || in->n_canais != buffer->n_canais)))
@@ -266,28 +749,287 @@ void filtroGaussiano (Imagem* in, Imagem* out, float sigmax, float sigmay, Image
         exit (1);
     }
 
-    Imagem* img_aux = (buffer)? buffer : criaImagem (in->largura, in->altura, in->n_canais);
+    if (metodo == GAUSSIANO_CAIXAS)
+    {
+        if (sigmax >= 0.5f && sigmay >= 0.5f)
+        {
+            _filtroGaussianoCaixas (in, out, sigmax, sigmay);
+            return;
+        }
+        metodo = GAUSSIANO_DIRETO;
+    }
 
-    // Calcula o tamanho da matriz de coeficientes.
-    int largura = _filtroGaussianoNCoef (sigmax);
-    int altura = _filtroGaussianoNCoef (sigmay);
+    // Com a passada vertical direta, as duas passadas so feitas juntas.
+    if (metodo != GAUSSIANO_RECURSIVO || sigmay < 0.5f)
+    {
+        _filtroGaussianoFundido (in, out, sigmax, sigmay, metodo);
+        return;
+    }
 
-    float* coef = malloc (sizeof (float) * MAX (largura, altura));
+    Imagem* img_aux = (buffer)? buffer : criaImagem (in->largura, in->altura, in->n_canais);
 
-    // Filtra na horizontal.
-    _filtroGaussianoCalculaCoef (largura, sigmax, coef);
-    filtro1D (in, img_aux, coef, largura, 0);
+    // Filtra na horizontal, e depois na vertical.
+    if (sigmax >= 0.5f)
+        _filtroGaussianoRecursivo (in, img_aux, sigmax, 0);
+    else
+    {
+        // Pega os coeficientes (calculados s no primeiro uso de cada sigma).
+        int largura;
+        const float* coef_h = _filtroGaussianoCoef (sigmax, &largura);
+        filtro1D (in, img_aux, (float*) coef_h, largura, 0);
+    }
 
-    // Agora na vertical.
-    if (sigmax != sigmay)
-        _filtroGaussianoCalculaCoef (altura, sigmay, coef);
-    filtro1D (img_aux, out, coef, altura, 1);
+    _filtroGaussianoRecursivo (img_aux, out, sigmay, 1);
 
-    free (coef);
     if (!buffer)
         destroiImagem (img_aux);
 }
 
+/*----------------------------------------------------------------------------*/
+/* O filtro recursivo. Cada passada calcula
+ *   w [i] = B*x [i] + b1*w [i-1] + b2*w [i-2] + b3*w [i-3]
+ * com os coeficientes j divididos por b0 (no artigo, eles aparecem
+ * separados). */
+
+typedef struct
+{
+    float B, b1, b2, b3;
+    int margem; // Tamanho da margem espelhada percorrida antes de cada linha, sem limitar pela imagem.
+} CoefRecursivo;
+
+// Calcula os coeficientes do filtro recursivo para um sigma >= 0.5 (equaes 11b e 8c do artigo).
+void _filtroGaussianoRecursivoCoef (float sigma, CoefRecursivo* c)
+{
+    double q, q2, q3, b0;
+
+    if (sigma >= 2.5f)
+        q = 0.98711*sigma - 0.96330;
+    else
+        q = 3.97156 - 4.14554*sqrt (1 - 0.26891*sigma);
+    q2 = q*q;
+    q3 = q2*q;
+
+    b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+    c->b1 = (float) ((2.44413*q + 2.85619*q2 + 1.26661*q3)/b0);
+    c->b2 = (float) (-(1.4281*q2 + 1.26661*q3)/b0);
+    c->b3 = (float) (0.422205*q3/b0);
+    c->B = 1.0f - (c->b1 + c->b2 + c->b3);
+    c->margem = (int) ceilf (sigma*4.0f);
+}
+
+// Filtra uma linha na horizontal. tmp precisa de largura + 2*margem posies.
+void _filtroGaussianoRecursivoLinha (const float* in, int largura, const CoefRecursivo* c, float* tmp, float* out)
+{
+    int margem = MIN (c->margem, largura-1);
+    float* w = tmp + margem; // w [i] para i entre -margem e largura+margem-1.
+    float w1, w2, w3, y1, y2, y3;
+    int i;
+
+    // Para frente, comeando no regime permanente do primeiro valor da margem.
+    w1 = w2 = w3 = in [_filtro1DEspelha (-margem, largura)];
+    for (i = -margem; i < largura+margem; i++)
+    {
+        w [i] = c->B*in [_filtro1DEspelha (i, largura)] + c->b1*w1 + c->b2*w2 + c->b3*w3;
+        w3 = w2;
+        w2 = w1;
+        w1 = w [i];
+    }
+
+    // Para trs, comeando do fim da margem de baixo.
+    y1 = y2 = y3 = w [largura+margem-1];
+    for (i = largura+margem-1; i >= 0; i--)
+    {
+        float y = c->B*w [i] + c->b1*y1 + c->b2*y2 + c->b3*y3;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+        if (i < largura)
+            out [i] = y;
+    }
+}
+
+/* Aplica o filtro recursivo na horizontal ou na vertical. Na vertical, as
+ * colunas so processadas juntas, linha a linha (acessando a memria em
+ * ordem), com o estado de cada coluna em vetores. Na horizontal, a sada
+ * pode ser a entrada; na vertical, no (a margem de baixo rel linhas que
+ * j teriam sido sobrescritas). */
+void _filtroGaussianoRecursivo (Imagem* in, Imagem* out, float sigma, int vertical)
+{
+    CoefRecursivo c;
+    int channel, row, col, i;
+
+    _filtroGaussianoRecursivoCoef (sigma, &c);
+
+    if (!vertical)
+    {
+        int margem = MIN (c.margem, in->largura-1);
+        float* tmp = (float*) poolAloca (sizeof (float) * (in->largura + 2*margem));
+        for (channel = 0; channel < in->n_canais; channel++)
+            for (row = 0; row < in->altura; row++)
+                _filtroGaussianoRecursivoLinha (in->dados [channel][row], in->largura, &c, tmp, out->dados [channel][row]);
+        poolLibera (tmp);
+        return;
+    }
+
+    int largura = in->largura, altura = in->altura;
+    int margem = MIN (c.margem, altura-1);
+
+    // Os resultados da passada para frente vo para a sada, e os da margem de
+    // baixo para a margem. O estado so as 3 ltimas linhas calculadas; as da
+    // margem de cima no ficam guardadas em outro lugar, ento o estado fica
+    // em 4 vetores que se revezam (o quarto recebe a linha nova).
+    float* margem_baixo = (float*) poolAloca (sizeof (float) * largura * (margem+1));
+    float* estado [4];
+    for (i = 0; i < 4; i++)
+        estado [i] = (float*) poolAloca (sizeof (float) * largura);
+
+    for (channel = 0; channel < in->n_canais; channel++)
+    {
+        float** x = in->dados [channel];
+        float** y = out->dados [channel];
+        float *w1, *w2, *w3, *w, *aux;
+
+        // Para frente.
+        w1 = estado [0]; w2 = estado [1]; w3 = estado [2]; w = estado [3];
+        memcpy (w1, x [_filtro1DEspelha (-margem, altura)], sizeof (float) * largura);
+        memcpy (w2, w1, sizeof (float) * largura);
+        memcpy (w3, w1, sizeof (float) * largura);
+        for (row = -margem; row < altura+margem; row++)
+        {
+            const float* lin = x [_filtro1DEspelha (row, altura)];
+            for (col = 0; col < largura; col++)
+                w [col] = c.B*lin [col] + c.b1*w1 [col] + c.b2*w2 [col] + c.b3*w3 [col];
+
+            // Guarda, depois de ler a entrada (que pode ser a sada) desta linha.
+            if (row >= 0)
+                memcpy ((row < altura)? y [row] : margem_baixo + (size_t) largura*(row-altura), w, sizeof (float) * largura);
+
+            aux = w3; w3 = w2; w2 = w1; w1 = w; w = aux;
+        }
+
+        // Para trs. Na margem, a entrada so as linhas guardadas; na imagem, a
+        // prpria sada, que recebe o resultado.
+        memcpy (w2, w1, sizeof (float) * largura);
+        memcpy (w3, w1, sizeof (float) * largura);
+        for (row = altura+margem-1; row >= 0; row--)
+        {
+            float* lin = (row < altura)? y [row] : margem_baixo + (size_t) largura*(row-altura);
+            for (col = 0; col < largura; col++)
+                w [col] = c.B*lin [col] + c.b1*w1 [col] + c.b2*w2 [col] + c.b3*w3 [col];
+            if (row < altura)
+                memcpy (lin, w, sizeof (float) * largura);
+
+            aux = w3; w3 = w2; w2 = w1; w1 = w; w = aux;
+        }
+    }
+
+    for (i = 0; i < 4; i++)
+        poolLibera (estado [i]);
+    poolLibera (margem_baixo);
+}
+
+/*----------------------------------------------------------------------------*/
+/* O filtro Gaussiano com a passada vertical direta, sem imagem temporria.
+ * As linhas filtradas na horizontal ficam em um anel com uma posio para
+ * cada coeficiente vertical (a linha y fica na posio y % n), como no
+ * processamento em fluxo, e cada linha da sada  calculada assim que as
+ * linhas da sua janela esto no anel. O anel cabe na cache, ao contrrio de
+ * uma imagem inteira. As contas so as mesmas das duas passadas separadas
+ * (com a filtro1D), ento o resultado  idntico. A sada pode ser a
+ * entrada: a linha y da sada s  escrita depois que a linha y da entrada
+ * foi filtrada na horizontal, e ela no  lida de novo. */
+void _filtroGaussianoFundido (Imagem* in, Imagem* out, float sigmax, float sigmay, int metodo)
+{
+    int channel, row, i, n_h = 0, n_v, pronta;
+    int largura = in->largura, altura = in->altura;
+    const float* coef_h = NULL;
+    const float* coef_v = _filtroGaussianoCoef (sigmay, &n_v);
+    CoefRecursivo rec;
+    float* tmp = NULL;
+
+    // Na horizontal, pode ser o filtro recursivo.
+    if (metodo == GAUSSIANO_RECURSIVO && sigmax >= 0.5f)
+    {
+        _filtroGaussianoRecursivoCoef (sigmax, &rec);
+        tmp = (float*) poolAloca (sizeof (float) * (largura + 2*MIN (rec.margem, largura-1)));
+    }
+    else
+        coef_h = _filtroGaussianoCoef (sigmax, &n_h);
+
+    if (n_h >= largura*2 || n_v >= altura*2)
+    {
+        printf ("ERRO: filtroGaussiano: vetor de coeficientes grande demais!\n");
+        exit (1);
+    }
+
+    float* anel = (float*) poolAloca (sizeof (float) * largura * n_v);
+    const float** linhas = (const float**) poolAloca (sizeof (float*) * n_v);
+
+    for (channel = 0; channel < in->n_canais; channel++)
+    {
+        pronta = 0; // A prxima linha a filtrar na horizontal.
+        for (row = 0; row < altura; row++)
+        {
+            // Filtra na horizontal as linhas que faltam para a janela desta linha.
+            for (; pronta <= MIN (altura-1, row + n_v/2); pronta++)
+            {
+                float* destino = anel + (size_t) (pronta % n_v) * largura;
+                if (tmp)
+                    _filtroGaussianoRecursivoLinha (in->dados [channel][pronta], largura, &rec, tmp, destino);
+                else
+                    _filtro1DLinha (in->dados [channel][pronta], largura, coef_h, n_h, destino);
+            }
+
+            for (i = 0; i < n_v; i++)
+                linhas [i] = anel + (size_t) (_filtro1DEspelha (row - n_v/2 + i, altura) % n_v) * largura;
+            _filtro1DColunas (linhas, largura, coef_v, n_v, out->dados [channel][row]);
+        }
+    }
+
+    poolLibera (linhas);
+    poolLibera (anel);
+    if (tmp)
+        poolLibera (tmp);
+}
+
+/*----------------------------------------------------------------------------*/
+/* O filtro Gaussiano aproximado por 3 passadas da blur (pelo teorema central
+ * do limite, convolues sucessivas de caixas se aproximam de uma
+ * Gaussiana). As larguras seguem Kovesi ("Fast almost-Gaussian filtering",
+ * 2010): com n passadas, a largura ideal  sqrt (12*sigma^2/n + 1); m
+ * passadas usam o mpar wl logo abaixo dela, e as outras usam wl+2, com m
+ * escolhido para que a varincia total seja a mais prxima de sigma^2. Nas
+ * margens, as janelas da blur so cortadas pela imagem (e no espelhadas),
+ * ento l o resultado difere um pouco mais da filtroGaussiano. */
+
+#define GAUSSIANO_N_CAIXAS 3
+
+// Calcula as larguras das caixas para um sigma.
+void _filtroGaussianoCaixasLarguras (float sigma, int larguras [GAUSSIANO_N_CAIXAS])
+{
+    int i, n = GAUSSIANO_N_CAIXAS;
+    float ideal = sqrtf (12*sigma*sigma/n + 1);
+    int wl = (int) ideal;
+    if (wl % 2 == 0)
+        wl--;
+    int m = (int) roundf ((12*sigma*sigma - n*wl*wl - 4*n*wl - 3*n) / (-4*wl - 4));
+
+    for (i = 0; i < n; i++)
+        larguras [i] = (i < m)? wl : wl+2;
+}
+
+void _filtroGaussianoCaixas (Imagem* in, Imagem* out, float sigmax, float sigmay)
+{
+    int i, larguras_x [GAUSSIANO_N_CAIXAS], larguras_y [GAUSSIANO_N_CAIXAS];
+
+    _filtroGaussianoCaixasLarguras (sigmax, larguras_x);
+    _filtroGaussianoCaixasLarguras (sigmay, larguras_y);
+
+    // A primeira passada l da entrada; as outras trabalham na prpria sada.
+    for (i = 0; i < GAUSSIANO_N_CAIXAS; i++)
+        blur ((i == 0)? in : out, out, larguras_y [i], larguras_x [i], NULL);
+}
+
 /*============================================================================*/
 /* UNSHARP MASKING                                                            */
 /*============================================================================*/
@@ -393,18 +1135,13 @@ void filtroMediana8bpp (Imagem* in, Imagem* out, int altura, int largura)
     int histograma [256];
     int n_histograma = 0;
 
-    unsigned char** in8bpp;
-    in8bpp = malloc (sizeof (unsigned char*) * in->altura);
-    for (i = 0; i < in->altura; i++)
-        in8bpp [i] = malloc (sizeof (unsigned char) * in->largura);
+    ImagemU8* in8bpp = criaImagemU8 (in->largura, in->altura);
 
     // Para cada canal...
     for (channel = 0; channel < in->n_canais; channel++)
     {
         // Converte para 8bpp.
-        for (row = 0; row < in->altura; row++)
-            for (col = 0; col < in->largura; col++)
-                in8bpp [row][col] = float2uchar (in->dados [channel][row][col]);
+        imagemParaU8 (in, channel, in8bpp);
 
         // Para cada linha...
         for (row = 0; row < in->altura; row++)
@@ -416,7 +1153,7 @@ void filtroMediana8bpp (Imagem* in, Imagem* out, int altura, int largura)
             // Obtm o primeiro histograma para esta linha.
             for (i = MAX (0, row-h); i <= MIN (in->altura-1, row+h); i++)
                 for (j = 0; j <= w; j++)
-                    histograma [in8bpp [i][j]]++;
+                    histograma [in8bpp->dados [i][j]]++;
             n_histograma = (row+h-MAX(0,row-h)+1)*(w+1); // Nmero de valores na primeira janela.
 
             // Obtm a mediana para o primeiro pixel.
@@ -431,7 +1168,7 @@ void filtroMediana8bpp (Imagem* in, Imagem* out, int altura, int largura)
                     j = col-w-1;
                     if (j >= 0)
                     {
-                        saiu = in8bpp [i][j];
+                        saiu = in8bpp->dados [i][j];
                         histograma [saiu]--;
                         n_histograma--;
                     }
@@ -441,7 +1178,7 @@ void filtroMediana8bpp (Imagem* in, Imagem* out, int altura, int largura)
                     j = col+w;
                     if (j < in->largura)
                     {
-                        entrou = in8bpp [i][j];
+                        entrou = in8bpp->dados [i][j];
                         histograma [entrou]++;
                         n_histograma++;
                     }
@@ -458,9 +1195,7 @@ void filtroMediana8bpp (Imagem* in, Imagem* out, int altura, int largura)
         }
     }
 
-    for (i = 0; i < in->altura; i++)
-        free (in8bpp [i]);
-    free (in8bpp);
+    destroiImagemU8 (in8bpp);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -569,32 +1304,113 @@ void filtroMedianaBinario (Imagem* in, Imagem* out, int altura, int largura, Ima
  *
  * Valor de retorno: nenhum (usa a imagem de sada). */
 
-int _maxLocalMaxLinha (Imagem* in, int channel, int row, int inicio, int fim) // Funo auxiliar para a maxLocal.
+/* Na horizontal, a janela desliza pela linha, guardando a posio do maior
+ * valor. Na vertical, percorrer as colunas faria um acesso fora da cache
+ * para cada pixel; em vez disso, cada linha da sada combina as linhas
+ * inteiras da janela, em ordem na memria. Nas margens, a janela  cortada
+ * pela imagem. */
+
+// Na vertical, para a maxLocal e a minLocal: o mximo (se maximo != 0) ou o mnimo das linhas de inicio a fim, coluna por coluna.
+void _extremoLocalLinhas (const float** linhas, int inicio, int fim, int largura, int maximo, float* out)
 {
-    int col;
+    int row, col;
 
-    if (inicio < 0) inicio = 0;
-    if (fim >= in->largura) fim = in->largura-1;
+    memcpy (out, linhas [inicio], sizeof (float) * largura);
+    for (row = inicio+1; row <= fim; row++)
+    {
+        const float* lin = linhas [row];
+        if (maximo)
+            for (col = 0; col < largura; col++)
+                out [col] = (lin [col] > out [col])? lin [col] : out [col];
+        else
+            for (col = 0; col < largura; col++)
+                out [col] = (lin [col] < out [col])? lin [col] : out [col];
+    }
+}
 
-    int pos_max = inicio;
-    for (col = inicio+1; col <= fim; col++)
-        if (in->dados [channel][row][col] >= in->dados [channel][row][pos_max])
-            pos_max = col;
+#if defined (__x86_64__) || defined (__i386__)
 
-    return (pos_max);
+// Verses com AVX2 e AVX-512, como as da filtro1D: cada grupo de colunas fica
+// em um registrador enquanto as linhas da janela so combinadas. As colunas
+// que sobram no fim ficam com a verso menor.
+
+__attribute__ ((target ("avx2")))
+void _extremoLocalLinhasAVX2 (const float** linhas, int inicio, int fim, int largura, int maximo, float* out)
+{
+    int row, col;
+    __m256 ext;
+
+    for (col = 0; col + 8 <= largura; col += 8)
+    {
+        ext = _mm256_loadu_ps (linhas [inicio] + col);
+        for (row = inicio+1; row <= fim; row++)
+            ext = (maximo)? _mm256_max_ps (_mm256_loadu_ps (linhas [row] + col), ext)
+                          : _mm256_min_ps (_mm256_loadu_ps (linhas [row] + col), ext);
+        _mm256_storeu_ps (out + col, ext);
+    }
+
+    if (col < largura)
+    {
+        const float* resto [fim-inicio+1];
+        for (row = inicio; row <= fim; row++)
+            resto [row-inicio] = linhas [row] + col;
+        _extremoLocalLinhas (resto, 0, fim-inicio, largura-col, maximo, out + col);
+    }
 }
 
-float _maxLocalMaxColuna (Imagem* in, int channel, int col, int inicio, int fim) // Funo auxiliar para a maxLocal.
+__attribute__ ((target ("avx512f")))
+void _extremoLocalLinhasAVX512 (const float** linhas, int inicio, int fim, int largura, int maximo, float* out)
 {
-    int row;
+    int row, col;
+    __m512 ext;
+
+    for (col = 0; col + 16 <= largura; col += 16)
+    {
+        ext = _mm512_loadu_ps (linhas [inicio] + col);
+        for (row = inicio+1; row <= fim; row++)
+            ext = (maximo)? _mm512_max_ps (_mm512_loadu_ps (linhas [row] + col), ext)
+                          : _mm512_min_ps (_mm512_loadu_ps (linhas [row] + col), ext);
+        _mm512_storeu_ps (out + col, ext);
+    }
+
+    if (col < largura)
+    {
+        const float* resto [fim-inicio+1];
+        for (row = inicio; row <= fim; row++)
+            resto [row-inicio] = linhas [row] + col;
+        _extremoLocalLinhasAVX2 (resto, 0, fim-inicio, largura-col, maximo, out + col);
+    }
+}
+
+#endif
+
+// A verso usada, escolhida uma vez s.
+void (*extremo_linhas) (const float**, int, int, int, int, float*) = _extremoLocalLinhas;
+pthread_once_t extremo_escolha = PTHREAD_ONCE_INIT;
+
+// Escolhe a verso conforme o processador.
+void _extremoLocalEscolhe (void)
+{
+#if defined (__x86_64__) || defined (__i386__)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
+        extremo_linhas = _extremoLocalLinhasAVX512;
+    else if (__builtin_cpu_supports ("avx2"))
+        extremo_linhas = _extremoLocalLinhasAVX2;
+#endif
+}
+
+int _maxLocalMaxLinha (Imagem* in, int channel, int row, int inicio, int fim) // Funo auxiliar para a maxLocal.
+{
+    int col;
 
     if (inicio < 0) inicio = 0;
-    if (fim >= in->altura) fim = in->altura-1;
+    if (fim >= in->largura) fim = in->largura-1;
 
     int pos_max = inicio;
-    for (row = inicio+1; row <= fim; row++)
-        if (in->dados [channel][row][col] >= in->dados [channel][pos_max][col])
-            pos_max = row;
+    for (col = inicio+1; col <= fim; col++)
+        if (in->dados [channel][row][col] >= in->dados [channel][row][pos_max])
+            pos_max = col;
 
     return (pos_max);
 }
@@ -618,6 +1434,7 @@ void maxLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
 
     int channel, row, col, pos_max;
     int w = largura/2; // largura = 2w+1
+    pthread_once (&extremo_escolha, _extremoLocalEscolhe);
     int h = altura/2; // algtura = 2h+1
     for (channel = 0; channel < in->n_canais; channel++)
     {
@@ -640,23 +1457,10 @@ void maxLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
             }
         }
 
-        // Agora na vertical.
-        for (col = 0; col < in->largura; col++)
-        {
-             // Acha o maior valor dentro da primeira janela desta coluna.
-             pos_max = _maxLocalMaxColuna (img_aux, channel, col, 0, h);
-             out->dados [channel][0][col] = img_aux->dados [channel][pos_max][col];
-
-             for (row = 1; row < in->altura; row++)
-             {
-                if (pos_max == row-h-1)
-                    pos_max = _maxLocalMaxColuna (img_aux, channel, col, row-h, row+h);
-                else if (row+h < in->altura && img_aux->dados [channel][row+w][col] >= img_aux->dados [channel][pos_max][col])
-                    pos_max = row+w;
-
-                out->dados [channel][row][col] = img_aux->dados [channel][pos_max][col];
-             }
-        }
+        // Agora na vertical, uma linha inteira por vez.
+        for (row = 0; row < in->altura; row++)
+            extremo_linhas ((const float**) img_aux->dados [channel], MAX (0, row-h), MIN (in->altura-1, row+h),
+                                 in->largura, 1, out->dados [channel][row]);
     }
 
     if (!buffer)
@@ -694,21 +1498,6 @@ int _minLocalMinLinha (Imagem* in, int channel, int row, int inicio, int fim) //
     return (pos_min);
 }
 
-float _minLocalMinColuna (Imagem* in, int channel, int col, int inicio, int fim) // Funo auxiliar para a minLocal.
-{
-    int row;
-
-    if (inicio < 0) inicio = 0;
-    if (fim >= in->altura) fim = in->altura-1;
-
-    int pos_min = inicio;
-    for (row = inicio+1; row <= fim; row++)
-        if (in->dados [channel][row][col] <= in->dados [channel][pos_min][col])
-            pos_min = row;
-
-    return (pos_min);
-}
-
 void minLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
 {
     if (in->largura != out->largura || in->altura != out->altura || in->n_canais != out->n_canais ||
@@ -728,6 +1517,7 @@ void minLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
 
     int channel, row, col, pos_min;
     int w = largura/2; // largura = 2w+1
+    pthread_once (&extremo_escolha, _extremoLocalEscolhe);
     int h = altura/2; // algtura = 2h+1
     for (channel = 0; channel < in->n_canais; channel++)
     {
@@ -750,23 +1540,10 @@ void minLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer)
             }
         }
 
-        // Agora na vertical.
-        for (col = 0; col < in->largura; col++)
-        {
-             // Acha o maior valor dentro da primeira janela desta coluna.
-             pos_min = _minLocalMinColuna (img_aux, channel, col, 0, h);
-             out->dados [channel][0][col] = img_aux->dados [channel][pos_min][col];
-
-             for (row = 1; row < in->altura; row++)
-             {
-                if (pos_min == row-h-1)
-                    pos_min = _minLocalMinColuna (img_aux, channel, col, row-h, row+h);
-                else if (row+h < in->altura && img_aux->dados [channel][row+w][col] <= img_aux->dados [channel][pos_min][col])
-                    pos_min = row+w;
-
-                out->dados [channel][row][col] = img_aux->dados [channel][pos_min][col];
-             }
-        }
+        // Agora na vertical, uma linha inteira por vez.
+        for (row = 0; row < in->altura; row++)
+            extremo_linhas ((const float**) img_aux->dados [channel], MAX (0, row-h), MIN (in->altura-1, row+h),
+                                 in->largura, 0, out->dados [channel][row]);
     }
 
     if (!buffer)
@@ -816,7 +1593,7 @@ Imagem* criaKernelCircular (int largura)
  *             Imagem* kernel: kernel para a dilatao.
  *             Coordenada centro: centro do kernel.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *
  * Valor de retorno: nenhum. */
 
@@ -828,6 +1605,11 @@ void dilata (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out)
         exit (1);
     }
 
+    // A vizinhana  lida da entrada; se a sada for a prpria entrada, l de uma cpia.
+    Imagem* copia = (in == out)? clonaImagem (in) : NULL;
+    if (copia)
+        in = copia;
+
     // Processa cada canal independentemente.
     int channel, row, col, row2, col2, set;
     int aesq = centro.x, adir = kernel->largura-1-centro.x, acima = centro.y, abaixo = kernel->altura-1-centro.y;
@@ -848,6 +1630,9 @@ void dilata (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out)
                 else
                     out->dados [channel][row][col] = 0;
             }
+
+    if (copia)
+        destroiImagem (copia);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -858,7 +1643,7 @@ void dilata (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out)
  *             Imagem* kernel: kernel para a eroso.
  *             Coordenada centro: centro do kernel.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *
  * Valor de retorno: nenhum. */
 
@@ -870,6 +1655,11 @@ void erode (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out)
         exit (1);
     }
 
+    // A vizinhana  lida da entrada; se a sada for a prpria entrada, l de uma cpia.
+    Imagem* copia = (in == out)? clonaImagem (in) : NULL;
+    if (copia)
+        in = copia;
+
     // Processa cada canal independentemente.
     int channel, row, col, row2, col2, set;
     int aesq = centro.x, adir = kernel->largura-1-centro.x, acima = centro.y, abaixo = kernel->altura-1-centro.y;
@@ -890,6 +1680,9 @@ void erode (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out)
                 else
                     out->dados [channel][row][col] = 0;
             }
+
+    if (copia)
+        destroiImagem (copia);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -955,4 +1748,169 @@ void fechamento (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out, Ima
     if (!buffer)
         destroiImagem (img_aux);
 }
+
+/*----------------------------------------------------------------------------*/
+/** Dilatao morfolgica para imagens de 8 bits. Em vez de testar o kernel
+ * para cada pixel, cada posio branca do kernel desloca uma linha inteira da
+ * entrada, e a sada fica com o mximo dos deslocamentos. Para imagens
+ * binrias (0 e 255), isso  a dilatao usual; para imagens em escala de
+ * cinza,  a dilatao com elemento estruturante plano.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a dilatao.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+// Funo auxiliar para dilataU8 e erodeU8: combina na linha de sada as linhas deslocadas pelo kernel.
+void _morfologiaU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out, int dilatacao)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: %s: as imagens precisam ter o mesmo tamanho.\n", (dilatacao)? "dilataU8" : "erodeU8");
+        exit (1);
+    }
+
+    int row, col, krow, kcol, dy, dx, inicio, fim;
+    unsigned char* lin_out;
+    const unsigned char* lin_in;
+
+    // Se a sada for a prpria entrada, cada linha  montada em um buffer, e
+    // as linhas originais acima dela (j sobrescritas) ficam guardadas em um anel.
+    int n_anel = (in == out)? MAX (1, centro.y) : 0;
+    unsigned char* linha = (n_anel)? poolAloca (in->largura) : NULL;
+    unsigned char* anel = (n_anel)? poolAloca ((size_t) in->largura * n_anel) : NULL;
+
+    for (row = 0; row < in->altura; row++)
+    {
+        lin_out = (n_anel)? linha : out->dados [row];
+        memset (lin_out, (dilatacao)? 0 : 255, in->largura);
+
+        for (krow = 0; krow < kernel->altura; krow++)
+        {
+            dy = krow - centro.y;
+            if (row+dy < 0 || row+dy >= in->altura)
+                continue; // Posies fora da imagem so ignoradas.
+            lin_in = (n_anel && dy < 0)? anel + (size_t) ((row+dy) % n_anel) * in->largura : in->dados [row+dy];
+
+            for (kcol = 0; kcol < kernel->largura; kcol++)
+            {
+                if (kernel->dados [0][krow][kcol] <= 0.5f)
+                    continue;
+
+                dx = kcol - centro.x;
+                inicio = MAX (0, -dx);
+                fim = MIN (in->largura, in->largura-dx);
+
+                if (dilatacao)
+                {
+                    for (col = inicio; col < fim; col++)
+                        lin_out [col] = MAX (lin_out [col], lin_in [col+dx]);
+                }
+                else
+                {
+                    for (col = inicio; col < fim; col++)
+                        lin_out [col] = MIN (lin_out [col], lin_in [col+dx]);
+                }
+            }
+        }
+
+        if (n_anel)
+        {
+            memcpy (anel + (size_t) (row % n_anel) * in->largura, in->dados [row], in->largura);
+            memcpy (out->dados [row], linha, in->largura);
+        }
+    }
+
+    if (n_anel)
+    {
+        poolLibera (linha);
+        poolLibera (anel);
+    }
+}
+
+void dilataU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out)
+{
+    _morfologiaU8 (in, kernel, centro, out, 1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Eroso morfolgica para imagens de 8 bits. Ver dilataU8.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a eroso.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *
+ * Valor de retorno: nenhum. */
+
+void erodeU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out)
+{
+    _morfologiaU8 (in, kernel, centro, out, 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Abertura morfolgica para imagens de 8 bits: eroso seguida de dilatao.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a dilatao/eroso.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *             ImagemU8* buffer: uma imagem com o mesmo tamanho da imagem de
+ *               entrada. Pode ser usada quando se quer evitar a alocao do
+ *               buffer interno. Use NULL se quiser usar o buffer interno.
+ *
+ * Valor de retorno: nenhum. */
+
+void aberturaU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out, ImagemU8* buffer)
+{
+    if (buffer && (in->largura != buffer->largura || in->altura != buffer->altura))
+    {
+        printf ("ERRO: aberturaU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    ImagemU8* img_aux = (buffer)? buffer : criaImagemU8 (in->largura, in->altura);
+
+    erodeU8 (in, kernel, centro, img_aux);
+    dilataU8 (img_aux, kernel, centro, out);
+
+    if (!buffer)
+        destroiImagemU8 (img_aux);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Fechamento morfolgico para imagens de 8 bits: dilatao seguida de eroso.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             Imagem* kernel: kernel para a dilatao/eroso.
+ *             Coordenada centro: centro do kernel.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
+ *             ImagemU8* buffer: uma imagem com o mesmo tamanho da imagem de
+ *               entrada. Pode ser usada quando se quer evitar a alocao do
+ *               buffer interno. Use NULL se quiser usar o buffer interno.
+ *
+ * Valor de retorno: nenhum. */
+
+void fechamentoU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out, ImagemU8* buffer)
+{
+    if (buffer && (in->largura != buffer->largura || in->altura != buffer->altura))
+    {
+        printf ("ERRO: fechamentoU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    ImagemU8* img_aux = (buffer)? buffer : criaImagemU8 (in->largura, in->altura);
+
+    dilataU8 (in, kernel, centro, img_aux);
+    erodeU8 (img_aux, kernel, centro, out);
+
+    if (!buffer)
+        destroiImagemU8 (img_aux);
+}
 /*============================================================================*/
@@ -16,16 +16,39 @@
 
 /*============================================================================*/
 
+// Mtodos da filtroGaussianoMetodo.
+#define GAUSSIANO_DIRETO 0    /* Convoluo com o kernel truncado. */
+#define GAUSSIANO_RECURSIVO 1 /* Filtro recursivo de Young e van Vliet: custo constante por pixel. */
+#define GAUSSIANO_CAIXAS 2    /* 3 passadas da blur: custo constante por pixel. */
+
+/*============================================================================*/
+
 // Genricos.
 void filtro1D (Imagem* in, Imagem* out, float* coef, int n, int vertical);
 
 // Suavizao e realce.
 void blur (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer);
+void blurU8 (ImagemU8* in, ImagemU8* out, int altura, int largura);
 void filtroGaussiano (Imagem* in, Imagem* out, float sigmax, float sigmay, Imagem* buffer);
+void filtroGaussianoMetodo (Imagem* in, Imagem* out, float sigmax, float sigmay, int metodo, Imagem* buffer);
 void unsharpMasking (Imagem* in, Imagem* out, float sigma, float threshold, float mult, Imagem* buffer);
 void filtroMediana8bpp (Imagem* in, Imagem* out, int altura, int largura);
 void filtroMedianaBinario (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer);
 
+// Ncleos da filtro1D, da filtroGaussiano e da blur, uma linha por vez. Para
+// o processamento em fluxo (ver fluxo.h).
+int _filtro1DEspelha (int pos, int tamanho);
+void _filtro1DLinha (const float* in, int largura, const float* coef, int n, float* out);
+void _filtro1DColunas (const float** linhas, int largura, const float* coef, int n, float* out);
+int _filtroGaussianoNCoef (float sigma);
+void _filtroGaussianoCalculaCoef (int largura, float sigma, float* coef);
+const float* _filtroGaussianoCoef (float sigma, int* n);
+void _filtroGaussianoRecursivo (Imagem* in, Imagem* out, float sigma, int vertical);
+void _filtroGaussianoFundido (Imagem* in, Imagem* out, float sigmax, float sigmay, int metodo);
+void _filtroGaussianoCaixas (Imagem* in, Imagem* out, float sigmax, float sigmay);
+void _blurSomaColunas (const float* entra, const float* sai, int largura, double* colunas);
+void _blurMediasColunas (const double* colunas, int n_linhas, int largura, int largura_janela, float* out);
+
 // Morfologia.
 void maxLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer);
 void minLocal (Imagem* in, Imagem* out, int altura, int largura, Imagem* buffer);
@@ -34,6 +57,10 @@ void dilata (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out);
 void erode (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out);
 void abertura (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out, Imagem* buffer);
 void fechamento (Imagem* in, Imagem* kernel, Coordenada centro, Imagem* out, Imagem* buffer);
+void dilataU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out);
+void erodeU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out);
+void aberturaU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out, ImagemU8* buffer);
+void fechamentoU8 (ImagemU8* in, Imagem* kernel, Coordenada centro, ImagemU8* out, ImagemU8* buffer);
 
 /*============================================================================*/
 #endif /* __FILTROS2D_H */
@@ -0,0 +1,773 @@
+/*============================================================================*/
+/* PROCESSAMENTO EM FLUXO                                                     */
+/*============================================================================*/
+/** Processamento de imagens linha por linha. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "base.h"
+#include "binaria.h"
+#include "filtros2d.h"
+#include "pool.h"
+#include "fluxo.h"
+
+/*============================================================================*/
+
+#define FLUXO_BMP 0
+#define FLUXO_GAUSSIANO 1
+#define FLUXO_NORMALIZA 2
+#define FLUXO_BINARIZA_ADAPT 3
+#define FLUXO_PARA_BIN 4
+#define FLUXO_MORFOLOGIA_BIN 5
+#define FLUXO_MASCARA 6
+
+struct _Fluxo
+{
+    int tipo;
+    int largura;
+    int altura;
+    int binario; /* Se != 0, as linhas so binrias (uint64_t); do contrrio, float. */
+    int palavras; /* Palavras de 64 bits por linha binria. */
+    int proxima; /* Prxima linha a entregar. */
+    int lidas; /* Linhas j puxadas da entrada. */
+    Fluxo* entrada;
+    Fluxo* mascara; /* FLUXO_MASCARA: a mscara. */
+    LeitorBMP* leitor; /* FLUXO_BMP: o arquivo. */
+
+    void* saida; /* A linha entregue. Vale at o prximo pedido. */
+
+    /* As ltimas linhas puxadas da entrada (j transformadas, conforme o
+     * tipo). A linha y fica na posio y % n_anel. */
+    unsigned char* anel;
+    int n_anel;
+    size_t passo; /* Bytes por linha do anel. */
+    float* auxiliar; /* Linha auxiliar (mdias da FLUXO_BINARIZA_ADAPT). */
+    double* colunas; /* FLUXO_BINARIZA_ADAPT: as somas das colunas da janela. */
+    const void** linhas; /* Linhas do anel usadas por uma linha de sada. */
+
+    /* FLUXO_GAUSSIANO. */
+    const float* coef_h; /* Da _filtroGaussianoCoef: no so liberados. */
+    int n_h;
+    const float* coef_v;
+    int n_v;
+
+    /* FLUXO_NORMALIZA. */
+    float min_in, max_in, min, max;
+
+    /* FLUXO_BINARIZA_ADAPT e FLUXO_PARA_BIN. */
+    int janela;
+    float threshold;
+
+    /* FLUXO_MORFOLOGIA_BIN. */
+    Imagem* kernel;
+    Coordenada centro;
+    int dilatacao;
+    uint64_t* deslocada;
+};
+
+Fluxo* _fluxoCria (int tipo, Fluxo* entrada, int largura, int altura, int binario);
+size_t _fluxoBytesLinha (Fluxo* f, int binario);
+void* _fluxoAnel (Fluxo* f, int y);
+const void* _fluxoPuxa (Fluxo* f, int binario, const char* funcao);
+const void* _fluxoProduz (Fluxo* f);
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Cria uma etapa, com a linha de sada j alocada.
+ *
+ * Parmetros: int tipo: tipo da etapa.
+ *             Fluxo* entrada: a entrada (NULL para uma fonte).
+ *             int largura: largura das linhas.
+ *             int altura: nmero de linhas.
+ *             int binario: se != 0, a etapa entrega linhas binrias.
+ *
+ * Valor de retorno: a etapa. */
+
+Fluxo* _fluxoCria (int tipo, Fluxo* entrada, int largura, int altura, int binario)
+{
+    Fluxo* f = (Fluxo*) calloc (1, sizeof (Fluxo));
+
+    f->tipo = tipo;
+    f->entrada = entrada;
+    f->largura = largura;
+    f->altura = altura;
+    f->binario = binario;
+    f->palavras = (largura + 63) / 64;
+    f->saida = poolAloca (_fluxoBytesLinha (f, binario));
+
+    return (f);
+}
+
+// Micro-funo: bytes de uma linha float ou binria desta etapa, arredondados para o alinhamento.
+size_t _fluxoBytesLinha (Fluxo* f, int binario)
+{
+    return (_alinhaBytes ((binario)? sizeof (uint64_t) * f->palavras : sizeof (float) * f->largura));
+}
+
+// Micro-funo: a linha y do anel.
+void* _fluxoAnel (Fluxo* f, int y)
+{
+    return (f->anel + (size_t) (y % f->n_anel) * f->passo);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Puxa uma linha da entrada de uma etapa, conferindo o tipo.
+ *
+ * Parmetros: Fluxo* f: a entrada.
+ *             int binario: tipo esperado das linhas.
+ *             const char* funcao: nome da funo, para a mensagem de erro.
+ *
+ * Valor de retorno: a linha. */
+
+const void* _fluxoPuxa (Fluxo* f, int binario, const char* funcao)
+{
+    if (f->binario != binario)
+    {
+        printf ("ERRO: %s: a entrada deve ter linhas %s.\n", funcao, (binario)? "binarias" : "float");
+        exit (1);
+    }
+
+    if (f->proxima >= f->altura)
+    {
+        printf ("ERRO: %s: todas as linhas ja foram lidas.\n", funcao);
+        exit (1);
+    }
+
+    return (_fluxoProduz (f));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Produz a prxima linha de uma etapa, puxando da entrada as linhas que
+ * faltam.
+ *
+ * Parmetros: Fluxo* f: a etapa.
+ *
+ * Valor de retorno: a linha, que fica em f->saida. */
+
+const void* _fluxoProduz (Fluxo* f)
+{
+    int y = f->proxima, i, ultima, topo;
+
+    switch (f->tipo)
+    {
+        case FLUXO_BMP:
+            leLinhaBMP (f->leitor, y, (float*) f->saida);
+            break;
+
+        case FLUXO_GAUSSIANO:
+        {
+            // Cada linha entra no anel j filtrada na horizontal.
+            ultima = MIN (f->altura-1, y + f->n_v/2);
+            for (; f->lidas <= ultima; f->lidas++)
+                _filtro1DLinha ((const float*) _fluxoPuxa (f->entrada, 0, "fluxoGaussiano"), f->largura,
+                                f->coef_h, f->n_h, (float*) _fluxoAnel (f, f->lidas));
+
+            for (i = 0; i < f->n_v; i++)
+                f->linhas [i] = _fluxoAnel (f, _filtro1DEspelha (y - f->n_v/2 + i, f->altura));
+            _filtro1DColunas ((const float**) f->linhas, f->largura, f->coef_v, f->n_v, (float*) f->saida);
+            break;
+        }
+
+        case FLUXO_NORMALIZA:
+            _normalizaLinha ((const float*) _fluxoPuxa (f->entrada, 0, "fluxoNormalizaSemExtremos8bpp"), f->largura,
+                             f->min_in, f->max_in, f->min, f->max, (float*) f->saida);
+            break;
+
+        case FLUXO_BINARIZA_ADAPT:
+        {
+            // O anel guarda as linhas originais, da linha que acabou de sair
+            // da janela at a ltima linha dela; as somas das colunas da janela
+            // so atualizadas como na blur (na mesma ordem, ento as mdias
+            // so idnticas).
+            ultima = MIN (f->altura-1, y + f->janela/2);
+            for (; f->lidas <= ultima; f->lidas++)
+            {
+                memcpy (_fluxoAnel (f, f->lidas), _fluxoPuxa (f->entrada, 0, "fluxoBinarizaAdapt"), sizeof (float) * f->largura);
+                if (y == 0)
+                    _blurSomaColunas ((const float*) _fluxoAnel (f, f->lidas), NULL, f->largura, f->colunas);
+            }
+            if (y > 0)
+            {
+                topo = y - f->janela/2 - 1;
+                _blurSomaColunas ((y + f->janela/2 < f->altura)? (const float*) _fluxoAnel (f, y + f->janela/2) : NULL,
+                                  (topo >= 0)? (const float*) _fluxoAnel (f, topo) : NULL, f->largura, f->colunas);
+            }
+
+            const float* lin_in = (const float*) _fluxoAnel (f, y);
+            float* lin_out = (float*) f->saida;
+
+            if (f->janela == 1)
+                memcpy (f->auxiliar, lin_in, sizeof (float) * f->largura); // Como na blur: janela 1x1  uma cpia.
+            else
+                _blurMediasColunas (f->colunas, ultima - MAX (0, y - f->janela/2) + 1, f->largura, f->janela, f->auxiliar);
+
+            for (i = 0; i < f->largura; i++)
+                lin_out [i] = (lin_in [i] - f->auxiliar [i] > f->threshold)? 1 : 0;
+            break;
+        }
+
+        case FLUXO_PARA_BIN:
+            _linhaParaBin ((const float*) _fluxoPuxa (f->entrada, 0, "fluxoParaBin"), f->largura,
+                           f->threshold, (uint64_t*) f->saida);
+            break;
+
+        case FLUXO_MORFOLOGIA_BIN:
+        {
+            ultima = MIN (f->altura-1, y + f->kernel->altura-1 - f->centro.y);
+            for (; f->lidas <= ultima; f->lidas++)
+                memcpy (_fluxoAnel (f, f->lidas), _fluxoPuxa (f->entrada, 1, (f->dilatacao)? "fluxoDilataBin" : "fluxoErodeBin"),
+                        sizeof (uint64_t) * f->palavras);
+
+            for (i = 0; i < f->kernel->altura; i++)
+            {
+                int row = y + i - f->centro.y;
+                f->linhas [i] = (row < 0 || row >= f->altura)? NULL : _fluxoAnel (f, row); // Linhas fora da imagem so ignoradas.
+            }
+            _morfologiaLinhaBin ((const uint64_t**) f->linhas, f->palavras, f->largura, f->kernel, f->centro,
+                                 f->dilatacao, f->deslocada, (uint64_t*) f->saida);
+            break;
+        }
+
+        case FLUXO_MASCARA:
+        {
+            const float* lin_in = (const float*) _fluxoPuxa (f->entrada, 0, "fluxoMascara");
+            const uint64_t* lin_mascara = (const uint64_t*) _fluxoPuxa (f->mascara, 1, "fluxoMascara");
+            float* lin_out = (float*) f->saida;
+
+            for (i = 0; i < f->largura; i++)
+                lin_out [i] = ((lin_mascara [i >> 6] >> (i & 63)) & 1)? lin_in [i] : 0.0f;
+            break;
+        }
+    }
+
+    f->proxima++;
+    return (f->saida);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Cria uma etapa de morfologia binria.
+ *
+ * Parmetros: Fluxo* in: a entrada, com linhas binrias.
+ *             Imagem* kernel: o kernel. No  copiado, e deve existir
+ *               enquanto a etapa existir.
+ *             Coordenada centro: centro do kernel.
+ *             int dilatacao: se != 0, dilatao; do contrrio, eroso.
+ *
+ * Valor de retorno: a etapa. */
+
+Fluxo* _fluxoMorfologiaBin (Fluxo* in, Imagem* kernel, Coordenada centro, int dilatacao)
+{
+    if (!in)
+        return (NULL);
+
+    Fluxo* f = _fluxoCria (FLUXO_MORFOLOGIA_BIN, in, in->largura, in->altura, 1);
+    f->kernel = kernel;
+    f->centro = centro;
+    f->dilatacao = dilatacao;
+    f->n_anel = kernel->altura;
+    f->passo = _fluxoBytesLinha (f, 1);
+    f->anel = poolAloca (f->passo * f->n_anel);
+    f->linhas = poolAloca (sizeof (void*) * kernel->altura);
+    f->deslocada = poolAloca (sizeof (uint64_t) * f->palavras);
+
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Acha as sequncias de pixels brancos (corridas) de uma linha binria.
+ *
+ * Parmetros: const uint64_t* linha: a linha. Os bits alm da largura devem
+ *               ser 0.
+ *             int palavras: palavras da linha.
+ *             int* inicio: sada. Primeiro pixel de cada corrida.
+ *             int* fim: sada. ltimo pixel de cada corrida.
+ *
+ * Valor de retorno: o nmero de corridas. */
+
+int _fluxoCorridas (const uint64_t* linha, int palavras, int* inicio, int* fim)
+{
+    int p, b, n = 0, dentro = 0;
+    uint64_t palavra;
+
+    for (p = 0; p < palavras; p++)
+    {
+        palavra = linha [p];
+        if ((!dentro && palavra == 0) || (dentro && palavra == ~((uint64_t) 0)))
+            continue; // A palavra toda continua o que j estava acontecendo.
+
+        for (b = 0; b < 64; b++)
+        {
+            if (((palavra >> b) & 1) != (uint64_t) dentro)
+            {
+                if (dentro)
+                    fim [n++] = p*64 + b - 1;
+                else
+                    inicio [n] = p*64 + b;
+                dentro = !dentro;
+            }
+        }
+    }
+
+    if (dentro)
+        fim [n++] = palavras*64 - 1;
+
+    return (n);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Guarda um componente terminado, se ele no for pequeno demais.
+ *
+ * Parmetros: ComponenteConexo* c: o componente.
+ *             ComponenteConexo** componentes: vetor de sada (realocado).
+ *             int* n: nmero de componentes no vetor.
+ *             int* capacidade: capacidade do vetor.
+ *             int largura_min, altura_min, n_pixels_min: como na rotulaFluxoBin.
+ *
+ * Valor de retorno: nenhum. */
+
+void _fluxoEmite (ComponenteConexo* c, ComponenteConexo** componentes, int* n, int* capacidade,
+                  int largura_min, int altura_min, int n_pixels_min)
+{
+    if (c->n_pixels < n_pixels_min ||
+        c->roi.d - c->roi.e + 1 < largura_min ||
+        c->roi.b - c->roi.c + 1 < altura_min)
+        return;
+
+    if (*n == *capacidade)
+    {
+        *capacidade *= 2;
+        *componentes = realloc (*componentes, sizeof (ComponenteConexo) * *capacidade);
+    }
+
+    (*componentes) [*n] = *c;
+    (*componentes) [*n].label = (float) (*n + 1);
+    (*n)++;
+}
+
+/*============================================================================*/
+/* FONTES E ETAPAS                                                            */
+/*============================================================================*/
+/** Abre um arquivo BMP como fonte de linhas em escala de cinza (ver
+ * abreLeitorBMP).
+ *
+ * Parmetros: char* arquivo: caminho do arquivo.
+ *
+ * Valor de retorno: a fonte, ou NULL se no for possvel abrir a imagem. */
+
+Fluxo* fluxoAbreBMP (char* arquivo)
+{
+    int largura, altura;
+    LeitorBMP* leitor = abreLeitorBMP (arquivo, &largura, &altura);
+
+    if (!leitor)
+        return (NULL);
+
+    Fluxo* f = _fluxoCria (FLUXO_BMP, NULL, largura, altura, 0);
+    f->leitor = leitor;
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Filtro Gaussiano, como a filtroGaussiano. Cada linha  filtrada na
+ * horizontal ao chegar; o anel guarda as linhas da janela vertical.
+ *
+ * Parmetros: Fluxo* in: a entrada.
+ *             float sigmax: desvio padro na horizontal (ver filtroGaussiano).
+ *             float sigmay: desvio padro na vertical.
+ *
+ * Valor de retorno: a etapa. */
+
+Fluxo* fluxoGaussiano (Fluxo* in, float sigmax, float sigmay)
+{
+    if (!in)
+        return (NULL);
+
+    Fluxo* f = _fluxoCria (FLUXO_GAUSSIANO, in, in->largura, in->altura, 0);
+    f->coef_h = _filtroGaussianoCoef (sigmax, &f->n_h);
+    f->coef_v = _filtroGaussianoCoef (sigmay, &f->n_v);
+
+    if (f->n_h >= f->largura*2 || f->n_v >= f->altura*2)
+    {
+        printf ("ERRO: fluxoGaussiano: vetor de coeficientes grande demais!\n");
+        exit (1);
+    }
+
+    f->n_anel = f->n_v;
+    f->passo = _fluxoBytesLinha (f, 0);
+    f->anel = poolAloca (f->passo * f->n_anel);
+    f->linhas = poolAloca (sizeof (void*) * f->n_v);
+
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Normalizao sem extremos, como a normalizaSemExtremos8bpp. Como a faixa
+ * depende da imagem inteira, o histograma precisa vir de uma passada
+ * anterior (ver fluxoHistograma8bpp).
+ *
+ * Parmetros: Fluxo* in: a entrada.
+ *             const int histograma [256]: histograma da entrada.
+ *             float min: valor inferior da faixa desejada.
+ *             float max: valor superior da faixa desejada.
+ *             float descartados: proporo de pixels descartados. Precisa ser
+ *               menor que 0.5.
+ *
+ * Valor de retorno: a etapa. */
+
+Fluxo* fluxoNormalizaSemExtremos8bpp (Fluxo* in, const int histograma [256], float min, float max, float descartados)
+{
+    if (!in)
+        return (NULL);
+
+    if (max <= min)
+    {
+        printf ("ERRO: fluxoNormalizaSemExtremos8bpp: max deve ser maior que min.\n");
+        exit (1);
+    }
+
+    if (descartados <= 0 || descartados >= 0.5f)
+    {
+        printf ("ERRO: fluxoNormalizaSemExtremos8bpp: a proporcao de pixels descartados deve ficar no intervalo (0,0.5).\n");
+        exit (1);
+    }
+
+    Fluxo* f = _fluxoCria (FLUXO_NORMALIZA, in, in->largura, in->altura, 0);
+    f->min = min;
+    f->max = max;
+    _faixaSemExtremos8bpp (histograma, (int) (descartados * in->largura * in->altura), &f->min_in, &f->max_in);
+
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Limiarizao adaptativa, como a binarizaAdapt. As mdias usam as somas
+ * deslizantes da blur: as somas das colunas da janela so atualizadas a
+ * cada linha, e o anel guarda as linhas originais da janela.
+ *
+ * Parmetros: Fluxo* in: a entrada.
+ *             int largura: largura/altura da janela para a mdia. mpar.
+ *             float threshold: limiar.
+ *
+ * Valor de retorno: a etapa. As linhas tm os valores 0 e 1. */
+
+Fluxo* fluxoBinarizaAdapt (Fluxo* in, int largura, float threshold)
+{
+    if (!in)
+        return (NULL);
+
+    if (largura % 2 == 0)
+    {
+        printf ("ERRO: fluxoBinarizaAdapt: a janela deve ter largura e altura impares.\n");
+        exit (1);
+    }
+
+    Fluxo* f = _fluxoCria (FLUXO_BINARIZA_ADAPT, in, in->largura, in->altura, 0);
+    f->janela = largura;
+    f->threshold = threshold;
+
+    f->n_anel = largura + 1; // Da linha acima da janela at a ltima linha dela.
+    f->passo = _fluxoBytesLinha (f, 0);
+    f->anel = poolAloca (f->passo * f->n_anel);
+    f->auxiliar = poolAloca (f->passo);
+    f->colunas = (double*) poolAloca (sizeof (double) * f->largura);
+    memset (f->colunas, 0, sizeof (double) * f->largura);
+
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Limiarizao, como a imagemParaBin.
+ *
+ * Parmetros: Fluxo* in: a entrada.
+ *             float threshold: limiar. Pixels maiores que ele ficam em 1.
+ *
+ * Valor de retorno: a etapa, com linhas binrias. */
+
+Fluxo* fluxoParaBin (Fluxo* in, float threshold)
+{
+    if (!in)
+        return (NULL);
+
+    Fluxo* f = _fluxoCria (FLUXO_PARA_BIN, in, in->largura, in->altura, 1);
+    f->threshold = threshold;
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Dilatao e eroso binrias, como a dilataBin e a erodeBin. O anel guarda
+ * as linhas sob o kernel.
+ *
+ * Parmetros: Fluxo* in: a entrada, com linhas binrias.
+ *             Imagem* kernel: o kernel. No  copiado, e deve existir
+ *               enquanto a etapa existir.
+ *             Coordenada centro: centro do kernel.
+ *
+ * Valor de retorno: a etapa, com linhas binrias. */
+
+Fluxo* fluxoDilataBin (Fluxo* in, Imagem* kernel, Coordenada centro)
+{
+    return (_fluxoMorfologiaBin (in, kernel, centro, 1));
+}
+
+Fluxo* fluxoErodeBin (Fluxo* in, Imagem* kernel, Coordenada centro)
+{
+    return (_fluxoMorfologiaBin (in, kernel, centro, 0));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Aplica uma mscara: mantm os pixels da entrada onde a mscara  1, e
+ * zera os outros.
+ *
+ * Parmetros: Fluxo* in: a entrada.
+ *             Fluxo* mascara: a mscara, com linhas binrias e o mesmo
+ *               tamanho da entrada. Passa a ser da etapa, como a entrada.
+ *
+ * Valor de retorno: a etapa. */
+
+Fluxo* fluxoMascara (Fluxo* in, Fluxo* mascara)
+{
+    if (!in || !mascara)
+    {
+        fluxoDestroi (in);
+        fluxoDestroi (mascara);
+        return (NULL);
+    }
+
+    if (in->largura != mascara->largura || in->altura != mascara->altura)
+    {
+        printf ("ERRO: fluxoMascara: a entrada e a mascara precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    Fluxo* f = _fluxoCria (FLUXO_MASCARA, in, in->largura, in->altura, 0);
+    f->mascara = mascara;
+    return (f);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Destri uma etapa e todas as etapas de que ela depende.
+ *
+ * Parmetros: Fluxo* fluxo: a etapa. Pode ser NULL.
+ *
+ * Valor de retorno: nenhum. */
+
+void fluxoDestroi (Fluxo* fluxo)
+{
+    if (!fluxo)
+        return;
+
+    fluxoDestroi (fluxo->entrada);
+    fluxoDestroi (fluxo->mascara);
+    fechaLeitorBMP (fluxo->leitor);
+
+    poolLibera (fluxo->saida);
+    poolLibera (fluxo->anel);
+    poolLibera (fluxo->colunas);
+    poolLibera (fluxo->auxiliar);
+    poolLibera (fluxo->linhas);
+    poolLibera (fluxo->deslocada);
+    free (fluxo);
+}
+
+/*============================================================================*/
+/* CONSUMO DAS LINHAS                                                         */
+/*============================================================================*/
+/** Dimenses das linhas de uma etapa.
+ *
+ * Parmetros: Fluxo* fluxo: a etapa.
+ *
+ * Valor de retorno: a largura (nmero de pixels por linha) ou a altura
+ *                   (nmero de linhas). */
+
+int fluxoLargura (Fluxo* fluxo)
+{
+    return (fluxo->largura);
+}
+
+int fluxoAltura (Fluxo* fluxo)
+{
+    return (fluxo->altura);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Pega a prxima linha de uma etapa. As linhas saem de cima para baixo;
+ * pedir mais linhas que a altura  um erro.
+ *
+ * Parmetros: Fluxo* fluxo: a etapa.
+ *
+ * Valor de retorno: a linha (float, ou binria na fluxoLinhaBin). Ela
+ *                   pertence  etapa, e vale at o prximo pedido. */
+
+const float* fluxoLinha (Fluxo* fluxo)
+{
+    return ((const float*) _fluxoPuxa (fluxo, 0, "fluxoLinha"));
+}
+
+const uint64_t* fluxoLinhaBin (Fluxo* fluxo)
+{
+    return ((const uint64_t*) _fluxoPuxa (fluxo, 1, "fluxoLinhaBin"));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Consome todas as linhas de uma etapa, montando o histograma de 256 faixas
+ * (como a criaHistograma8bpp1c).
+ *
+ * Parmetros: Fluxo* fluxo: a etapa, com linhas float.
+ *             int histograma [256]: histograma de sada.
+ *
+ * Valor de retorno: nenhum (o histograma  preenchido). */
+
+void fluxoHistograma8bpp (Fluxo* fluxo, int histograma [256])
+{
+    int i, row;
+    unsigned char* linha = poolAloca (fluxo->largura);
+
+    for (i = 0; i < 256; i++)
+        histograma [i] = 0;
+
+    for (row = fluxo->proxima; row < fluxo->altura; row++)
+    {
+        _linhaFloatParaU8 (fluxoLinha (fluxo), fluxo->largura, linha);
+        for (i = 0; i < fluxo->largura; i++)
+            histograma [linha [i]]++;
+    }
+
+    poolLibera (linha);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Rotulagem dos componentes conexos (vizinhana-4, como a
+ * rotulaFloodFillU8) de uma etapa com linhas binrias, consumindo todas as
+ * linhas. Cada linha  dividida em corridas de pixels brancos, que se ligam
+ * s corridas da linha anterior com union-find. S ficam na memria as
+ * classes das corridas da linha anterior: quando uma classe no continua na
+ * linha atual, o componente terminou e  guardado. Os componentes saem na
+ * ordem em que terminam, e o label  a posio no vetor, comeando em 1.
+ *
+ * Parmetros: Fluxo* fluxo: a etapa.
+ *             ComponenteConexo** componentes: um ponteiro para um vetor de
+ *               sada, alocado dentro desta funo. Lembre-se de desalocar!
+ *             int largura_min: descarta componentes com largura menor que esta.
+ *             int altura_min: descarta componentes com altura menor que esta.
+ *             int n_pixels_min: descarta componentes com menos pixels que isso.
+ *
+ * Valor de retorno: o nmero de componentes conexos encontrados. */
+
+int rotulaFluxoBin (Fluxo* fluxo, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min)
+{
+    int max_corridas = fluxo->largura/2 + 1;
+    int* inicio = poolAloca (sizeof (int) * max_corridas);
+    int* fim = poolAloca (sizeof (int) * max_corridas);
+    int* classe = poolAloca (sizeof (int) * max_corridas);
+    int* inicio_ant = poolAloca (sizeof (int) * max_corridas);
+    int* fim_ant = poolAloca (sizeof (int) * max_corridas);
+    int* classe_ant = poolAloca (sizeof (int) * max_corridas);
+    int* tmp;
+    int n_corridas, n_ant = 0;
+    int row, i, j, k, raiz;
+
+    // Classes: a 0 no  usada; as liberadas voltam para a pilha de livres.
+    int capacidade = 256, n_classes = 1, n_livres = 0;
+    int* equivalencias = malloc (sizeof (int) * capacidade);
+    int* marca = malloc (sizeof (int) * capacidade); // ltima linha em que a classe foi vista.
+    int* livres = malloc (sizeof (int) * capacidade);
+    ComponenteConexo* dados = malloc (sizeof (ComponenteConexo) * capacidade);
+
+    int n = 0, capacidade_saida = 64;
+    *componentes = malloc (sizeof (ComponenteConexo) * capacidade_saida);
+
+    for (row = 0; row <= fluxo->altura; row++)
+    {
+        // Depois da ltima linha, uma linha vazia termina todos os componentes.
+        n_corridas = (row < fluxo->altura)? _fluxoCorridas (fluxoLinhaBin (fluxo), fluxo->palavras, inicio, fim) : 0;
+
+        k = 0;
+        for (i = 0; i < n_corridas; i++)
+        {
+            // Pula as corridas anteriores que terminam antes desta comear.
+            while (k < n_ant && fim_ant [k] < inicio [i])
+                k++;
+
+            if (k >= n_ant || inicio_ant [k] > fim [i]) // Nova classe.
+            {
+                if (n_livres)
+                    classe [i] = livres [--n_livres];
+                else
+                {
+                    if (n_classes == capacidade)
+                    {
+                        capacidade *= 2;
+                        equivalencias = realloc (equivalencias, sizeof (int) * capacidade);
+                        marca = realloc (marca, sizeof (int) * capacidade);
+                        livres = realloc (livres, sizeof (int) * capacidade);
+                        dados = realloc (dados, sizeof (ComponenteConexo) * capacidade);
+                    }
+                    classe [i] = n_classes++;
+                }
+                equivalencias [classe [i]] = 0;
+                marca [classe [i]] = -1;
+                dados [classe [i]].n_pixels = 0;
+                dados [classe [i]].roi = criaRetangulo (row, row, inicio [i], fim [i]);
+            }
+            else
+            {
+                // Junta todas as corridas anteriores que tocam esta.
+                classe [i] = classe_ant [k];
+                for (j = k+1; j < n_ant && inicio_ant [j] <= fim [i]; j++)
+                    _rotulaUnionU8 (equivalencias, dados, classe [i], classe_ant [j]);
+            }
+
+            ComponenteConexo* c = &(dados [rotulaFind (equivalencias, classe [i])]);
+            c->n_pixels += fim [i] - inicio [i] + 1;
+            c->roi.b = MAX (c->roi.b, row);
+            c->roi.e = MIN (c->roi.e, inicio [i]);
+            c->roi.d = MAX (c->roi.d, fim [i]);
+        }
+
+        // As corridas da linha atual passam a apontar para as razes.
+        for (i = 0; i < n_corridas; i++)
+        {
+            classe [i] = rotulaFind (equivalencias, classe [i]);
+            marca [classe [i]] = row;
+        }
+
+        // Classes da linha anterior: as que foram juntadas a outras j no
+        // servem, e as razes que no continuaram terminaram.
+        for (i = 0; i < n_ant; i++)
+        {
+            raiz = classe_ant [i];
+            if (marca [raiz] == row)
+                continue; // Continua, ou j foi tratada.
+
+            if (equivalencias [raiz] == 0)
+                _fluxoEmite (&(dados [raiz]), componentes, &n, &capacidade_saida, largura_min, altura_min, n_pixels_min);
+
+            marca [raiz] = row;
+            livres [n_livres++] = raiz;
+        }
+
+        tmp = inicio_ant; inicio_ant = inicio; inicio = tmp;
+        tmp = fim_ant; fim_ant = fim; fim = tmp;
+        tmp = classe_ant; classe_ant = classe; classe = tmp;
+        n_ant = n_corridas;
+    }
+
+    *componentes = realloc (*componentes, sizeof (ComponenteConexo) * MAX (n, 1));
+
+    free (equivalencias);
+    free (marca);
+    free (livres);
+    free (dados);
+    poolLibera (inicio);
+    poolLibera (fim);
+    poolLibera (classe);
+    poolLibera (inicio_ant);
+    poolLibera (fim_ant);
+    poolLibera (classe_ant);
+    return (n);
+}
+
+/*============================================================================*/
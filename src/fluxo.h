@@ -0,0 +1,58 @@
+/*============================================================================*/
+/* PROCESSAMENTO EM FLUXO                                                     */
+/*============================================================================*/
+/** Processamento de imagens linha por linha, para imagens grandes demais para
+ * a memria (como as de cmeras de varredura de linha). Cada etapa  um
+ * fluxo de linhas que puxa, da etapa anterior, s as linhas de que precisa
+ * (a linha atual e a margem do filtro), e guarda apenas essas em um anel.
+ * Uma cadeia de etapas usa memria proporcional  largura vezes a soma das
+ * janelas, e no  altura da imagem.
+ *
+ * As linhas saem na ordem, de cima para baixo, uma vez s. Etapas que
+ * dependem da imagem inteira (como as normalizaes pelo histograma) so
+ * feitas em mais de uma passada: uma cadeia calcula o histograma, e outra,
+ * criada depois, usa o histograma. As contas so as mesmas das funes
+ * para imagens inteiras, ento o resultado  idntico.
+ *
+ * Cada etapa passa a ser dona da(s) sua(s) entrada(s): destruir a ltima
+ * etapa destri a cadeia toda. Os construtores aceitam uma entrada NULL (e
+ * ento retornam NULL), para que uma cadeia possa ser montada sem conferir
+ * cada passo. */
+/*============================================================================*/
+
+#ifndef __FLUXO_H
+#define __FLUXO_H
+
+/*============================================================================*/
+
+#include <stdint.h>
+#include "imagem.h"
+#include "geometria.h"
+#include "segmenta.h"
+
+/*============================================================================*/
+
+typedef struct _Fluxo Fluxo;
+
+/* Fontes e etapas. As etapas float entregam linhas float; as binrias
+ * entregam linhas de 1 bit por pixel, no formato das linhas de ImagemBin. */
+Fluxo* fluxoAbreBMP (char* arquivo);
+Fluxo* fluxoGaussiano (Fluxo* in, float sigmax, float sigmay);
+Fluxo* fluxoNormalizaSemExtremos8bpp (Fluxo* in, const int histograma [256], float min, float max, float descartados);
+Fluxo* fluxoBinarizaAdapt (Fluxo* in, int largura, float threshold);
+Fluxo* fluxoParaBin (Fluxo* in, float threshold);
+Fluxo* fluxoDilataBin (Fluxo* in, Imagem* kernel, Coordenada centro);
+Fluxo* fluxoErodeBin (Fluxo* in, Imagem* kernel, Coordenada centro);
+Fluxo* fluxoMascara (Fluxo* in, Fluxo* mascara);
+void fluxoDestroi (Fluxo* fluxo);
+
+/* Consumo das linhas. */
+int fluxoLargura (Fluxo* fluxo);
+int fluxoAltura (Fluxo* fluxo);
+const float* fluxoLinha (Fluxo* fluxo);
+const uint64_t* fluxoLinhaBin (Fluxo* fluxo);
+void fluxoHistograma8bpp (Fluxo* fluxo, int histograma [256]);
+int rotulaFluxoBin (Fluxo* fluxo, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min);
+
+/*============================================================================*/
+#endif /* __FLUXO_H */
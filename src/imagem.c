@@ -13,26 +13,74 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "imagem.h"
 #include "base.h"
+#include "pool.h"
 
 /*============================================================================*/
 
 #define MIN(a,b) ((a<b)?a:b)
 #define MAX(a,b) ((a>b)?a:b)
 
-unsigned long getLittleEndianULong (unsigned char* buffer);
-int leHeaderBitmap (FILE* stream, unsigned long* offset);
-int leHeaderDIB (FILE* stream, unsigned long* largura, unsigned long* altura);
-int leDados (FILE* stream, Imagem* img);
+int _passoImagem (int largura);
+
+/* Um arquivo inteiro na memria: mapeado com mmap ou, se no der, lido em um
+ * nico bloco. */
+typedef struct
+{
+	unsigned char* dados;
+	size_t tamanho;
+	int mapeado;
+} ArquivoMemoria;
+
+int _abreArquivoMemoria (char* arquivo, ArquivoMemoria* arq);
+void _fechaArquivoMemoria (ArquivoMemoria* arq);
+
+unsigned long getLittleEndianULong (const unsigned char* buffer);
+unsigned short getLittleEndianUShort (const unsigned char* buffer);
+int leHeaderBitmap (const unsigned char* arquivo, size_t tamanho, unsigned long* offset);
+
+/* O que os cabealhos dizem sobre os pixels de um BMP. */
+typedef struct
+{
+	int largura;
+	int altura;
+	int bpp; /* 8 (com paleta), 24 ou 32. */
+	int de_cima_para_baixo; /* Altura negativa no arquivo: a primeira linha  a de cima. */
+	size_t bytes_por_linha; /* J com o preenchimento at um mltiplo de 4 bytes. */
+	unsigned char paleta [256*4]; /* 8 bpp: as cores, em BGRA. As que no esto no arquivo ficam pretas. */
+} FormatoBMP;
+
+/* Tabelas da decodificao, montadas uma vez por imagem. */
+typedef struct
+{
+	float valor [256]; /* Cada byte na faixa [0,1]. */
+	float r [256], g [256], b [256]; /* J multiplicados pelo peso de cada canal no cinza. */
+	float paleta_cinza [256]; /* 8 bpp: o cinza de cada cor da paleta. */
+} TabelasBMP;
+
+int leHeaderDIB (const unsigned char* arquivo, size_t tamanho, FormatoBMP* formato);
+int _abreBMP (char* arquivo, ArquivoMemoria* arq, FormatoBMP* formato, unsigned long* data_offset);
+int _dadosCompletosBMP (const FormatoBMP* formato, size_t tamanho);
+const unsigned char* _linhaBMP (const unsigned char* dados, const FormatoBMP* formato, int y);
+void _tabelasBMP (const FormatoBMP* formato, TabelasBMP* tab);
+void _linhaBMPParaCinza (const unsigned char* linha, const FormatoBMP* formato, const TabelasBMP* tab, float* out);
+void _linhaBMPParaRGB (const unsigned char* linha, const FormatoBMP* formato, const TabelasBMP* tab, float* r, float* g, float* b);
+int leDados (const unsigned char* dados, size_t tamanho, const FormatoBMP* formato, Imagem* img);
+int leDadosU8 (const unsigned char* dados, size_t tamanho, const FormatoBMP* formato, ImagemU8* img);
 
 void putLittleEndianULong (unsigned long val, unsigned char* buffer);
 void putLittleEndianUShort (unsigned short val, unsigned char* buffer);
-int salvaHeaderBitmap (FILE* stream, Imagem* img);
-int salvaHeaderDIB (FILE* stream, Imagem* img);
+unsigned long _bytesPorLinhaBMP (int largura, int bpp);
 int salvaDados (FILE* stream, Imagem* img);
+int salvaDadosU8 (FILE* stream, ImagemU8* img);
 
 /*============================================================================*/
 /* FUNES DO MDULO                                                          */
@@ -49,6 +97,8 @@ int salvaDados (FILE* stream, Imagem* img);
 Imagem* criaImagem (int largura, int altura, int n_canais)
 {
 	int i, j;
+	size_t bytes_cabecalho, bytes_indices, bytes_pixels;
+	char* memoria;
 	Imagem* img;
 
 	if (largura <= 0 || altura <= 0 || n_canais <= 0)
@@ -57,18 +107,34 @@ Imagem* criaImagem (int largura, int altura, int n_canais)
         return (NULL);
     }
 
-	img = (Imagem*) malloc (sizeof (Imagem));
+	/* Tudo fica em um nico bloco: a estrutura, os ponteiros de linhas (para
+	  manter o acesso por dados [canal][y][x]) e os pixels. Cada linha comea
+	  em um endereo alinhado, por isso o passo pode ser maior que a largura. */
+	bytes_cabecalho = _alinhaBytes (sizeof (Imagem));
+	bytes_indices = _alinhaBytes (sizeof (float**) * n_canais + sizeof (float*) * n_canais * altura);
+	bytes_pixels = sizeof (float) * _passoImagem (largura) * altura * n_canais;
+
+	memoria = (char*) poolAloca (bytes_cabecalho + bytes_indices + bytes_pixels);
+	if (!memoria)
+	{
+		printf ("criaImagem: memoria insuficiente.\n");
+		return (NULL);
+	}
 
+	img = (Imagem*) memoria;
 	img->largura = largura;
 	img->altura = altura;
 	img->n_canais = n_canais;
+	img->passo = _passoImagem (largura);
+	img->bloco = (float*) (memoria + bytes_cabecalho + bytes_indices);
+	img->visao = 0;
 
-    img->dados = (float***) malloc (sizeof (float**) * n_canais); /* Uma matriz por canal. */
+    img->dados = (float***) (memoria + bytes_cabecalho); /* Uma matriz por canal. */
 	for (i = 0; i < n_canais; i++)
 	{
-		img->dados [i] = (float**) malloc (sizeof (float*) * altura);
+		img->dados [i] = ((float**) (img->dados + n_canais)) + i*altura;
 		for (j = 0; j < altura; j++)
-			img->dados [i][j] = (float*) malloc (sizeof (float) * largura);
+			img->dados [i][j] = img->bloco + ((size_t) i*altura + j) * img->passo;
 	}
 
 	return (img);
@@ -83,16 +149,7 @@ Imagem* criaImagem (int largura, int altura, int n_canais)
 
 void destroiImagem (Imagem* img)
 {
-	int i, j;
-
-	for (i = 0; i < img->n_canais; i++)
-	{
-		for (j = 0; j < img->altura; j++)
-			free (img->dados [i][j]);
-		free (img->dados [i]);
-	}
-	free (img->dados);
-	free (img);
+	poolLibera (img); /* A estrutura est no incio do bloco. */
 }
 
 /*----------------------------------------------------------------------------*/
@@ -107,8 +164,9 @@ void destroiImagem (Imagem* img)
 
 Imagem* abreImagem (char* arquivo, int n_canais)
 {
-	FILE* stream;
-	unsigned long data_offset = 0, largura = 0, altura = 0;
+	ArquivoMemoria arq;
+	unsigned long data_offset = 0;
+	FormatoBMP formato;
 	Imagem* img;
 
     if (n_canais != 1 && n_canais != 3)
@@ -117,70 +175,23 @@ Imagem* abreImagem (char* arquivo, int n_canais)
         return (NULL);
 	}
 
-	/* Abre o arquivo. */
-	stream = fopen (arquivo, "rb");
-	if (!stream)
-		return (NULL);
-
-	if (!leHeaderBitmap (stream, &data_offset))
-	{
-		fclose (stream);
-		return (NULL);
-	}
-
-	if (!leHeaderDIB (stream, &largura, &altura))
-	{
-		fclose (stream);
-		return (NULL);
-	}
-
-	/* Pronto, cabealhos lidos! Vamos agora colocar o fluxo nos dados... */
-	if (fseek (stream, data_offset, SEEK_SET) != 0)
-	{
-		printf ("abreImagem: erro lendo dados do arquivo.\n");
-		fclose (stream);
+	if (!_abreBMP (arquivo, &arq, &formato, &data_offset))
 		return (NULL);
-	}
 
-	/* ... e tudo pronto para criar nossa imagem! */
-	img = criaImagem (largura, altura, 3);
+	/* Tudo pronto para criar nossa imagem! Se o chamador espera uma imagem de
+	  1 canal, a converso para escala de cinza  feita durante a leitura. */
+	img = criaImagem (formato.largura, formato.altura, n_canais);
 
 	/* L os dados. */
-	if (!leDados (stream, img))
+	if (!leDados (arq.dados + data_offset, arq.tamanho - data_offset, &formato, img))
 	{
 		printf ("abreImagem: erro lendo dados do arquivo.\n");
-		fclose (stream);
-		free (img);
+		_fechaArquivoMemoria (&arq);
+		destroiImagem (img);
 		return (NULL);
 	}
 
-	fclose (stream);
-
-	/* Se o chamador espera uma imagem de 1 canal, converte para escala de cinza. */
-    if (n_canais == 1)
-    {
-        int i, j;
-        float** ptr_canal0;
-
-        /* Para no ficar to ineficiente, reaproveita a memria da imagem RGB original. */
-        for (i = 0; i < img->altura; i++)
-            for (j = 0; j < img->largura; j++)
-                img->dados [0][i][j] = img->dados [0][i][j] * 0.299f + img->dados [1][i][j] * 0.587f + img->dados [2][i][j] * 0.114f;
-
-        /* Modifica a imagem original. */
-        ptr_canal0 = img->dados [0];
-        for (i = 1; i < img->n_canais; i++)
-        {
-            for (j = 0; j < img->altura; j++)
-                free (img->dados [i][j]);
-            free (img->dados[i]);
-        }
-        img->n_canais = 1;
-        free (img->dados);
-        img->dados = (float***) malloc (sizeof (float**));
-        img->dados [0] = ptr_canal0;
-    }
-
+	_fechaArquivoMemoria (&arq);
     return (img);
 }
 
@@ -195,6 +206,7 @@ Imagem* abreImagem (char* arquivo, int n_canais)
 int salvaImagem (Imagem* img, char* arquivo)
 {
 	FILE* stream;
+	int bpp = (img->n_canais == 1)? 8 : 24;
 
 	if (img->n_canais != 1 && img->n_canais != 3)
 	{
@@ -207,14 +219,21 @@ int salvaImagem (Imagem* img, char* arquivo)
 	if (!stream)
 		return (0);
 
-	/* Escreve os blocos. */
-	if (!salvaHeaderBitmap (stream, img))
+	/* Escreve os blocos. Imagens de 1 canal so salvas com 8 bpp e uma paleta
+	  de tons de cinza. */
+	if (!salvaHeaderBitmap (stream, img->largura, img->altura, bpp))
+	{
+		fclose (stream);
+		return (0);
+	}
+
+	if (!salvaHeaderDIB (stream, img->largura, img->altura, bpp))
 	{
 		fclose (stream);
 		return (0);
 	}
 
-	if (!salvaHeaderDIB (stream, img))
+	if (!salvaPaleta (stream, bpp))
 	{
 		fclose (stream);
 		return (0);
@@ -239,14 +258,8 @@ int salvaImagem (Imagem* img, char* arquivo)
 
 Imagem* clonaImagem (Imagem* img)
 {
-    int i, j, k;
     Imagem* clone = criaImagem (img->largura, img->altura, img->n_canais);
-
-    for (i = 0; i < img->n_canais; i++)
-        for (j = 0; j < img->altura; j++)
-            for (k = 0; k < img->largura; k++)
-                clone->dados [i][j][k] = img->dados [i][j][k];
-
+    copiaConteudo (img, clone);
     return (clone);
 }
 
@@ -260,7 +273,7 @@ Imagem* clonaImagem (Imagem* img)
 
 void copiaConteudo (Imagem* in, Imagem* out)
 {
-    int i, j, k;
+    int i, j;
 
     if (in->largura != out->largura || in->altura != out->altura || in->n_canais != out->n_canais)
     {
@@ -268,10 +281,97 @@ void copiaConteudo (Imagem* in, Imagem* out)
         exit (1);
     }
 
+    if (in == out)
+        return;
+
+    /* Com o mesmo passo, os blocos tm o mesmo formato e podem ser copiados de uma vez. */
+    if (in->passo == out->passo && !in->visao && !out->visao)
+    {
+        memcpy (out->bloco, in->bloco, sizeof (float) * in->passo * in->altura * in->n_canais);
+        return;
+    }
+
     for (i = 0; i < in->n_canais; i++)
         for (j = 0; j < in->altura; j++)
-            for (k = 0; k < in->largura; k++)
-                out->dados [i][j][k] = in->dados [i][j][k];
+            memcpy (out->dados [i][j], in->dados [i][j], sizeof (float) * in->largura);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Troca duas imagens de lugar, sem copiar nenhum pixel. Serve para
+ * encadear etapas de processamento com duas imagens ("ping-pong"): a sada de
+ * uma etapa vira a entrada da prxima, e a entrada antiga  reaproveitada
+ * como a prxima sada.
+ *
+ * Parmetros: Imagem** a: ponteiro para a primeira imagem...
+ *             Imagem** b: ... e para a segunda. Devem ter o mesmo tamanho e
+ *               nmero de canais.
+ *
+ * Valor de retorno: nenhum (os ponteiros so trocados). */
+
+void trocaImagens (Imagem** a, Imagem** b)
+{
+    if ((*a)->largura != (*b)->largura || (*a)->altura != (*b)->altura || (*a)->n_canais != (*b)->n_canais)
+    {
+        printf ("ERRO: trocaImagens: as imagens precisam ter o mesmo tamanho e numero de canais.\n");
+        exit (1);
+    }
+
+    Imagem* aux = *a;
+    *a = *b;
+    *b = aux;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Cria uma viso de uma regio retangular de uma imagem. A viso s tem os
+ * ponteiros de linhas, que apontam para dentro da imagem original: nenhum
+ * pixel  copiado, e os filtros aplicados sobre a viso tocam apenas a
+ * regio.
+ *
+ * Parmetros: Imagem* img: imagem original. Pode ser outra viso.
+ *             Retangulo roi: regio da imagem original (inclusive).
+ *
+ * Valor de retorno: a viso, ou NULL se a regio no estiver dentro da
+ *                   imagem. Destrua-a com destroiImagem. */
+
+Imagem* criaVisao (Imagem* img, Retangulo roi)
+{
+	int i, j, altura;
+	size_t bytes_cabecalho;
+	char* memoria;
+	Imagem* visao;
+
+	if (roi.c < 0 || roi.e < 0 || roi.b >= img->altura || roi.d >= img->largura || roi.c > roi.b || roi.e > roi.d)
+	{
+		printf ("criaVisao: a regiao precisa estar dentro da imagem.\n");
+		return (NULL);
+	}
+
+	altura = roi.b - roi.c + 1;
+	bytes_cabecalho = _alinhaBytes (sizeof (Imagem));
+	memoria = (char*) poolAloca (bytes_cabecalho + sizeof (float**) * img->n_canais + sizeof (float*) * img->n_canais * altura);
+	if (!memoria)
+	{
+		printf ("criaVisao: memoria insuficiente.\n");
+		return (NULL);
+	}
+
+	visao = (Imagem*) memoria;
+	visao->largura = roi.d - roi.e + 1;
+	visao->altura = altura;
+	visao->n_canais = img->n_canais;
+	visao->passo = img->passo;
+	visao->bloco = img->dados [0][roi.c] + roi.e;
+	visao->visao = 1;
+
+	visao->dados = (float***) (memoria + bytes_cabecalho);
+	for (i = 0; i < img->n_canais; i++)
+	{
+		visao->dados [i] = ((float**) (visao->dados + img->n_canais)) + i*altura;
+		for (j = 0; j < altura; j++)
+			visao->dados [i][j] = img->dados [i][roi.c + j] + roi.e;
+	}
+
+	return (visao);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -373,237 +473,1008 @@ void redimensionaBilinear (Imagem* in, Imagem* out)
 }
 
 /*============================================================================*/
-/* FUNES INTERNAS (LEITURA)                                                 */
+/* IMAGENS DE 8 BITS                                                          */
 /*============================================================================*/
-/** Pega os 4 primeiros bytes do buffer e coloca em um unsigned long,
- * considerando os bytes em ordem little endian.
+/** Cria uma imagem vazia de 8 bits em escala de cinza.
  *
- * Parmetros: unsigned char* buffer: l 4 bytes daqui.
+ * Parmetros: int largura: largura da imagem.
+ *             int altura: altura da imagem.
  *
- * Valor de Retorno: um unsigned long com os dados do buffer reorganizados. */
+ * Valor de retorno: a imagem alocada. A responsabilidade por desaloc-la  do
+ *                   chamador. */
 
-unsigned long getLittleEndianULong (unsigned char* buffer)
+ImagemU8* criaImagemU8 (int largura, int altura)
 {
-	return (buffer [3] << 24) | (buffer [2] << 16) | (buffer [1] << 8) | buffer [0];
+	int i;
+	size_t bytes_cabecalho, bytes_indices, bytes_pixels;
+	char* memoria;
+	ImagemU8* img;
+
+	if (largura <= 0 || altura <= 0)
+    {
+        printf ("criaImagemU8: imagens devem ter altura e largura maiores que 0.\n");
+        return (NULL);
+    }
+
+	/* Mesmo esquema da criaImagem: estrutura, ponteiros e pixels em um s bloco. */
+	bytes_cabecalho = _alinhaBytes (sizeof (ImagemU8));
+	bytes_indices = _alinhaBytes (sizeof (unsigned char*) * altura);
+	bytes_pixels = _alinhaBytes (largura) * altura;
+
+	memoria = (char*) poolAloca (bytes_cabecalho + bytes_indices + bytes_pixels);
+	if (!memoria)
+	{
+		printf ("criaImagemU8: memoria insuficiente.\n");
+		return (NULL);
+	}
+
+	img = (ImagemU8*) memoria;
+	img->largura = largura;
+	img->altura = altura;
+	img->passo = (int) _alinhaBytes (largura);
+	img->bloco = (unsigned char*) (memoria + bytes_cabecalho + bytes_indices);
+	img->visao = 0;
+
+	img->dados = (unsigned char**) (memoria + bytes_cabecalho);
+	for (i = 0; i < altura; i++)
+		img->dados [i] = img->bloco + (size_t) i * img->passo;
+
+	return (img);
 }
 
 /*----------------------------------------------------------------------------*/
-/** L o header de 14 bytes do formato BMP.
+/** Destroi uma imagem de 8 bits.
  *
- * Parmetros: FILE* stream: arquivo a ser lido. Supomos que j est aberto.
- *             unsigned long* offset: parmetro de sada,  o deslocamento dos
- *               dados a partir do incio do arquivo.
+ * Parmetros: ImagemU8* img: a imagem a destruir.
  *
- * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+ * Valor de retorno: nenhum. */
 
-int leHeaderBitmap (FILE* stream, unsigned long* offset)
+void destroiImagemU8 (ImagemU8* img)
 {
-	unsigned char data [14]; /* O bloco tem exatamente 14 bytes. */
+	poolLibera (img);
+}
 
-	if (fread ((void*) data, 1, 14, stream) != 14)
-	{
-		printf ("leHeaderBitmap: erro lendo header.\n");
-		return (0);
-	}
+/*----------------------------------------------------------------------------*/
+/** Abre um arquivo de imagem dado, j convertendo para escala de cinza com 8
+ * bits por pixel.
+ *
+ * Parmetros: char* arquivo: caminho do arquivo a abrir.
+ *
+ * Valor de retorno: uma imagem alocada contendo os dados do arquivo, ou NULL
+ *                   se no for possvel abrir a imagem. */
 
-	/* Os 2 primeiros bytes precisam ser 'B' e 'M'. */
-	if (data [0] != 'B' || data [1] != 'M')
+ImagemU8* abreImagemU8 (char* arquivo)
+{
+	ArquivoMemoria arq;
+	unsigned long data_offset = 0;
+	FormatoBMP formato;
+	ImagemU8* img;
+
+	if (!_abreBMP (arquivo, &arq, &formato, &data_offset))
+		return (NULL);
+
+	img = criaImagemU8 (formato.largura, formato.altura);
+
+	if (!leDadosU8 (arq.dados + data_offset, arq.tamanho - data_offset, &formato, img))
 	{
-		printf ("leHeaderBitmap: pode ler apenas formato BM.\n");
-		return (0);
+		printf ("abreImagemU8: erro lendo dados do arquivo.\n");
+		_fechaArquivoMemoria (&arq);
+		destroiImagemU8 (img);
+		return (NULL);
 	}
 
-	/* Vou pular todo o resto e ir direto para o offset. */
-	*offset = getLittleEndianULong (&(data [10]));
-	return (1);
+	_fechaArquivoMemoria (&arq);
+	return (img);
 }
 
 /*----------------------------------------------------------------------------*/
-/** L o header DIB.
+/** Salva uma imagem de 8 bits em um arquivo dado.
  *
- * Parmetros: FILE* stream: arquivo a ser lido. Supomos que j est aberto.
- *             unsigned long* largura: parmetro de sada. Largura da imagem.
- *             unsigned long* altura: parmetro de sada. Altura da imagem.
+ * Parmetros: ImagemU8* img: imagem a salvar.
+ *             char* arquivo: caminho do arquivo a salvar.
  *
- * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+ * Valor de retorno: 0 se ocorreu algum erro, 1 do contrrio. */
 
-int leHeaderDIB (FILE* stream, unsigned long* largura, unsigned long* altura)
+int salvaImagemU8 (ImagemU8* img, char* arquivo)
 {
-	unsigned long size = 0; /* O tamanho do cabealho DIB. */
+	FILE* stream;
 
-	if (fread ((void*) &size, 4, 1, stream) != 1)
-	{
-		printf ("leHeaderDIB: erro lendo header.\n");
+	stream = fopen (arquivo, "wb");
+	if (!stream)
 		return (0);
-	}
 
-	if (size == 12) /* Formato BITMAPCOREHEADER. */
+	if (!salvaHeaderBitmap (stream, img->largura, img->altura, 8) ||
+		!salvaHeaderDIB (stream, img->largura, img->altura, 8) ||
+		!salvaPaleta (stream, 8) ||
+		!salvaDadosU8 (stream, img))
 	{
-		printf ("leHeaderDIB: BITMAPCOREHEADER nao suportado (arquivo antigo!?)\n");
+		fclose (stream);
 		return (0);
 	}
-	else if (size >= 40) /* Outros formatos. */
-	{
-		unsigned short tmp_short = 0;
-		unsigned long tmp_long = 0;
 
-		/* Largura. */
-		if (fread ((void*) largura, 4, 1, stream) != 1 || *largura <= 0)
-		{
-			printf ("leHeaderDIB: largura invalida.\n");
-			return (0);
-		}
+	fclose (stream);
+	return (1);
+}
 
-		/* Altura. */
-		if (fread ((void*) altura, 4, 1, stream) != 1 || *altura <= 0)
-		{
-			printf ("leHeaderDIB: altura invalida.\n");
-			return (0);
-		}
+/*----------------------------------------------------------------------------*/
+/** Cria uma cpia de uma imagem de 8 bits.
+ *
+ * Parmetros: ImagemU8* img: imagem a clonar.
+ *
+ * Valor de retorno: uma nova imagem, igual  imagem dada. */
 
-		/* Color planes. Precisa ser 1. */
-		if (fread ((void*) &tmp_short, 2, 1, stream) != 1 || tmp_short != 1)
-		{
-			printf ("leHeaderDIB: erro lendo header.\n");
-			return (0);
-		}
+ImagemU8* clonaImagemU8 (ImagemU8* img)
+{
+    ImagemU8* clone = criaImagemU8 (img->largura, img->altura);
+    copiaConteudoU8 (img, clone);
+    return (clone);
+}
 
-		/* Bpp. Aqui, estou forando 24 bpp. */
-		if (fread ((void*) &tmp_short, 2, 1, stream) != 1 || tmp_short != 24)
-		{
-			printf ("leHeaderDIB: supporta apenas arquivos com 24 bpp.\n");
-			return (0);
-		}
+/*----------------------------------------------------------------------------*/
+/** Copia o contedo de uma imagem de 8 bits para outra.
+ *
+ * Parmetros: ImagemU8* in: copia desta imagem...
+ *             ImagemU8* out: ... para esta.
+ *
+ * Valor de retorno: nenhum. */
 
-		/* Compresso. Vou aceitar s imagens sem compresso. */
-		if (fread ((void*) &tmp_long, 4, 1, stream) != 1 || tmp_long != 0)
-		{
-			printf ("leHeaderDIB: suporta apenas arquivos sem compressao.\n");
-			return (0);
-		}
+void copiaConteudoU8 (ImagemU8* in, ImagemU8* out)
+{
+    int i;
 
-		/* Pula os prximos 12 bytes. */
-		if (fseek (stream, 12, SEEK_CUR) != 0)
-		{
-			printf ("leHeaderDIB: erro lendo header.\n");
-			return (0);
-		}
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: copiaConteudoU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
 
-		/* Paleta. No  para usar! */
-		if (fread ((void*) &tmp_long, 4, 1, stream) != 1 || tmp_long != 0)
-		{
-			printf ("leHeaderDIB: sem suporte a arquivos com paletas de cores.\n");
-			return (0);
-		}
+    if (in == out)
+        return;
 
-		return (1);
-	}
+    if (in->passo == out->passo && !in->visao && !out->visao)
+    {
+        memcpy (out->bloco, in->bloco, (size_t) in->passo * in->altura);
+        return;
+    }
 
-	return (0);
+    for (i = 0; i < in->altura; i++)
+        memcpy (out->dados [i], in->dados [i], in->largura);
 }
 
 /*----------------------------------------------------------------------------*/
-/** L os dados de um arquivo.
+/** Troca duas imagens de 8 bits de lugar, sem copiar nenhum pixel. Ver
+ * trocaImagens.
  *
- * Parmetros: FILE* stream: arquivo a ser lido. Supomos que j est aberto.
- *             Imagem* img: imagem a preencher.
+ * Parmetros: ImagemU8** a: ponteiro para a primeira imagem...
+ *             ImagemU8** b: ... e para a segunda. Devem ter o mesmo tamanho.
  *
- * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+ * Valor de retorno: nenhum (os ponteiros so trocados). */
 
-int leDados (FILE* stream, Imagem* img)
+void trocaImagensU8 (ImagemU8** a, ImagemU8** b)
 {
-	long long i, j, k;
-	int line_padding;
-	unsigned char data;
+    if ((*a)->largura != (*b)->largura || (*a)->altura != (*b)->altura)
+    {
+        printf ("ERRO: trocaImagensU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    ImagemU8* aux = *a;
+    *a = *b;
+    *b = aux;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Cria uma viso de uma regio retangular de uma imagem de 8 bits. Ver
+ * criaVisao.
+ *
+ * Parmetros: ImagemU8* img: imagem original. Pode ser outra viso.
+ *             Retangulo roi: regio da imagem original (inclusive).
+ *
+ * Valor de retorno: a viso, ou NULL se a regio no estiver dentro da
+ *                   imagem. Destrua-a com destroiImagemU8. */
 
-	/* Calcula quantos bytes preciso pular no fim de cada linha.
-	  Aqui, cada linha precisa ter um mltiplo de 4. */
-	line_padding = (int) ceil (img->largura*3.0/4.0)*4 - (img->largura*3);
+ImagemU8* criaVisaoU8 (ImagemU8* img, Retangulo roi)
+{
+	int i, altura;
+	size_t bytes_cabecalho;
+	char* memoria;
+	ImagemU8* visao;
 
-	/* L! */
-	for (i = img->altura-1; i >= 0; i--)
+	if (roi.c < 0 || roi.e < 0 || roi.b >= img->altura || roi.d >= img->largura || roi.c > roi.b || roi.e > roi.d)
 	{
-		for (j = 0; j < img->largura; j++)
-		{
-		    /* L 3 bytes, na ordem BGR. */
-		    for (k = 0; k < 3; k++)
-		    {
-                if (fread (&data, 1, 1, stream) != 1)
-                    return (0);
-
-                img->dados [2-k][i][j] = (float) data / 255.0f; // 2-k -> 0 = R, 1 = G, 2 = B. Coloca na faixa [0,1]
-		    }
-		}
+		printf ("criaVisaoU8: a regiao precisa estar dentro da imagem.\n");
+		return (NULL);
+	}
 
-		if (fseek (stream, line_padding, SEEK_CUR) != 0)
-			return (0);
+	altura = roi.b - roi.c + 1;
+	bytes_cabecalho = _alinhaBytes (sizeof (ImagemU8));
+	memoria = (char*) poolAloca (bytes_cabecalho + sizeof (unsigned char*) * altura);
+	if (!memoria)
+	{
+		printf ("criaVisaoU8: memoria insuficiente.\n");
+		return (NULL);
 	}
 
-	return (1);
+	visao = (ImagemU8*) memoria;
+	visao->largura = roi.d - roi.e + 1;
+	visao->altura = altura;
+	visao->passo = img->passo;
+	visao->bloco = img->dados [roi.c] + roi.e;
+	visao->visao = 1;
+
+	visao->dados = (unsigned char**) (memoria + bytes_cabecalho);
+	for (i = 0; i < altura; i++)
+		visao->dados [i] = img->dados [roi.c + i] + roi.e;
+
+	return (visao);
 }
 
-/*============================================================================*/
-/* FUNES INTERNAS (ESCRITA)                                                 */
-/*============================================================================*/
-/** Coloca um unsigned long nos 4 primeiros bytes do buffer, em ordem little
- * endian.
+/*----------------------------------------------------------------------------*/
+/** Converte um canal de uma imagem float para 8 bits. Os valores no intervalo
+ * [0,1] so levados para [0,255], com arredondamento e saturao.
  *
- * Parmetros: unsigned long val: valor a escrever.
- *             unsigned char* buffer: coloca o valor aqui.
+ * Parmetros: Imagem* in: imagem de entrada.
+ *             int canal: canal da imagem de entrada a converter.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
  *
- * Valor de Retorno: NENHUM */
+ * Valor de retorno: nenhum. */
 
-void putLittleEndianULong (unsigned long val, unsigned char* buffer)
+void imagemParaU8 (Imagem* in, int canal, ImagemU8* out)
 {
-	buffer [0] = (unsigned char) val;
-	buffer [1] = (unsigned char) (val >> 8);
-	buffer [2] = (unsigned char) (val >> 16);
-	buffer [3] = (unsigned char) (val >> 24);
+    int row;
+
+    if (in->largura != out->largura || in->altura != out->altura || canal < 0 || canal >= in->n_canais)
+    {
+        printf ("ERRO: imagemParaU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    for (row = 0; row < in->altura; row++)
+        _linhaFloatParaU8 (in->dados [canal][row], in->largura, out->dados [row]);
 }
 
 /*----------------------------------------------------------------------------*/
-/** Coloca um unsigned short nos 2 primeiros bytes do buffer, em ordem little
- * endian.
+/** Converte uma imagem de 8 bits para float, no intervalo [0,1]. Se a imagem
+ * de sada tiver mais de 1 canal, o valor  replicado em todos eles.
  *
- * Parmetros: unsigned short val: valor a escrever.
- *             unsigned char* buffer: coloca o valor aqui.
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada.
  *
- * Valor de Retorno: NENHUM */
+ * Valor de retorno: nenhum. */
 
-void putLittleEndianUShort (unsigned short val, unsigned char* buffer)
+void U8ParaImagem (ImagemU8* in, Imagem* out)
+{
+    int channel, row, col;
+
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: U8ParaImagem: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    for (channel = 0; channel < out->n_canais; channel++)
+        for (row = 0; row < in->altura; row++)
+        {
+            const unsigned char* lin_in = in->dados [row];
+            float* lin_out = out->dados [channel][row];
+            for (col = 0; col < in->largura; col++)
+                lin_out [col] = (float) lin_in [col] / 255.0f;
+        }
+}
+
+/*============================================================================*/
+/* LEITURA LINHA POR LINHA                                                    */
+/*============================================================================*/
+
+struct _LeitorBMP
+{
+	ArquivoMemoria arq;
+	const unsigned char* dados; /* Incio dos pixels no arquivo. */
+	FormatoBMP formato;
+	TabelasBMP tabelas;
+};
+
+/** Abre um arquivo BMP para leitura linha por linha. Apenas os cabealhos so
+ * lidos aqui; o arquivo fica mapeado na memria, e cada linha  convertida
+ * para escala de cinza quando pedida (como em abreImagem com 1 canal).
+ *
+ * Parmetros: char* arquivo: caminho do arquivo a abrir.
+ *             int* largura: sada. Largura da imagem.
+ *             int* altura: sada. Altura da imagem.
+ *
+ * Valor de retorno: o leitor, ou NULL se no for possvel abrir a imagem.
+ *                   Feche com fechaLeitorBMP. */
+
+LeitorBMP* abreLeitorBMP (char* arquivo, int* largura, int* altura)
+{
+	ArquivoMemoria arq;
+	unsigned long data_offset = 0;
+	LeitorBMP* leitor = (LeitorBMP*) malloc (sizeof (LeitorBMP));
+
+	if (!_abreBMP (arquivo, &arq, &leitor->formato, &data_offset))
+	{
+		free (leitor);
+		return (NULL);
+	}
+
+	/* Confere logo se todas as linhas esto no arquivo, como em leDados. */
+	if (!_dadosCompletosBMP (&leitor->formato, arq.tamanho - data_offset))
+	{
+		printf ("abreLeitorBMP: erro lendo dados do arquivo.\n");
+		_fechaArquivoMemoria (&arq);
+		free (leitor);
+		return (NULL);
+	}
+
+	leitor->arq = arq;
+	leitor->dados = arq.dados + data_offset;
+	_tabelasBMP (&leitor->formato, &leitor->tabelas);
+
+	*largura = leitor->formato.largura;
+	*altura = leitor->formato.altura;
+	return (leitor);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L uma linha de um BMP aberto com abreLeitorBMP, em escala de cinza. As
+ * linhas podem ser pedidas em qualquer ordem.
+ *
+ * Parmetros: LeitorBMP* leitor: o leitor.
+ *             int y: a linha, contando de cima para baixo.
+ *             float* linha: sada. Deve ter espao para a largura da imagem.
+ *
+ * Valor de retorno: nenhum. */
+
+void leLinhaBMP (LeitorBMP* leitor, int y, float* linha)
+{
+	_linhaBMPParaCinza (_linhaBMP (leitor->dados, &leitor->formato, y), &leitor->formato, &leitor->tabelas, linha);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Fecha um leitor aberto com abreLeitorBMP.
+ *
+ * Parmetros: LeitorBMP* leitor: o leitor. Pode ser NULL.
+ *
+ * Valor de retorno: nenhum. */
+
+void fechaLeitorBMP (LeitorBMP* leitor)
+{
+	if (!leitor)
+		return;
+
+	_fechaArquivoMemoria (&leitor->arq);
+	free (leitor);
+}
+
+/*============================================================================*/
+/* FUNES INTERNAS (ALOCAO)                                                */
+/*============================================================================*/
+/** Arredonda um nmero de bytes para cima, at um mltiplo do alinhamento.
+ *
+ * Parmetros: size_t bytes: nmero de bytes.
+ *
+ * Valor de Retorno: o nmero arredondado. */
+
+size_t _alinhaBytes (size_t bytes)
+{
+	return ((bytes + IMAGEM_ALINHAMENTO - 1) / IMAGEM_ALINHAMENTO) * IMAGEM_ALINHAMENTO;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Calcula o passo (em floats) das linhas de uma imagem, de forma que cada
+ * linha comece em um endereo alinhado.
+ *
+ * Parmetros: int largura: largura da imagem.
+ *
+ * Valor de Retorno: o passo. */
+
+int _passoImagem (int largura)
+{
+	return ((int) (_alinhaBytes (sizeof (float) * largura) / sizeof (float)));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Converte uma linha de floats para 8 bits, com o mesmo arredondamento e
+ * saturao da float2uchar. O lao no tem desvios nem chamadas, para que o
+ * compilador possa vetoriz-lo.
+ *
+ * Parmetros: float* in: linha de entrada.
+ *             int n: nmero de valores.
+ *             unsigned char* out: linha de sada.
+ *
+ * Valor de Retorno: NENHUM */
+
+void _linhaFloatParaU8 (const float* in, int n, unsigned char* out)
+{
+	int i;
+	for (i = 0; i < n; i++)
+	{
+		float val = 255.0f*in [i] + 0.5f;
+		val = (val < 255.0f)? val : 255.0f;
+		val = (val > 0.0f)? val : 0.0f;
+		out [i] = (unsigned char) val;
+	}
+}
+
+/*============================================================================*/
+/* FUNES INTERNAS (LEITURA)                                                 */
+/*============================================================================*/
+/** Traz um arquivo inteiro para a memria. Tenta primeiro mapear o arquivo
+ * (mmap), o que evita qualquer cpia; se no for possvel (por exemplo, se o
+ * arquivo no for um arquivo comum), l tudo com um nico fread.
+ *
+ * Parmetros: char* arquivo: caminho do arquivo a abrir.
+ *             ArquivoMemoria* arq: parmetro de sada. Deve ser liberado com
+ *               _fechaArquivoMemoria.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int _abreArquivoMemoria (char* arquivo, ArquivoMemoria* arq)
+{
+	struct stat info;
+	int fd = open (arquivo, O_RDONLY);
+	if (fd < 0)
+		return (0);
+
+	arq->dados = NULL;
+	arq->tamanho = 0;
+	arq->mapeado = 0;
+
+	if (fstat (fd, &info) == 0 && S_ISREG (info.st_mode) && info.st_size > 0)
+	{
+		void* memoria = mmap (NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (memoria != MAP_FAILED)
+		{
+			madvise (memoria, (size_t) info.st_size, MADV_SEQUENTIAL);
+			arq->dados = (unsigned char*) memoria;
+			arq->tamanho = (size_t) info.st_size;
+			arq->mapeado = 1;
+			close (fd);
+			return (1);
+		}
+	}
+
+	/* No deu para mapear: l em blocos grandes, crescendo o buffer. */
+	size_t capacidade = (fstat (fd, &info) == 0 && info.st_size > 0)? (size_t) info.st_size : 1 << 20;
+	ssize_t lidos;
+	arq->dados = (unsigned char*) malloc (capacidade);
+
+	while (arq->dados && (lidos = read (fd, arq->dados + arq->tamanho, capacidade - arq->tamanho)) > 0)
+	{
+		arq->tamanho += (size_t) lidos;
+		if (arq->tamanho == capacidade)
+		{
+			unsigned char* maior = (unsigned char*) realloc (arq->dados, capacidade*2);
+			if (!maior)
+				break;
+			arq->dados = maior;
+			capacidade *= 2;
+		}
+	}
+
+	close (fd);
+	if (!arq->dados || arq->tamanho == 0)
+	{
+		free (arq->dados);
+		return (0);
+	}
+	return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Libera um arquivo trazido para a memria por _abreArquivoMemoria.
+ *
+ * Parmetros: ArquivoMemoria* arq: o arquivo.
+ *
+ * Valor de Retorno: NENHUM */
+
+void _fechaArquivoMemoria (ArquivoMemoria* arq)
+{
+	if (arq->mapeado)
+		munmap (arq->dados, arq->tamanho);
+	else
+		free (arq->dados);
+	arq->dados = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Abre um arquivo BMP e l os cabealhos.
+ *
+ * Parmetros: char* arquivo: caminho do arquivo a abrir.
+ *             ArquivoMemoria* arq: parmetro de sada. O contedo do arquivo.
+ *               Se a funo retornar 1, deve ser liberado com
+ *               _fechaArquivoMemoria.
+ *             FormatoBMP* formato: parmetro de sada. Dimenses e formato
+ *               dos pixels.
+ *             unsigned long* data_offset: parmetro de sada. Deslocamento
+ *               dos dados a partir do incio do arquivo.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int _abreBMP (char* arquivo, ArquivoMemoria* arq, FormatoBMP* formato, unsigned long* data_offset)
+{
+	/* Abre o arquivo, trazendo todo o contedo para a memria. */
+	if (!_abreArquivoMemoria (arquivo, arq))
+		return (0);
+
+	if (!leHeaderBitmap (arq->dados, arq->tamanho, data_offset) ||
+	    !leHeaderDIB (arq->dados, arq->tamanho, formato))
+	{
+		_fechaArquivoMemoria (arq);
+		return (0);
+	}
+
+	/* Pronto, cabealhos lidos! Vamos agora conferir se os dados esto l. */
+	if (*data_offset >= arq->tamanho)
+	{
+		printf ("abreImagem: erro lendo dados do arquivo.\n");
+		_fechaArquivoMemoria (arq);
+		return (0);
+	}
+
+	return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Pega os 4 primeiros bytes do buffer e coloca em um unsigned long,
+ * considerando os bytes em ordem little endian.
+ *
+ * Parmetros: unsigned char* buffer: l 4 bytes daqui.
+ *
+ * Valor de Retorno: um unsigned long com os dados do buffer reorganizados. */
+
+unsigned long getLittleEndianULong (const unsigned char* buffer)
+{
+	return ((unsigned long) buffer [3] << 24) | (buffer [2] << 16) | (buffer [1] << 8) | buffer [0];
+}
+
+/*----------------------------------------------------------------------------*/
+/** Pega os 2 primeiros bytes do buffer e coloca em um unsigned short,
+ * considerando os bytes em ordem little endian.
+ *
+ * Parmetros: unsigned char* buffer: l 2 bytes daqui.
+ *
+ * Valor de Retorno: um unsigned short com os dados do buffer reorganizados. */
+
+unsigned short getLittleEndianUShort (const unsigned char* buffer)
+{
+	return (unsigned short) ((buffer [1] << 8) | buffer [0]);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L o header de 14 bytes do formato BMP.
+ *
+ * Parmetros: unsigned char* arquivo: contedo do arquivo.
+ *             size_t tamanho: tamanho do arquivo, em bytes.
+ *             unsigned long* offset: parmetro de sada,  o deslocamento dos
+ *               dados a partir do incio do arquivo.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int leHeaderBitmap (const unsigned char* arquivo, size_t tamanho, unsigned long* offset)
+{
+	/* O bloco tem exatamente 14 bytes. */
+	if (tamanho < 14)
+	{
+		printf ("leHeaderBitmap: erro lendo header.\n");
+		return (0);
+	}
+
+	/* Os 2 primeiros bytes precisam ser 'B' e 'M'. */
+	if (arquivo [0] != 'B' || arquivo [1] != 'M')
+	{
+		printf ("leHeaderBitmap: pode ler apenas formato BM.\n");
+		return (0);
+	}
+
+	/* Vou pular todo o resto e ir direto para o offset. */
+	*offset = getLittleEndianULong (&(arquivo [10]));
+	return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L o header DIB, que comea logo depois do header de 14 bytes. So aceitos
+ * arquivos sem compresso com 8 bpp (com paleta), 24 bpp ou 32 bpp (o quarto
+ * byte, alfa ou no usado,  ignorado; a compresso BI_BITFIELDS tambm 
+ * aceita se as mscaras forem as usuais), com as linhas de baixo para cima
+ * ou, se a altura for negativa, de cima para baixo.
+ *
+ * Parmetros: unsigned char* arquivo: contedo do arquivo.
+ *             size_t tamanho: tamanho do arquivo, em bytes.
+ *             FormatoBMP* formato: parmetro de sada. Dimenses e formato
+ *               dos pixels (e a paleta, se houver).
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int leHeaderDIB (const unsigned char* arquivo, size_t tamanho, FormatoBMP* formato)
+{
+	const unsigned char* dib = arquivo + 14;
+	unsigned long size; /* O tamanho do cabealho DIB. */
+	unsigned long compressao, n_cores;
+	long altura;
+
+	if (tamanho < 14+4)
+	{
+		printf ("leHeaderDIB: erro lendo header.\n");
+		return (0);
+	}
+
+	size = getLittleEndianULong (dib);
+
+	if (size == 12) /* Formato BITMAPCOREHEADER. */
+	{
+		printf ("leHeaderDIB: BITMAPCOREHEADER nao suportado (arquivo antigo!?)\n");
+		return (0);
+	}
+	else if (size >= 40) /* Outros formatos. */
+	{
+		if (tamanho < 14+40)
+		{
+			printf ("leHeaderDIB: erro lendo header.\n");
+			return (0);
+		}
+
+		/* Largura. */
+		formato->largura = (int) getLittleEndianULong (dib + 4);
+		if (formato->largura <= 0)
+		{
+			printf ("leHeaderDIB: largura invalida.\n");
+			return (0);
+		}
+
+		/* Altura. Se for negativa, as linhas esto de cima para baixo. */
+		altura = (int) getLittleEndianULong (dib + 8);
+		formato->de_cima_para_baixo = (altura < 0);
+		if (altura < 0)
+			altura = -altura;
+		if (altura <= 0 || altura > 0x7fffffffL)
+		{
+			printf ("leHeaderDIB: altura invalida.\n");
+			return (0);
+		}
+		formato->altura = (int) altura;
+
+		/* Color planes. Precisa ser 1. */
+		if (getLittleEndianUShort (dib + 12) != 1)
+		{
+			printf ("leHeaderDIB: erro lendo header.\n");
+			return (0);
+		}
+
+		/* Bpp. */
+		formato->bpp = getLittleEndianUShort (dib + 14);
+		if (formato->bpp != 8 && formato->bpp != 24 && formato->bpp != 32)
+		{
+			printf ("leHeaderDIB: suporta apenas arquivos com 8, 24 ou 32 bpp.\n");
+			return (0);
+		}
+		formato->bytes_por_linha = (((size_t) formato->largura * formato->bpp + 31) / 32) * 4;
+
+		/* Compresso. Vou aceitar s imagens sem compresso, ou imagens de
+		  32 bpp com as mscaras usuais (os canais nos bytes B, G, R). As
+		  mscaras vm logo depois dos 40 bytes, dentro ou fora do header. */
+		compressao = getLittleEndianULong (dib + 16);
+		if (compressao == 3 && formato->bpp == 32)
+		{
+			if (tamanho < 14+52 ||
+			    getLittleEndianULong (dib + 40) != 0x00ff0000 ||
+			    getLittleEndianULong (dib + 44) != 0x0000ff00 ||
+			    getLittleEndianULong (dib + 48) != 0x000000ff)
+			{
+				printf ("leHeaderDIB: suporta apenas mascaras BGR de 8 bits.\n");
+				return (0);
+			}
+		}
+		else if (compressao != 0)
+		{
+			printf ("leHeaderDIB: suporta apenas arquivos sem compressao.\n");
+			return (0);
+		}
+
+		/* Paleta: s  usada com 8 bpp (com 24 ou 32,  s uma sugesto de
+		  cores, e pode ser ignorada). Fica logo depois do header DIB. */
+		memset (formato->paleta, 0, sizeof (formato->paleta));
+		if (formato->bpp == 8)
+		{
+			n_cores = getLittleEndianULong (dib + 32);
+			if (n_cores == 0)
+				n_cores = 256;
+
+			if (n_cores > 256 || 14 + size + 4*n_cores > tamanho)
+			{
+				printf ("leHeaderDIB: paleta invalida.\n");
+				return (0);
+			}
+			memcpy (formato->paleta, dib + size, 4*n_cores);
+		}
+
+		return (1);
+	}
+
+	return (0);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Confere se todas as linhas de um BMP cabem nos dados. A ltima linha pode
+ * vir sem o preenchimento.
+ *
+ * Parmetros: FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             size_t tamanho: nmero de bytes disponveis a partir do offset.
+ *
+ * Valor de Retorno: 1 se as linhas cabem, 0 do contrrio. */
+
+int _dadosCompletosBMP (const FormatoBMP* formato, size_t tamanho)
+{
+	return (formato->bytes_por_linha * (formato->altura-1) + ((size_t) formato->largura * formato->bpp + 7) / 8 <= tamanho);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Encontra uma linha da imagem nos dados do arquivo.
+ *
+ * Parmetros: unsigned char* dados: os dados do arquivo (a partir do offset).
+ *             FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             int y: a linha, contando de cima para baixo.
+ *
+ * Valor de Retorno: ponteiro para o incio da linha. */
+
+const unsigned char* _linhaBMP (const unsigned char* dados, const FormatoBMP* formato, int y)
+{
+	/* Normalmente as linhas esto de baixo para cima. */
+	if (!formato->de_cima_para_baixo)
+		y = formato->altura-1-y;
+	return (dados + formato->bytes_por_linha * y);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Monta as tabelas da decodificao. As de cada canal tm o valor de um byte
+ * j na faixa [0,1] e multiplicado pelo peso do canal, de forma que o
+ * resultado  exatamente o mesmo da converso feita sobre os 3 planos float.
+ * Com 8 bpp, o cinza de cada cor da paleta  calculado aqui, com as mesmas
+ * contas, e a converso vira uma consulta por pixel.
+ *
+ * Parmetros: FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             TabelasBMP* tab: as tabelas, a preencher.
+ *
+ * Valor de Retorno: NENHUM */
+
+void _tabelasBMP (const FormatoBMP* formato, TabelasBMP* tab)
+{
+	int i;
+	for (i = 0; i < 256; i++)
+	{
+		float val = (float) i / 255.0f;
+		tab->valor [i] = val;
+		tab->r [i] = val * 0.299f;
+		tab->g [i] = val * 0.587f;
+		tab->b [i] = val * 0.114f;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		const unsigned char* cor = formato->paleta + 4*i;
+		tab->paleta_cinza [i] = tab->r [cor [2]] + tab->g [cor [1]] + tab->b [cor [0]];
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/** Converte uma linha do arquivo para escala de cinza.
+ *
+ * Parmetros: unsigned char* linha: a linha do arquivo.
+ *             FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             TabelasBMP* tab: tabelas de _tabelasBMP.
+ *             float* out: linha de sada, com largura posies.
+ *
+ * Valor de Retorno: NENHUM */
+
+void _linhaBMPParaCinza (const unsigned char* linha, const FormatoBMP* formato, const TabelasBMP* tab, float* out)
+{
+	int j, largura = formato->largura;
+
+	if (formato->bpp == 8)
+		for (j = 0; j < largura; j++)
+			out [j] = tab->paleta_cinza [linha [j]];
+	else if (formato->bpp == 24)
+		for (j = 0; j < largura; j++)
+			out [j] = tab->r [linha [3*j+2]] + tab->g [linha [3*j+1]] + tab->b [linha [3*j]];
+	else
+		for (j = 0; j < largura; j++)
+			out [j] = tab->r [linha [4*j+2]] + tab->g [linha [4*j+1]] + tab->b [linha [4*j]];
+}
+
+/*----------------------------------------------------------------------------*/
+/** Converte uma linha do arquivo para 3 planos float, na faixa [0,1].
+ *
+ * Parmetros: unsigned char* linha: a linha do arquivo.
+ *             FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             TabelasBMP* tab: tabelas de _tabelasBMP.
+ *             float* r, g, b: linhas de sada, com largura posies.
+ *
+ * Valor de Retorno: NENHUM */
+
+void _linhaBMPParaRGB (const unsigned char* linha, const FormatoBMP* formato, const TabelasBMP* tab, float* r, float* g, float* b)
+{
+	int j, largura = formato->largura;
+	int passo = formato->bpp / 8; /* Bytes por pixel, na ordem BGR(A). */
+
+	for (j = 0; j < largura; j++)
+	{
+		/* Com 8 bpp, o pixel  o ndice de uma cor BGRA na paleta. */
+		const unsigned char* cor = (passo == 1)? formato->paleta + 4*linha [j] : linha + passo*j;
+		b [j] = tab->valor [cor [0]];
+		g [j] = tab->valor [cor [1]];
+		r [j] = tab->valor [cor [2]];
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/** L os dados de um arquivo. Cada linha  decodificada de uma vez, direto
+ * para os planos da imagem, usando tabelas com os 256 valores possveis. Se
+ * a imagem tiver 1 canal, cada linha  convertida para escala de cinza
+ * durante a leitura, sem passar pelos 3 planos (com 8 bpp,  uma consulta 
+ * paleta por pixel).
+ *
+ * Parmetros: unsigned char* dados: os dados do arquivo (a partir do offset).
+ *             size_t tamanho: nmero de bytes disponveis em dados.
+ *             FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             Imagem* img: imagem a preencher, com 1 ou 3 canais.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int leDados (const unsigned char* dados, size_t tamanho, const FormatoBMP* formato, Imagem* img)
+{
+	int i;
+	TabelasBMP tab;
+
+	if (!_dadosCompletosBMP (formato, tamanho))
+		return (0);
+
+	_tabelasBMP (formato, &tab);
+
+	for (i = 0; i < img->altura; i++)
+	{
+		const unsigned char* linha = _linhaBMP (dados, formato, i);
+
+		if (img->n_canais == 1)
+			_linhaBMPParaCinza (linha, formato, &tab, img->dados [0][i]);
+		else
+			_linhaBMPParaRGB (linha, formato, &tab, img->dados [0][i], img->dados [1][i], img->dados [2][i]);
+	}
+
+	return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L os dados de um arquivo para uma imagem de 8 bits, em escala de cinza.
+ * Cada linha  convertida para cinza em float (como na leDados) e arredondada
+ * para 8 bits, ento o resultado  o mesmo de abrir a imagem em float e
+ * converter com imagemParaU8. Com 8 bpp, a paleta  convertida uma vez, e
+ * cada pixel vira uma consulta.
+ *
+ * Parmetros: unsigned char* dados: os dados do arquivo (a partir do offset).
+ *             size_t tamanho: nmero de bytes disponveis em dados.
+ *             FormatoBMP* formato: o formato, lido com leHeaderDIB.
+ *             ImagemU8* img: imagem a preencher.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int leDadosU8 (const unsigned char* dados, size_t tamanho, const FormatoBMP* formato, ImagemU8* img)
+{
+	int i, j;
+	TabelasBMP tab;
+	unsigned char paleta_u8 [256];
+	float* cinza;
+
+	if (!_dadosCompletosBMP (formato, tamanho))
+		return (0);
+
+	_tabelasBMP (formato, &tab);
+
+	if (formato->bpp == 8)
+	{
+		_linhaFloatParaU8 (tab.paleta_cinza, 256, paleta_u8);
+		for (i = 0; i < img->altura; i++)
+		{
+			const unsigned char* linha = _linhaBMP (dados, formato, i);
+			for (j = 0; j < img->largura; j++)
+				img->dados [i][j] = paleta_u8 [linha [j]];
+		}
+		return (1);
+	}
+
+	cinza = (float*) poolAloca (sizeof (float) * img->largura);
+
+	for (i = 0; i < img->altura; i++)
+	{
+		_linhaBMPParaCinza (_linhaBMP (dados, formato, i), formato, &tab, cinza);
+		_linhaFloatParaU8 (cinza, img->largura, img->dados [i]);
+	}
+
+	poolLibera (cinza);
+	return (1);
+}
+
+/*============================================================================*/
+/* FUNES INTERNAS (ESCRITA)                                                 */
+/*============================================================================*/
+/** Coloca um unsigned long nos 4 primeiros bytes do buffer, em ordem little
+ * endian.
+ *
+ * Parmetros: unsigned long val: valor a escrever.
+ *             unsigned char* buffer: coloca o valor aqui.
+ *
+ * Valor de Retorno: NENHUM */
+
+void putLittleEndianULong (unsigned long val, unsigned char* buffer)
 {
 	buffer [0] = (unsigned char) val;
 	buffer [1] = (unsigned char) (val >> 8);
+	buffer [2] = (unsigned char) (val >> 16);
+	buffer [3] = (unsigned char) (val >> 24);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Coloca um unsigned short nos 2 primeiros bytes do buffer, em ordem little
+ * endian.
+ *
+ * Parmetros: unsigned short val: valor a escrever.
+ *             unsigned char* buffer: coloca o valor aqui.
+ *
+ * Valor de Retorno: NENHUM */
+
+void putLittleEndianUShort (unsigned short val, unsigned char* buffer)
+{
+	buffer [0] = (unsigned char) val;
+	buffer [1] = (unsigned char) (val >> 8);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Calcula o nmero de bytes de cada linha de um BMP. Cada linha precisa ter
+ * um mltiplo de 4 bytes.
+ *
+ * Parmetros: int largura: largura da imagem.
+ *             int bpp: bits por pixel.
+ *
+ * Valor de Retorno: o nmero de bytes por linha, incluindo o preenchimento. */
+
+unsigned long _bytesPorLinhaBMP (int largura, int bpp)
+{
+	return (((unsigned long) largura * bpp + 31) / 32) * 4;
 }
 
 /*----------------------------------------------------------------------------*/
 /** Escreve o header Bitmap.
  *
  * Parmetros: FILE* file: arquivo a ser escrito. Supomos que j est aberto.
- *             Imagem* img: imagem a ser salva.
+ *             int largura: largura da imagem a ser salva.
+ *             int altura: altura da imagem a ser salva.
+ *             int bpp: bits por pixel (1, 8 ou 24). Com 1 ou 8 bpp, o
+ *               arquivo tem uma paleta logo depois dos cabealhos.
  *
  * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
 
-int salvaHeaderBitmap (FILE* stream, Imagem* img)
+int salvaHeaderBitmap (FILE* stream, int largura, int altura, int bpp)
 {
 	unsigned char data [14]; /* O bloco tem exatamente 14 bytes. */
 	int pos = 0;
 	unsigned long bytes_por_linha;
+	unsigned long bytes_paleta = (bpp <= 8)? 4UL << bpp : 0;
 
 	data [pos++] = 'B';
 	data [pos++] = 'M';
 
-	/* Tamanho do arquivo. Definimos como sendo 14+40 (dos cabealhos) + o espao dos dados. */
-	bytes_por_linha = (unsigned long) ceil (img->largura*3.0/4.0)*4;
-	putLittleEndianULong (14+40+img->altura*bytes_por_linha, &(data [pos]));
+	/* Tamanho do arquivo. Definimos como sendo 14+40 (dos cabealhos) + a paleta + o espao dos dados. */
+	bytes_por_linha = _bytesPorLinhaBMP (largura, bpp);
+	putLittleEndianULong (14+40+bytes_paleta+altura*bytes_por_linha, &(data [pos]));
 	pos+=4;
 
 	/* Reservado. */
 	putLittleEndianULong (0, &(data [pos]));
 	pos+=4;
 
-	/* Offset. Definimos como 14+40 (o tamanho dos cabealhos). */
-	putLittleEndianULong (14+40, &(data [pos]));
+	/* Offset. Definimos como 14+40 (o tamanho dos cabealhos) + a paleta. */
+	putLittleEndianULong (14+40+bytes_paleta, &(data [pos]));
 
 	if (fwrite ((void*) data, 1, 14, stream) != 14)
 	{
@@ -618,11 +1489,13 @@ int salvaHeaderBitmap (FILE* stream, Imagem* img)
 /** Escreve o header DIB.
  *
  * Parmetros: FILE* file: arquivo a ser escrito. Supomos que j est aberto.
- *             Imagem* img: imagem a ser salva.
+ *             int largura: largura da imagem a ser salva.
+ *             int altura: altura da imagem a ser salva.
+ *             int bpp: bits por pixel (1, 8 ou 24).
  *
  * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
 
-int salvaHeaderDIB (FILE* stream, Imagem* img)
+int salvaHeaderDIB (FILE* stream, int largura, int altura, int bpp)
 {
 	unsigned char data [40]; /* O bloco tem exatamente 40 bytes. */
 	int pos = 0;
@@ -633,11 +1506,11 @@ int salvaHeaderDIB (FILE* stream, Imagem* img)
 	pos += 4;
 
 	/* Largura. */
-	putLittleEndianULong (img->largura, &(data [pos]));
+	putLittleEndianULong (largura, &(data [pos]));
 	pos += 4;
 
 	/* Altura. */
-	putLittleEndianULong (img->altura, &(data [pos]));
+	putLittleEndianULong (altura, &(data [pos]));
 	pos += 4;
 
 	/* Color planes. */
@@ -645,7 +1518,7 @@ int salvaHeaderDIB (FILE* stream, Imagem* img)
 	pos += 2;
 
 	/* bpp. */
-	putLittleEndianUShort (24, &(data [pos]));
+	putLittleEndianUShort (bpp, &(data [pos]));
 	pos += 2;
 
 	/* Compresso. */
@@ -653,8 +1526,8 @@ int salvaHeaderDIB (FILE* stream, Imagem* img)
 	pos += 4;
 
 	/* Tamanho dos dados. */
-	bytes_por_linha = (unsigned long) ceil (img->largura*3.0/4.0)*4;
-	putLittleEndianULong (img->altura*bytes_por_linha, &(data [pos]));
+	bytes_por_linha = _bytesPorLinhaBMP (largura, bpp);
+	putLittleEndianULong (altura*bytes_por_linha, &(data [pos]));
 	pos += 4;
 
 	/* Resoluo horizontal e vertical (simplesmente copiei este valor de algum arquivo!). */
@@ -663,8 +1536,8 @@ int salvaHeaderDIB (FILE* stream, Imagem* img)
 	putLittleEndianULong (0xF61, &(data [pos]));
 	pos += 4;
 
-	/* Cores. */
-	putLittleEndianULong (0, &(data [pos]));
+	/* Cores: nmero de entradas na paleta, todas "importantes". */
+	putLittleEndianULong ((bpp <= 8)? 1UL << bpp : 0, &(data [pos]));
 	pos += 4;
 	putLittleEndianULong (0, &(data [pos]));
 	pos += 4;
@@ -679,7 +1552,45 @@ int salvaHeaderDIB (FILE* stream, Imagem* img)
 }
 
 /*----------------------------------------------------------------------------*/
-/** Escreve o bloco de dados.
+/** Escreve a paleta de tons de cinza, para arquivos com 1 ou 8 bpp: com 8 bpp,
+ * o ndice i  o cinza i; com 1 bpp, 0  preto e 1  branco. Com 24 bpp no
+ * h paleta, e nada  escrito.
+ *
+ * Parmetros: FILE* file: arquivo a ser escrito. Supomos que j est aberto.
+ *             int bpp: bits por pixel.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int salvaPaleta (FILE* stream, int bpp)
+{
+	unsigned char paleta [256*4];
+	int i, n_cores;
+
+	if (bpp > 8)
+		return (1);
+
+	n_cores = 1 << bpp;
+	for (i = 0; i < n_cores; i++)
+	{
+		unsigned char cinza = (unsigned char) (i * 255 / (n_cores-1));
+		paleta [i*4] = cinza; /* B */
+		paleta [i*4+1] = cinza; /* G */
+		paleta [i*4+2] = cinza; /* R */
+		paleta [i*4+3] = 0;
+	}
+
+	if (fwrite ((void*) paleta, 4, n_cores, stream) != (size_t) n_cores)
+	{
+		printf ("salvaPaleta: erro escrevendo paleta.\n");
+		return (0);
+	}
+
+	return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Escreve o bloco de dados. Imagens de 3 canais so salvas com 24 bpp (BGR);
+ * imagens de 1 canal com 8 bpp (ndices da paleta de cinzas).
  *
  * Parmetros: FILE* file: arquivo a ser escrito. Supomos que j est aberto.
  *             Imagem* img: imagem a ser salva.
@@ -688,49 +1599,87 @@ int salvaHeaderDIB (FILE* stream, Imagem* img)
 
 int salvaDados (FILE* stream, Imagem* img)
 {
-    unsigned char dado;
-	long long i, j, k;
-	unsigned long largura_linha, line_padding;
+	long long i, j;
+	unsigned long largura_linha;
 	unsigned char* linha;
-	unsigned long pos_linha;
+	unsigned char* planos = NULL;
 
-	/* Calcula quantos bytes preciso pular no fim de cada linha.
-	  Aqui, cada linha precisa ter um mltiplo de 4. */
-	largura_linha = (unsigned long) ceil (img->largura*3.0/4.0)*4;
-	line_padding = largura_linha - (img->largura*3);
-	linha = (unsigned char*) malloc (sizeof (unsigned char) * largura_linha);
+	largura_linha = _bytesPorLinhaBMP (img->largura, (img->n_canais == 1)? 8 : 24);
+	linha = (unsigned char*) poolAloca (sizeof (unsigned char) * largura_linha);
+	memset (linha, 0, largura_linha); /* O padding fica zerado. */
+	if (img->n_canais == 3)
+		planos = (unsigned char*) poolAloca (sizeof (unsigned char) * img->largura * 3);
 
     for (i = img->altura-1; i >= 0; i--)
 	{
-		pos_linha = 0;
-		for (j = 0; j < img->largura; j++)
+	    /* Imagem de 1 canal: converte direto para a linha do arquivo. */
+		if (img->n_canais == 1)
+			_linhaFloatParaU8 (img->dados [0][i], img->largura, linha);
+		else
 		{
-		    /* Imagem de 3 canais: converte para uchar na ordem BGR. */
-		    if (img->n_canais == 3)
-		    {
-		        for (k = 0; k < 3; k++)
-		            linha [pos_linha++] = float2uchar (img->dados [2-k][i][j]);
-		    }
-		    else /* Imagem de 1 canal: converte para uchar e replica 3 vezes. */
-		    {
-		        dado = float2uchar (img->dados [0][i][j]);
-                for (k = 0; k < 3; k++)
-                    linha [pos_linha++] = dado;
-            }
+			/* Imagem de 3 canais: converte cada plano e intercala na ordem BGR. */
+			unsigned char* r = planos;
+			unsigned char* g = planos + img->largura;
+			unsigned char* b = planos + img->largura*2;
+			_linhaFloatParaU8 (img->dados [0][i], img->largura, r);
+			_linhaFloatParaU8 (img->dados [1][i], img->largura, g);
+			_linhaFloatParaU8 (img->dados [2][i], img->largura, b);
+			for (j = 0; j < img->largura; j++)
+			{
+				linha [3*j] = b [j];
+				linha [3*j+1] = g [j];
+				linha [3*j+2] = r [j];
+			}
 		}
 
-		for (j = 0; j < line_padding; j++)
-			linha [pos_linha++] = 0;
-
 		if (fwrite ((void*) linha, 1, largura_linha, stream) != largura_linha)
 		{
 			printf ("salvaDados: errro escrevendo dados da imagem.\n");
-			free (linha);
+			poolLibera (linha);
+			if (planos)
+				poolLibera (planos);
+			return (0);
+		}
+	}
+
+	poolLibera (linha);
+	if (planos)
+		poolLibera (planos);
+	return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Escreve o bloco de dados de uma imagem de 8 bits, com 8 bpp (ndices da
+ * paleta de cinzas).
+ *
+ * Parmetros: FILE* file: arquivo a ser escrito. Supomos que j est aberto.
+ *             ImagemU8* img: imagem a ser salva.
+ *
+ * Valor de Retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int salvaDadosU8 (FILE* stream, ImagemU8* img)
+{
+	long long i;
+	unsigned long largura_linha;
+	unsigned char* linha;
+
+	largura_linha = _bytesPorLinhaBMP (img->largura, 8);
+	linha = (unsigned char*) poolAloca (sizeof (unsigned char) * largura_linha);
+	memset (linha, 0, largura_linha); /* O padding fica zerado. */
+
+    for (i = img->altura-1; i >= 0; i--)
+	{
+		memcpy (linha, img->dados [i], img->largura);
+
+		if (fwrite ((void*) linha, 1, largura_linha, stream) != largura_linha)
+		{
+			printf ("salvaDadosU8: erro escrevendo dados da imagem.\n");
+			poolLibera (linha);
 			return (0);
 		}
 	}
 
-	free (linha);
+	poolLibera (linha);
 	return (1);
 }
 
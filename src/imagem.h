@@ -16,18 +16,52 @@
 
 /*============================================================================*/
 
+#include <stdio.h>
+#include <stddef.h>
+#include "geometria.h"
+
+/*============================================================================*/
+
 typedef struct
 {
 	int largura;
 	int altura;
 	int n_canais;
-	float*** dados; /* Uma matriz de dados por canal. Acessar com 3 ndices: [canal][y][x]. */
+	int passo; /* Distncia (em floats) entre o incio de duas linhas consecutivas. */
+	float* bloco; /* Todos os pixels, em um nico bloco alinhado: o pixel (x,y) do canal c fica em bloco [(c*altura+y)*passo+x]. */
+	float*** dados; /* Uma matriz de dados por canal. Acessar com 3 ndices: [canal][y][x]. Os ponteiros apontam para dentro do bloco. */
+	int visao; /* Se != 0, a imagem  uma viso de uma regio de outra imagem (ver criaVisao): os pixels pertencem  outra imagem, e as linhas no so contguas. */
 } Imagem;
 
+/* Imagem em escala de cinza com 8 bits por pixel, valores inteiros em [0,255].
+ * Usa 1/4 da memria de uma Imagem de 1 canal. O float continua disponvel
+ * para as etapas que precisarem, com converses explcitas entre os tipos. */
+typedef struct
+{
+	int largura;
+	int altura;
+	int passo; /* Distncia (em bytes) entre o incio de duas linhas consecutivas. */
+	unsigned char* bloco; /* Todos os pixels, em um nico bloco alinhado: o pixel (x,y) fica em bloco [y*passo+x]. */
+	unsigned char** dados; /* Ponteiros para as linhas. Acessar com 2 ndices: [y][x]. */
+	int visao; /* Se != 0, a imagem  uma viso de uma regio de outra imagem (ver criaVisaoU8). */
+} ImagemU8;
+
+#define IMAGEM_ALINHAMENTO 64 /* Alinhamento (em bytes) do bloco e do incio de cada linha. */
+size_t _alinhaBytes (size_t bytes); /* Arredonda para um mltiplo do alinhamento. Para mdulos que usam o mesmo esquema de alocao. */
+void _linhaFloatParaU8 (const float* in, int n, unsigned char* out); /* Mesmo que float2uchar, para uma linha inteira. */
+
+/* Escrita dos cabealhos e da paleta de um BMP com o bpp dado (1, 8 ou 24).
+ * Para mdulos que salvam seus prprios tipos de imagem. */
+int salvaHeaderBitmap (FILE* stream, int largura, int altura, int bpp);
+int salvaHeaderDIB (FILE* stream, int largura, int altura, int bpp);
+int salvaPaleta (FILE* stream, int bpp);
+
 /*----------------------------------------------------------------------------*/
-/* Por simplicidade e compatibilidade, ns sempre consideramos a leitura e
- * escrita de imagens com 3 canais, 24bpp. Todas as converses para escala de
- * cinza e float so feitas internamente. */
+/* Na leitura, so aceitos arquivos BMP sem compresso com 8bpp (com paleta),
+ * 24bpp ou 32bpp, com as linhas de baixo para cima (o usual) ou de cima para
+ * baixo. Na escrita, imagens de 3 canais usam 24bpp, e imagens de 1 canal
+ * usam 8bpp com uma paleta de tons de cinza. Todas as converses para escala
+ * de cinza e float so feitas internamente. */
 
 Imagem* criaImagem (int largura, int altura, int n_canais);
 void destroiImagem (Imagem* img);
@@ -35,8 +69,35 @@ Imagem* abreImagem (char* arquivo, int n_canais);
 int salvaImagem (Imagem* img, char* arquivo);
 Imagem* clonaImagem (Imagem* img);
 void copiaConteudo (Imagem* in, Imagem* out);
+void trocaImagens (Imagem** a, Imagem** b);
 void redimensionaNN (Imagem* in, Imagem* out);
 void redimensionaBilinear (Imagem* in, Imagem* out);
 
+/* Vises: imagens que apontam para uma regio de outra imagem, sem copiar os
+ * pixels. Podem ser usadas em qualquer funo que receba uma imagem; alterar
+ * a viso altera a imagem original. Coordenadas calculadas sobre uma viso
+ * (como os retngulos dos componentes conexos) so relativas  regio. A
+ * viso deve ser destruda (com destroiImagem/destroiImagemU8) antes da
+ * imagem original. */
+Imagem* criaVisao (Imagem* img, Retangulo roi);
+ImagemU8* criaVisaoU8 (ImagemU8* img, Retangulo roi);
+
+ImagemU8* criaImagemU8 (int largura, int altura);
+void destroiImagemU8 (ImagemU8* img);
+ImagemU8* abreImagemU8 (char* arquivo);
+int salvaImagemU8 (ImagemU8* img, char* arquivo);
+ImagemU8* clonaImagemU8 (ImagemU8* img);
+void copiaConteudoU8 (ImagemU8* in, ImagemU8* out);
+void trocaImagensU8 (ImagemU8** a, ImagemU8** b);
+void imagemParaU8 (Imagem* in, int canal, ImagemU8* out);
+void U8ParaImagem (ImagemU8* in, Imagem* out);
+
+/* Leitura de um BMP uma linha por vez, em escala de cinza, sem criar a imagem
+ * inteira. Para imagens grandes demais para a memria (ver fluxo.h). */
+typedef struct _LeitorBMP LeitorBMP;
+LeitorBMP* abreLeitorBMP (char* arquivo, int* largura, int* altura);
+void leLinhaBMP (LeitorBMP* leitor, int y, float* linha);
+void fechaLeitorBMP (LeitorBMP* leitor);
+
 /*============================================================================*/
 #endif /* __IMAGEM_H */
@@ -0,0 +1,232 @@
+/*============================================================================*/
+/* LOTES DE IMAGENS                                                           */
+/*============================================================================*/
+/** Enumerao das imagens de um processamento em lote. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include "lote.h"
+
+/*============================================================================*/
+
+#define LOTE_LISTA 0 /* Os caminhos j esto todos em lote->caminhos. */
+#define LOTE_ARQUIVO 1 /* Os caminhos so lidos de lote->arquivo, um por vez. */
+
+struct _Lote
+{
+    int tipo;
+    char** caminhos; /* LOTE_LISTA: os caminhos, em ordem. */
+    size_t n_caminhos;
+    size_t proximo;
+    glob_t glob; /* Se o lote veio de um glob, os caminhos so os dele. */
+    int usa_glob;
+    FILE* arquivo; /* LOTE_ARQUIVO: a lista de caminhos. */
+};
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Funo de comparao para ordenar os caminhos de um diretrio. */
+
+int _loteComparaCaminhos (const void* a, const void* b)
+{
+    return (strcmp (*(char* const*) a, *(char* const*) b));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Lista os arquivos .bmp de um diretrio, em ordem alfabtica.
+ *
+ * Parmetros: Lote* lote: lote a preencher.
+ *             const char* diretorio: o diretrio.
+ *
+ * Valor de retorno: 1 se no ocorreram erros, 0 do contrrio. */
+
+int _loteDiretorio (Lote* lote, const char* diretorio)
+{
+    DIR* dir = opendir (diretorio);
+    struct dirent* entrada;
+    size_t capacidade = 0, n;
+
+    if (!dir)
+        return (0);
+
+    while ((entrada = readdir (dir)))
+    {
+        n = strlen (entrada->d_name);
+        if (n < 4 || strcasecmp (entrada->d_name + n - 4, ".bmp") != 0)
+            continue;
+
+        if (lote->n_caminhos == capacidade)
+        {
+            capacidade = (capacidade)? capacidade*2 : 64;
+            lote->caminhos = (char**) realloc (lote->caminhos, sizeof (char*) * capacidade);
+        }
+
+        lote->caminhos [lote->n_caminhos] = (char*) malloc (strlen (diretorio) + n + 2);
+        sprintf (lote->caminhos [lote->n_caminhos], "%s/%s", diretorio, entrada->d_name);
+        lote->n_caminhos++;
+    }
+
+    closedir (dir);
+    qsort (lote->caminhos, lote->n_caminhos, sizeof (char*), _loteComparaCaminhos);
+    return (1);
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Abre uma fonte de imagens. O tipo da fonte  deduzido do texto (ver o
+ * cabealho).
+ *
+ * Parmetros: const char* fonte: diretrio, padro glob, arquivo .bmp,
+ *               arquivo com uma lista de caminhos, ou "-".
+ *
+ * Valor de retorno: o lote, ou NULL se a fonte no puder ser aberta. Libere
+ *                   com loteFecha. */
+
+Lote* loteAbre (const char* fonte)
+{
+    struct stat info;
+    size_t n = strlen (fonte);
+    Lote* lote = (Lote*) calloc (1, sizeof (Lote));
+
+    if (strcmp (fonte, "-") == 0)
+    {
+        lote->tipo = LOTE_ARQUIVO;
+        lote->arquivo = stdin;
+        return (lote);
+    }
+
+    lote->tipo = LOTE_LISTA;
+
+    if (stat (fonte, &info) == 0 && S_ISDIR (info.st_mode))
+    {
+        if (_loteDiretorio (lote, fonte))
+            return (lote);
+    }
+    else if (strpbrk (fonte, "*?["))
+    {
+        int erro = glob (fonte, 0, NULL, &lote->glob);
+        if (erro == 0 || erro == GLOB_NOMATCH)
+        {
+            lote->usa_glob = 1;
+            lote->caminhos = lote->glob.gl_pathv;
+            lote->n_caminhos = lote->glob.gl_pathc;
+            return (lote);
+        }
+    }
+    else if (n >= 4 && strcasecmp (fonte + n - 4, ".bmp") == 0)
+    {
+        lote->caminhos = (char**) malloc (sizeof (char*));
+        lote->caminhos [0] = (char*) malloc (n + 1);
+        strcpy (lote->caminhos [0], fonte);
+        lote->n_caminhos = 1;
+        return (lote);
+    }
+    else if ((lote->arquivo = fopen (fonte, "r")))
+    {
+        lote->tipo = LOTE_ARQUIVO;
+        return (lote);
+    }
+
+    printf ("ERRO: loteAbre: nao foi possivel abrir %s.\n", fonte);
+    loteFecha (lote);
+    return (NULL);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Cria um lote a partir de uma lista de caminhos j conhecida.
+ *
+ * Parmetros: char** caminhos: os caminhos, em ordem. So copiados.
+ *             int n: nmero de caminhos.
+ *
+ * Valor de retorno: o lote. Libere com loteFecha. */
+
+Lote* loteCriaLista (char** caminhos, int n)
+{
+    int i;
+    Lote* lote = (Lote*) calloc (1, sizeof (Lote));
+
+    lote->tipo = LOTE_LISTA;
+    lote->caminhos = (char**) malloc (sizeof (char*) * ((n > 0)? n : 1));
+    for (i = 0; i < n; i++)
+    {
+        lote->caminhos [i] = (char*) malloc (strlen (caminhos [i]) + 1);
+        strcpy (lote->caminhos [i], caminhos [i]);
+    }
+    lote->n_caminhos = (n > 0)? n : 0;
+
+    return (lote);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Pega o prximo caminho do lote.
+ *
+ * Parmetros: Lote* lote: o lote.
+ *             char* caminho: sada. Recebe o caminho.
+ *             size_t tamanho: tamanho do buffer de sada. Caminhos maiores
+ *               so truncados.
+ *
+ * Valor de retorno: 1 se havia um prximo caminho, 0 se o lote acabou. */
+
+int loteProximo (Lote* lote, char* caminho, size_t tamanho)
+{
+    if (lote->tipo == LOTE_LISTA)
+    {
+        if (lote->proximo >= lote->n_caminhos)
+            return (0);
+
+        strncpy (caminho, lote->caminhos [lote->proximo++], tamanho-1);
+        caminho [tamanho-1] = 0;
+        return (1);
+    }
+
+    while (fgets (caminho, (int) tamanho, lote->arquivo))
+    {
+        size_t n = strlen (caminho);
+        while (n > 0 && (caminho [n-1] == '\n' || caminho [n-1] == '\r' || caminho [n-1] == ' ' || caminho [n-1] == '\t'))
+            caminho [--n] = 0;
+
+        if (n > 0 && caminho [0] != '#')
+            return (1);
+    }
+
+    return (0);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Fecha um lote.
+ *
+ * Parmetros: Lote* lote: o lote. Pode ser NULL.
+ *
+ * Valor de retorno: nenhum. */
+
+void loteFecha (Lote* lote)
+{
+    size_t i;
+
+    if (!lote)
+        return;
+
+    if (lote->usa_glob)
+        globfree (&lote->glob);
+    else if (lote->caminhos)
+    {
+        for (i = 0; i < lote->n_caminhos; i++)
+            free (lote->caminhos [i]);
+        free (lote->caminhos);
+    }
+
+    if (lote->arquivo && lote->arquivo != stdin)
+        fclose (lote->arquivo);
+
+    free (lote);
+}
+
+/*============================================================================*/
@@ -0,0 +1,33 @@
+/*============================================================================*/
+/* LOTES DE IMAGENS                                                           */
+/*============================================================================*/
+/** Enumerao das imagens de um processamento em lote. Uma fonte pode ser:
+ *
+ * - um diretrio: todos os arquivos .bmp dentro dele, em ordem alfabtica;
+ * - um padro glob (com *, ? ou [), como "bandejas/2024-*.bmp";
+ * - um arquivo .bmp, que  a nica imagem da fonte;
+ * - qualquer outro arquivo (ou "-" para a entrada padro): uma lista com um
+ *   caminho por linha. Linhas vazias e linhas comeando com # so ignoradas.
+ *   A lista  lida aos poucos, ento pode ser arbitrariamente grande.
+ *
+ * Apenas os caminhos ficam na memria (e, para listas, s o caminho atual). */
+/*============================================================================*/
+
+#ifndef __LOTE_H
+#define __LOTE_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+
+/*============================================================================*/
+
+typedef struct _Lote Lote;
+
+Lote* loteAbre (const char* fonte);
+Lote* loteCriaLista (char** caminhos, int n);
+int loteProximo (Lote* lote, char* caminho, size_t tamanho);
+void loteFecha (Lote* lote);
+
+/*============================================================================*/
+#endif /* __LOTE_H */
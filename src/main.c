@@ -1,144 +1,1197 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <math.h>
 #include "pdi.h"
 
-#define KERNEL 3
+#define MAX_KERNEL 31
+#define MAX_CAMINHO 1024
+#define MAX_PARAMETROS 256
+#define PROFUNDIDADE 2
+#define LIMITE_CACHE 256 //Em MB.
+
+//Parametros do processamento, que podem ser mudados com -P (ou no pedido
+//"ajusta" do modo residente) para ajustar a contagem a outras imagens.
+typedef struct {
+    float sigma;        //Desvio padrao do filtro gaussiano.
+    int gaussiano;      //Como o filtro gaussiano e calculado (GAUSSIANO_*).
+    float descartados;  //Fracao dos extremos descartada nas normalizacoes.
+    int janela;         //Largura da janela da binarizacao adaptativa.
+    float limiarAdapt;  //Limiar da binarizacao adaptativa.
+    float limiar1;      //Limiar da mascara.
+    int dilata;         //Largura do kernel que dilata a mascara.
+    float limiar2;      //Limiar da imagem mascarada.
+    int abertura;       //Largura do kernel da abertura e da erosao final.
+} Parametros;
+
+//Nomes dos metodos do filtro gaussiano, na ordem das constantes GAUSSIANO_*.
+#define N_GAUSSIANO 3
+const char *nomesGaussiano[N_GAUSSIANO] = {"direto", "recursivo", "caixas"};
+
+//Saidas das etapas que podem ser guardadas para o ajuste dos parametros (ver
+//memo.h), na ordem do processamento. As etapas 1, 2, 5 e 6 saem em float, e
+//as outras em binario.
+#define N_MEMO 8
+const char *nomesMemo[N_MEMO] = {
+    "borrada", "normalizada", "binAdapt", "dilata",
+    "mascara", "normalizada2", "binarizada", "abertura"
+};
+
+//Tempos medidos para cada imagem (em milissegundos): a leitura, cada etapa
+//do processamento e a rotulagem. Com a leitura antecipada, o tempo de leitura
+//e so a espera pela imagem, que fica perto de zero quando o processamento e
+//mais lento que a leitura.
+#define N_TEMPOS 10
+const char *nomesTempos[N_TEMPOS] = {
+    "leitura", "borrada", "normalizada", "binAdapt", "dilata",
+    "mascara", "normalizada2", "binarizada", "abertura", "rotulagem"
+};
+
+//No processamento em fluxo, as etapas acontecem juntas, e o tempo e medido
+//para cada passada pela imagem.
+#define N_PASSADAS 3
+const char *nomesPassadas[N_PASSADAS] = {
+    "histograma1", "histograma2", "rotulagem"
+};
+
+//Resultado do processamento de uma imagem.
+typedef struct {
+    int graos;          //Estimativa do numero de graos.
+    int componentes;    //Componentes conexos encontrados.
+    int nPixels;        //Soma dos pixels de todos os componentes.
+    int menor;          //Pixels do menor componente.
+    int mediana;        //Mediana dos pixels dos componentes.
+    int maior;          //Pixels do maior componente.
+    double tempos[N_TEMPOS];
+    const char **nomes; //Nomes dos tempos (nomesTempos ou nomesPassadas).
+    int nTempos;
+    ComponenteConexo *tabela; //Os componentes, do menor para o maior. Liberar com free.
+    int cache;          //Se != 0, o resultado veio do cache.
+    const char *memo;   //Ultima etapa que veio da memorizacao, ou NULL.
+    const char *erro;   //Se != NULL, a imagem nao pode ser processada, e o motivo.
+} Resultado;
 
 //Novas funções
-void mascara(Imagem *original, Imagem *mascara, Imagem *saida);
+int processaImagem(Imagem *original, const char *prefixo, const ChaveCache *entrada,
+                    const Parametros *p, Resultado *r);
+int tamanhoValido(int largura, int altura, const Parametros *p);
+void chavesMemo(const ChaveCache *entrada, const Parametros *p, ChaveCache chaves[N_MEMO]);
+void memoriza(const ChaveCache *chaves, int etapa, Imagem *img, ImagemBin *bin);
+const ChaveCache *chaveEntrada(const char *caminho, ChaveCache *chave);
+int processaFluxo(char *arquivo, const Parametros *p, Resultado *r);
+Fluxo *fluxoMascarado(char *arquivo, int histograma[256], const Parametros *p);
+int proximaImagem(Lote *lote, Preleitura *pre, char *caminho, Imagem **original, Resultado **guardado);
+void *consultaCache(const char *caminho, void *dados);
+void guardaResultado(const char *caminho, const Parametros *p, Resultado *r);
+int leParametros(const char *texto, Parametros *p);
+void descreveParametros(const Parametros *p, char *saida, size_t tamanho);
+Imagem *kernelCircular(int largura, Coordenada *centro);
+void relatorioGaussiano(char *caminho, const char *sigmas);
+int processaQuadros(char *fonte, int largura, int altura);
+int processaAnel(char *nome);
+int trataPedido(const char *pedido, char *resposta, size_t tamanho, void *dados);
+Imagem *abreQuadroCompartilhado(const char *nome, int largura, int altura);
+void contaGraos(ComponenteConexo *componente, int qArroz, Resultado *r);
+void imprimeResultado(const char *arquivo, Resultado *r);
+void formataResultado(char *saida, size_t tamanho, const char *arquivo, Resultado *r);
+double agora();
+void mascara(Imagem *original, ImagemBin *mascara, Imagem *saida);
 int cmpfunc(const void * a, const void * b);
 
-int main() {
+//Parametros usados quando nenhum outro e pedido: os padroes, ou os de -P.
+Parametros parametros = {5, GAUSSIANO_DIRETO, 0.01f, 101, 0.15f, 0.5f, 3, 0.8f, 5};
 
-    //Localização das imagens a serem segmentadas.
+//Kernels circulares, criados quando cada largura e usada pela primeira vez e
+//depois compartilhados por todas as imagens (e threads).
+Imagem *kernels[MAX_KERNEL + 1];
+pthread_mutex_t mutexKernels = PTHREAD_MUTEX_INITIALIZER;
+//No modo residente, quantos pedidos podem ser processados ao mesmo tempo (um
+//por processador). Os outros esperam, e a memoria usada fica limitada.
+sem_t vagas;
+
+//Se != 0, os resultados sao procurados e guardados no cache (ver cache.h).
+int usaCache = 0;
+//Se != 0, as saidas das etapas sao guardadas, para que outra contagem da
+//mesma imagem com outros parametros refaca so as etapas que mudaram.
+int usaMemo = 0;
+
+int eCinza, eBorrada, eNormalizada1, eBinAdapt, eDilata, eMascara,
+    eNormalizada2, eBinarizada, eAbertura;
+
+int main(int argc, char *argv[]) {
+
+    //Imagens usadas quando nenhuma fonte e dada na linha de comando.
     char *imagens[5] = {
                         "../imagens/60.bmp" ,
-                        "../imagens/82.bmp" , 
-                        "../imagens/114.bmp", 
-                        "../imagens/150.bmp", 
-                        "../imagens/205.bmp" 
+                        "../imagens/82.bmp" ,
+                        "../imagens/114.bmp",
+                        "../imagens/150.bmp",
+                        "../imagens/205.bmp"
                        };
-    char name[40] = "";
-    Imagem *original, *entrada, *saida, *buffer;
-    Imagem *kernel = criaKernelCircular(KERNEL);
-    Coordenada coordenada = criaCoordenada(KERNEL/2, KERNEL/2);
-    Imagem *k = criaKernelCircular(5);
-    Coordenada c = criaCoordenada(2, 2);
-    ComponenteConexo *componente;
+    char *fontes[argc];
+    int nFontes = 0;
+    char *etapas = NULL;
+    int profundidade = PROFUNDIDADE;
+    int fluxo = 0;
+    char *quadros = NULL, *anel = NULL, *servidor = NULL, *cache = NULL, *relatorio = NULL;
+    int limiteCache = LIMITE_CACHE, limiteMemo = 0;
+    int largura = 0, altura = 0;
+    int falhou = 0; //Codigo de saida: 1 se o servidor nao pode abrir o socket ou parou por um erro.
+    char caminho[MAX_CAMINHO], prefixo[MAX_CAMINHO + 2];
+    Imagem *original;
+    Resultado r, *guardado;
+
+    //Etapas que podem ser salvas para inspecao, na ordem do processamento.
+    eCinza = etapaRegistra("cinza");
+    eBorrada = etapaRegistra("borrada");
+    eNormalizada1 = etapaRegistra("normalizada");
+    eBinAdapt = etapaRegistra("binAdapt");
+    eDilata = etapaRegistra("dilata");
+    eMascara = etapaRegistra("mascara");
+    eNormalizada2 = etapaRegistra("normalizada");
+    eBinarizada = etapaRegistra("binarizada");
+    eAbertura = etapaRegistra("abertura");
 
-    //Procedimento para cada imagens.
-    for(int i = 0; i < 5; i += 1) {
-
-        //Carregando imagem em escala de cinza.
-        original = abreImagem(imagens[i], 1);
-        sprintf(name, "../resultados/%d1 - cinza.bmp", i + 1);
-        salvaImagem(original, name); 
-
-        //Criando imagens auxiliares, com o mesmo tamanho da imagem carregada.
-        entrada = criaImagem(original->largura,
-                    original->altura, original->n_canais);
-        copiaConteudo(original, entrada);
-        saida = criaImagem(original->largura,
-                    original->altura, original->n_canais);
-        buffer = criaImagem(original->largura,
-                    original->altura, original->n_canais);
-
-        filtroGaussiano(entrada, saida, 5, 5, buffer);
-        sprintf(name, "../resultados/%d2 - borrada.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        normalizaSemExtremos8bpp(entrada, saida, 0, 1, 0.01f);
-        sprintf(name, "../resultados/%d3 - normalizada.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        binarizaAdapt(entrada, saida, 101, 0.15f, buffer);
-        sprintf(name, "../resultados/%d4 - binAdapt.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        dilata(entrada, kernel, coordenada, saida);
-        sprintf(name, "../resultados/%d5 - dilata.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        mascara(original, entrada, saida);
-        sprintf(name, "../resultados/%d6 - mascara.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        normalizaSemExtremos8bpp(entrada, saida, 0, 1, 0.01f);
-        sprintf(name, "../resultados/%d7 - normalizada.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        binariza(entrada, saida, 0.8f);
-        sprintf(name, "../resultados/%d8 - binarizada.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        abertura(entrada, k, c, saida, buffer);
-        copiaConteudo(saida, entrada);
-        erode(entrada, k, c, saida);
-        sprintf(name, "../resultados/%d9 - abertura.bmp", i + 1);
-        salvaImagem(saida, name);
-        copiaConteudo(saida, entrada);
-
-        int qArroz = rotulaFloodFill(entrada, &componente, 1, 1, 1);
-        int nPixels = 0;
-
-        qsort(componente, qArroz, sizeof(ComponenteConexo), cmpfunc);
-
-        int mediana;
-        if((qArroz - 1)%2 == 0)
-            mediana = (componente[(qArroz-1)/2].n_pixels
-                        + componente[(qArroz)/2].n_pixels)/2;
+    //Uso: trabalho4 [-e etapas] [-o diretorio] [-p profundidade] [-f] [-q formato] [-m anel] [-d socket]
+    //                 [-c diretorio] [-C limite] [-P parametros] [-M limite] [-A sigmas] [fontes...]
+    //Sem fontes, processa as 5 imagens de ../imagens, salva todas as etapas
+    //e mostra a contagem como texto. Com fontes (diretorios, padroes glob,
+    //arquivos .bmp ou listas de caminhos, "-" para a entrada padrao), nao
+    //salva nenhuma etapa (a nao ser com -e) e escreve uma linha JSON por
+    //imagem. "-e" escolhe as etapas salvas (ex.: "-e nenhuma", "-e abertura"
+    //ou "-e 2,binAdapt"), e "-o" o diretorio onde sao salvas. "-p" diz
+    //quantas imagens sao lidas antes, em segundo plano, enquanto a atual e
+    //processada (0 le cada imagem so quando ela e usada). "-f" processa cada
+    //imagem linha por linha, sem carrega-la inteira (para imagens maiores
+    //que a memoria); nesse modo nenhuma etapa e salva. "-q" le as fontes
+    //(ou a entrada padrao, "-") como uma sequencia de quadros, sem arquivos
+    //intermediarios: "-q pnm" para PGM/PPM binarios, ou "-q 640x480" para
+    //quadros brutos de 8 bits com essas dimensoes. "-m" recebe os quadros
+    //do anel em memoria compartilhada com o nome dado (ver produtor.c). "-d"
+    //fica residente, atendendo pedidos no socket Unix dado (ver trataPedido),
+    //com os kernels, os coeficientes e a memoria das imagens ja prontos.
+    //"-c" guarda o resultado de cada arquivo no cache do diretorio dado, e
+    //nao processa de novo um arquivo com o mesmo conteudo (as etapas dele
+    //tambem nao sao salvas de novo); "-C" e o tamanho maximo do cache, em MB.
+    //"-P" muda parametros do processamento (ex.: "-P limiar2=0.7,abertura=7";
+    //os nomes sao os campos de Parametros). "-M" guarda as saidas das etapas
+    //de cada imagem, ate o limite dado em MB, para ajustar os parametros: uma
+    //nova contagem da mesma imagem (no modo residente, ou em outra execucao
+    //com -c, onde as saidas que nao cabem na memoria sao guardadas) so refaz
+    //as etapas depois do primeiro parametro mudado. "-A" nao conta os graos:
+    //escreve o relatorio de precisao dos metodos do filtro gaussiano para os
+    //sigmas dados (ex.: "-A 2,5,10,20"), para cada imagem.
+    for(int a = 1; a < argc; a += 1) {
+        if(strcmp(argv[a], "-e") == 0 && a + 1 < argc)
+            etapas = argv[++a];
+        else if(strcmp(argv[a], "-o") == 0 && a + 1 < argc)
+            etapaDiretorio(argv[++a]);
+        else if(strcmp(argv[a], "-p") == 0 && a + 1 < argc)
+            profundidade = atoi(argv[++a]);
+        else if(strcmp(argv[a], "-f") == 0)
+            fluxo = 1;
+        else if(strcmp(argv[a], "-q") == 0 && a + 1 < argc)
+            quadros = argv[++a];
+        else if(strcmp(argv[a], "-m") == 0 && a + 1 < argc)
+            anel = argv[++a];
+        else if(strcmp(argv[a], "-d") == 0 && a + 1 < argc)
+            servidor = argv[++a];
+        else if(strcmp(argv[a], "-c") == 0 && a + 1 < argc)
+            cache = argv[++a];
+        else if(strcmp(argv[a], "-C") == 0 && a + 1 < argc)
+            limiteCache = atoi(argv[++a]);
+        else if(strcmp(argv[a], "-P") == 0 && a + 1 < argc) {
+            if(!leParametros(argv[++a], &parametros)) {
+                printf("Parametros invalidos: %s\n", argv[a]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[a], "-M") == 0 && a + 1 < argc)
+            limiteMemo = atoi(argv[++a]);
+        else if(strcmp(argv[a], "-A") == 0 && a + 1 < argc)
+            relatorio = argv[++a];
+        else if(argv[a][0] == '-' && argv[a][1] != 0) {
+            printf("Uso: %s [-e etapas] [-o diretorio] [-p profundidade] [-f] [-q formato] [-m anel] [-d socket] [-c diretorio] [-C limite] [-P parametros] [-M limite] [-A sigmas] [fontes...]\n", argv[0]);
+            return 1;
+        }
         else
-            mediana = componente[(qArroz-1)/2].n_pixels;
-
-        for(int cont = 0; cont < qArroz; cont += 1)
-            nPixels += componente[cont].n_pixels;
-
-        // desviopadrao = raiz(somatorio, i de 0 ate n-1 ((comp(i) - media)²)/n)    
-        int desvpad = 0;
-
-        // Desvio padrao representa o número total de pixels que nao foram 
-        // contados por conta da juncao dos arroz
-        for(int j = 0; j < qArroz; j += 1)
-        // A mediana representa o grau de experança, também pode usar média
-            desvpad += abs(componente[j].n_pixels - mediana);
-        desvpad /= sqrt(qArroz);
-
-        printf("Imagem %d\n", i + 1);
-        if((componente[qArroz - 1].n_pixels)/mediana > 4)
-        // Calcula porcentagem de erro e soma com o número de pixels total
-            printf("Graos de arroz na imagem: \t%d\n\n",
-                    (nPixels + (desvpad*100/nPixels))/mediana);
+            fontes[nFontes++] = argv[a];
+    }
+
+    //Os quadros chegam uma vez so, e o processamento em fluxo le cada imagem
+    //tres vezes.
+    if(servidor != NULL && (anel != NULL || quadros != NULL || fluxo || nFontes > 0)) {
+        printf("-d nao pode ser usado com -m, -q, -f ou fontes\n");
+        return 1;
+    }
+    if(relatorio != NULL && (servidor != NULL || anel != NULL || quadros != NULL || fluxo)) {
+        printf("-A nao pode ser usado com -d, -m, -q ou -f\n");
+        return 1;
+    }
+    if(fluxo && parametros.gaussiano != GAUSSIANO_DIRETO) {
+        printf("-f so usa o filtro gaussiano direto\n");
+        return 1;
+    }
+    if(anel != NULL && (quadros != NULL || fluxo || nFontes > 0)) {
+        printf("-m nao pode ser usado com -q, -f ou fontes\n");
+        return 1;
+    }
+    if(quadros != NULL) {
+        if(fluxo) {
+            printf("-f nao pode ser usado com -q\n");
+            return 1;
+        }
+        if(strcmp(quadros, "pnm") != 0 &&
+           (sscanf(quadros, "%dx%d", &largura, &altura) != 2 || largura <= 0 || altura <= 0)) {
+            printf("Formato de quadros invalido: %s (use pnm ou LARGURAxALTURA)\n", quadros);
+            return 1;
+        }
+        if(nFontes == 0)
+            fontes[nFontes++] = "-";
+    }
+
+    if(cache != NULL) {
+        if(!cacheInicia(cache, (size_t) limiteCache * 1024 * 1024))
+            return 1;
+        usaCache = 1;
+    }
+    if(limiteMemo > 0) {
+        memoInicia((size_t) limiteMemo * 1024 * 1024, usaCache);
+        usaMemo = 1;
+    }
+
+    if(etapas == NULL)
+        etapas = (nFontes > 0 || fluxo || anel != NULL || servidor != NULL) ? "nenhuma" : "todas";
+    if(!etapaSeleciona(etapas))
+        return 1;
+
+    //As imagens de cada iteração reaproveitam a memória da iteração anterior,
+    //entao a memoria usada nao cresce com o tamanho do lote.
+    poolInicia(0);
+
+    //As imagens intermediarias sao gravadas em segundo plano, enquanto o
+    //processamento continua. As copias na fila ocupam no maximo 64 MB.
+    escritaInicia(64*1024*1024);
+
+    if(relatorio != NULL) {
+        for(int f = 0; f < (nFontes > 0 ? nFontes : 1); f += 1) {
+            Lote *lote = nFontes > 0 ? loteAbre(fontes[f]) : loteCriaLista(imagens, 5);
+            if(lote == NULL)
+                continue;
+            while(loteProximo(lote, caminho, MAX_CAMINHO))
+                relatorioGaussiano(caminho, relatorio);
+            loteFecha(lote);
+        }
+    }
+    else if(servidor != NULL) {
+        //Os kernels dos parametros atuais ja ficam prontos para o primeiro pedido.
+        Coordenada centro;
+        kernelCircular(parametros.dilata, &centro);
+        kernelCircular(parametros.abertura, &centro);
+        sem_init(&vagas, 0, sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1);
+        if(!servidorExecuta(servidor, trataPedido, NULL))
+            falhou = 1;
+        sem_destroy(&vagas);
+    }
+    else if(anel != NULL) {
+        processaAnel(anel);
+    }
+    else if(quadros != NULL) {
+        for(int f = 0; f < nFontes; f += 1)
+            processaQuadros(fontes[f], largura, altura);
+    }
+    else if(nFontes == 0) {
+        //Procedimento para cada imagens. A imagem seguinte ja vai sendo lida
+        //enquanto a atual e processada.
+        Lote *lote = loteCriaLista(imagens, 5);
+        Preleitura *pre = fluxo ? NULL : preleituraInicia(lote, 1, profundidade,
+                                    usaCache ? consultaCache : NULL, NULL);
+        for(int i = 0; ; i += 1) {
+            double t = agora();
+            if(!proximaImagem(lote, pre, caminho, &original, &guardado))
+                break;
+            if(guardado != NULL) {
+                r = *guardado;
+                free(guardado);
+            }
+            else if(fluxo ? !processaFluxo(caminho, &parametros, &r) : original == NULL) {
+                printf("Nao foi possivel abrir %s\n", caminho);
+                continue;
+            }
+            else {
+                if(!fluxo) {
+                    r.tempos[0] = agora() - t;
+                    sprintf(prefixo, "%d", i + 1);
+                    ChaveCache chave;
+                    int ok = processaImagem(original, prefixo, chaveEntrada(caminho, &chave), &parametros, &r);
+                    destroiImagem(original);
+                    if(!ok) {
+                        printf("Imagem pequena demais: %s\n", caminho);
+                        continue;
+                    }
+                }
+                guardaResultado(caminho, &parametros, &r);
+            }
+
+            printf("Imagem %d\n", i + 1);
+            printf("Graos de arroz na imagem: \t%d\n\n", r.graos);
+            free(r.tabela);
+        }
+        preleituraFinaliza(pre);
+        loteFecha(lote);
+    }
+    else {
+        //Processamento em lote: uma imagem por vez, na ordem das fontes,
+        //lendo as proximas em segundo plano.
+        for(int f = 0; f < nFontes; f += 1) {
+            Lote *lote = loteAbre(fontes[f]);
+            if(lote == NULL)
+                continue;
+            Preleitura *pre = fluxo ? NULL : preleituraInicia(lote, 1, profundidade,
+                                        usaCache ? consultaCache : NULL, NULL);
+
+            for(;;) {
+                double t = agora();
+                if(!proximaImagem(lote, pre, caminho, &original, &guardado))
+                    break;
+                if(guardado != NULL) {
+                    r = *guardado;
+                    free(guardado);
+                    r.tempos[0] = agora() - t;
+                }
+                else if(fluxo ? !processaFluxo(caminho, &parametros, &r) : original == NULL) {
+                    imprimeResultado(caminho, NULL);
+                    continue;
+                }
+                else if(!fluxo) {
+                    r.tempos[0] = agora() - t;
+
+                    //Os arquivos das etapas usam o nome da imagem, sem extensao.
+                    char *nome = strrchr(caminho, '/');
+                    snprintf(prefixo, sizeof(prefixo), "%s_", nome ? nome + 1 : caminho);
+                    char *ponto = strrchr(prefixo, '.');
+                    if(ponto != NULL)
+                        strcpy(ponto, "_");
+
+                    ChaveCache chave;
+                    processaImagem(original, prefixo, chaveEntrada(caminho, &chave), &parametros, &r);
+                    destroiImagem(original);
+                }
+                if(guardado == NULL && r.erro == NULL)
+                    guardaResultado(caminho, &parametros, &r);
+                imprimeResultado(caminho, &r);
+                free(r.tabela);
+            }
+
+            preleituraFinaliza(pre);
+            loteFecha(lote);
+        }
+    }
+
+    //Espera todas as imagens serem gravadas.
+    if(escritaFinaliza() > 0)
+        fprintf(stderr, "Algumas imagens nao puderam ser salvas.\n");
+
+    //As saidas das etapas que ainda estao na memoria vao para o cache antes
+    //de ele ser fechado.
+    memoFinaliza();
+    cacheFinaliza();
+    for(int i = 0; i <= MAX_KERNEL; i += 1)
+        if(kernels[i] != NULL)
+            destroiImagem(kernels[i]);
+    if(nFontes == 0 && anel == NULL && servidor == NULL && relatorio == NULL)
+        poolImprimeEstatisticas();
+    poolFinaliza();
+
+    return falhou;
+}
+
+//Conta os graos de arroz de uma imagem em escala de cinza, com os parametros
+//dados. As etapas ligadas sao salvas com o prefixo dado. Se a memorizacao
+//estiver ligada e a entrada tiver uma chave (ver chaveEntrada), a saida da
+//ultima etapa ja guardada para essa entrada e esses parametros e carregada,
+//e o processamento continua dali: as etapas anteriores ficam com tempo zero
+//e nao sao salvas. As saidas calculadas sao guardadas. Retorna 0 (com o
+//motivo em r->erro, e sem a tabela) se a imagem for pequena demais para os
+//filtros (ver tamanhoValido).
+int processaImagem(Imagem *original, const char *prefixo, const ChaveCache *entradaChave,
+                   const Parametros *p, Resultado *r) {
+    Imagem *entrada, *saida, *buffer, *kernel, *k;
+    ImagemU8 *binaria;
+    ImagemBin *bin, *bin_saida, *bin_buffer;
+    ComponenteConexo *componente;
+    Coordenada coordenada, c;
+    ChaveCache chavesEtapas[N_MEMO], *chaves = NULL;
+    int inicio = 0; //Numero de etapas que nao precisam ser feitas.
+    double t;
+
+    r->nomes = nomesTempos;
+    r->nTempos = N_TEMPOS;
+    r->cache = 0;
+    r->memo = NULL;
+    r->erro = NULL;
+    if(!tamanhoValido(original->largura, original->altura, p)) {
+        r->erro = "tamanho";
+        r->tabela = NULL;
+        return 0;
+    }
+    etapaSalva(eCinza, prefixo, original);
+
+    kernel = kernelCircular(p->dilata, &coordenada);
+    k = kernelCircular(p->abertura, &c);
+
+    //Criando imagens auxiliares, com o mesmo tamanho da imagem carregada.
+    //As etapas em tons de cinza usam float (quantizar em 8 bits muda os
+    //limiares e a contagem); as mascaras usam 1 bit por pixel (e sao
+    //salvas assim), e a imagem de 8 bits serve para rotular.
+    //Cada etapa escreve na propria entrada ou na imagem do par
+    //(entrada/saida, bin/bin_saida); trocar os ponteiros evita copiar a
+    //imagem inteira entre as etapas.
+    entrada = criaImagem(original->largura,
+                original->altura, original->n_canais);
+    saida = criaImagem(original->largura,
+                original->altura, original->n_canais);
+    buffer = criaImagem(original->largura,
+                original->altura, original->n_canais);
+    binaria = criaImagemU8(original->largura, original->altura);
+    bin = criaImagemBin(original->largura, original->altura);
+    bin_saida = criaImagemBin(original->largura, original->altura);
+    bin_buffer = criaImagemBin(original->largura, original->altura);
+
+    //Procura a saida guardada da etapa mais adiantada, indo para tras. Cada
+    //saida e carregada onde a etapa a deixaria.
+    if(usaMemo && entradaChave != NULL) {
+        chaves = chavesEtapas;
+        chavesMemo(entradaChave, p, chaves);
+        for(inicio = N_MEMO; inicio > 0; inicio -= 1) {
+            int ok;
+            if(inicio == 3 || inicio == 4 || inicio >= 7)
+                ok = memoCarregaBin(&chaves[inicio - 1], bin);
+            else
+                ok = memoCarregaImagem(&chaves[inicio - 1], inicio <= 2 ? entrada : saida);
+            if(ok)
+                break;
+        }
+        if(inicio > 0)
+            r->memo = nomesMemo[inicio - 1];
+        for(int i = 1; i <= inicio; i += 1)
+            r->tempos[i] = 0;
+    }
+
+    if(inicio < 1) {
+        t = agora();
+        filtroGaussianoMetodo(original, saida, p->sigma, p->sigma, p->gaussiano, buffer);
+        trocaImagens(&entrada, &saida);
+        memoriza(chaves, 1, entrada, NULL);
+        r->tempos[1] = agora() - t;
+    }
+    if(inicio <= 1)
+        etapaSalva(eBorrada, prefixo, entrada);
+
+    if(inicio < 2) {
+        t = agora();
+        normalizaSemExtremos8bpp(entrada, entrada, 0, 1, p->descartados);
+        memoriza(chaves, 2, entrada, NULL);
+        r->tempos[2] = agora() - t;
+    }
+    if(inicio <= 2)
+        etapaSalva(eNormalizada1, prefixo, entrada);
+
+    if(inicio < 3) {
+        t = agora();
+        binarizaAdapt(entrada, saida, p->janela, p->limiarAdapt, buffer);
+        imagemParaBin(saida, 0, p->limiar1, bin);
+        memoriza(chaves, 3, NULL, bin);
+        r->tempos[3] = agora() - t;
+    }
+    if(inicio <= 3)
+        etapaSalvaBin(eBinAdapt, prefixo, bin);
+
+    if(inicio < 4) {
+        t = agora();
+        dilataBin(bin, kernel, coordenada, bin_saida);
+        trocaImagensBin(&bin, &bin_saida);
+        memoriza(chaves, 4, NULL, bin);
+        r->tempos[4] = agora() - t;
+    }
+    if(inicio <= 4)
+        etapaSalvaBin(eDilata, prefixo, bin);
+
+    if(inicio < 5) {
+        t = agora();
+        mascara(original, bin, saida);
+        memoriza(chaves, 5, saida, NULL);
+        r->tempos[5] = agora() - t;
+    }
+    if(inicio <= 5)
+        etapaSalva(eMascara, prefixo, saida);
+
+    if(inicio < 6) {
+        t = agora();
+        normalizaSemExtremos8bpp(saida, saida, 0, 1, p->descartados);
+        memoriza(chaves, 6, saida, NULL);
+        r->tempos[6] = agora() - t;
+    }
+    if(inicio <= 6)
+        etapaSalva(eNormalizada2, prefixo, saida);
+
+    if(inicio < 7) {
+        t = agora();
+        imagemParaBin(saida, 0, p->limiar2, bin);
+        memoriza(chaves, 7, NULL, bin);
+        r->tempos[7] = agora() - t;
+    }
+    if(inicio <= 7)
+        etapaSalvaBin(eBinarizada, prefixo, bin);
+
+    if(inicio < 8) {
+        t = agora();
+        aberturaBin(bin, k, c, bin_saida, bin_buffer);
+        erodeBin(bin_saida, k, c, bin);
+        memoriza(chaves, 8, NULL, bin);
+        r->tempos[8] = agora() - t;
+    }
+    etapaSalvaBin(eAbertura, prefixo, bin);
+
+    t = agora();
+    binParaU8(bin, binaria);
+    int qArroz = rotulaFloodFillU8(binaria, &componente, 1, 1, 1);
+    contaGraos(componente, qArroz, r);
+    r->tabela = componente;
+    r->tempos[9] = agora() - t;
+
+    //Desalocando memória previamente alocada.
+    destroiImagem(entrada);
+    destroiImagem(saida);
+    destroiImagem(buffer);
+    destroiImagemU8(binaria);
+    destroiImagemBin(bin);
+    destroiImagemBin(bin_saida);
+    destroiImagemBin(bin_buffer);
+    return 1;
+}
+
+//Confere se uma imagem com as dimensoes dadas e grande o bastante para os
+//filtros com os parametros dados: a convolucao do filtro gaussiano nao aceita
+//um kernel com o dobro do tamanho da imagem, e a janela da binarizacao
+//adaptativa e os kernels da morfologia devem caber nela. Sem isso, os filtros
+//encerrariam o programa (e, no modo residente, o servidor).
+int tamanhoValido(int largura, int altura, const Parametros *p) {
+    int menor = largura < altura ? largura : altura;
+    return _filtroGaussianoNCoef(p->sigma) < 2*menor &&
+           p->janela <= menor && p->dilata <= menor && p->abertura <= menor;
+}
+
+//Monta as chaves das saidas das etapas: cada uma deriva da anterior (a
+//primeira, da entrada) e dos parametros da propria etapa, entao depende da
+//entrada e dos parametros de todas as etapas ate ela. Mudar um parametro
+//muda so as chaves da etapa que o usa e das seguintes.
+void chavesMemo(const ChaveCache *entrada, const Parametros *p, ChaveCache chaves[N_MEMO]) {
+    char texto[N_MEMO][64];
+
+    snprintf(texto[0], sizeof(texto[0]), "gaussiano=%g,%s", p->sigma, nomesGaussiano[p->gaussiano]);
+    snprintf(texto[1], sizeof(texto[1]), "normaliza=%g", p->descartados);
+    snprintf(texto[2], sizeof(texto[2]), "binAdapt=%d,%g;bin=%g", p->janela, p->limiarAdapt, p->limiar1);
+    snprintf(texto[3], sizeof(texto[3]), "dilata=%d", p->dilata);
+    snprintf(texto[4], sizeof(texto[4]), "mascara");
+    snprintf(texto[5], sizeof(texto[5]), "normaliza2=%g", p->descartados);
+    snprintf(texto[6], sizeof(texto[6]), "bin2=%g", p->limiar2);
+    snprintf(texto[7], sizeof(texto[7]), "abertura=%d", p->abertura);
+
+    for(int i = 0; i < N_MEMO; i += 1) {
+        chaves[i] = i == 0 ? *entrada : chaves[i - 1];
+        cacheCombinaChave(&chaves[i], texto[i]);
+    }
+}
+
+//Guarda a saida de uma etapa (numerada de 1 a N_MEMO), se a memorizacao
+//estiver ligada para a imagem atual (chaves != NULL).
+void memoriza(const ChaveCache *chaves, int etapa, Imagem *img, ImagemBin *bin) {
+    if(chaves == NULL)
+        return;
+    if(img != NULL)
+        memoGuardaImagem(&chaves[etapa - 1], img);
+    else
+        memoGuardaBin(&chaves[etapa - 1], bin);
+}
+
+//Chave que identifica o conteudo de um arquivo de entrada, para a
+//memorizacao das etapas. Retorna NULL se a memorizacao estiver desligada ou
+//o arquivo nao puder ser lido.
+const ChaveCache *chaveEntrada(const char *caminho, ChaveCache *chave) {
+    if(!usaMemo || !cacheChaveArquivo(caminho, "entrada", chave))
+        return NULL;
+    return chave;
+}
+
+//Le parametros no formato "nome=valor,nome=valor", mudando so os campos
+//dados. O valor de "gaussiano" e o nome do metodo (ex.: "gaussiano=recursivo").
+//Retorna 0 se algum nome ou valor for invalido (e os parametros podem ter
+//sido mudados em parte).
+int leParametros(const char *texto, Parametros *p) {
+    char copia[MAX_PARAMETROS], nome[32], *salva;
+    double valor;
+
+    if(snprintf(copia, sizeof(copia), "%s", texto) >= (int) sizeof(copia))
+        return 0;
+    for(char *item = strtok_r(copia, ",", &salva); item != NULL; item = strtok_r(NULL, ",", &salva)) {
+        if(strncmp(item, "gaussiano=", 10) == 0) {
+            for(p->gaussiano = N_GAUSSIANO - 1; p->gaussiano >= 0; p->gaussiano -= 1)
+                if(strcmp(item + 10, nomesGaussiano[p->gaussiano]) == 0)
+                    break;
+            if(p->gaussiano < 0)
+                return 0;
+            continue;
+        }
+        if(sscanf(item, "%31[^=]=%lf", nome, &valor) != 2)
+            return 0;
+        if(strcmp(nome, "sigma") == 0)
+            p->sigma = valor;
+        else if(strcmp(nome, "descartados") == 0)
+            p->descartados = valor;
+        else if(strcmp(nome, "janela") == 0)
+            p->janela = (int) valor;
+        else if(strcmp(nome, "limiarAdapt") == 0)
+            p->limiarAdapt = valor;
+        else if(strcmp(nome, "limiar1") == 0)
+            p->limiar1 = valor;
+        else if(strcmp(nome, "dilata") == 0)
+            p->dilata = (int) valor;
+        else if(strcmp(nome, "limiar2") == 0)
+            p->limiar2 = valor;
+        else if(strcmp(nome, "abertura") == 0)
+            p->abertura = (int) valor;
         else
-            printf("Graos de arroz na imagem: \t%d\n\n", qArroz);
-        //printf("Numero de arroz c/ desvpad: %d\n", (nPixels + desvpad)/mediana);
-        //printf("Numero de arroz c/ mediana: %d\n", nPixels/mediana);
-        //printf("Numero de arroz s/ mediana: %d\n\n", qArroz);
-        //Desalocando memória previamente alocada.
+            return 0;
+    }
 
-        free(componente);
+    //Os filtros encerram o programa com valores invalidos (no modo residente,
+    //o servidor inteiro), entao eles sao recusados aqui: a janela da
+    //binarizacao adaptativa e os kernels circulares precisam de largura impar,
+    //a normalizacao precisa descartar uma fracao em (0, 0.5), e o kernel do
+    //filtro gaussiano fica limitado a MAX_KERNEL, como os outros.
+    return p->sigma > 0 && _filtroGaussianoNCoef(p->sigma) <= MAX_KERNEL &&
+           p->descartados > 0 && p->descartados < 0.5f &&
+           p->janela > 0 && p->janela % 2 == 1 &&
+           p->dilata > 0 && p->dilata <= MAX_KERNEL && p->dilata % 2 == 1 &&
+           p->abertura > 0 && p->abertura <= MAX_KERNEL && p->abertura % 2 == 1;
+}
+
+//Descreve os parametros, para a chave do cache de resultados. Com os
+//parametros padrao, o texto e o mesmo das versoes anteriores, e os
+//resultados ja guardados continuam valendo.
+void descreveParametros(const Parametros *p, char *saida, size_t tamanho) {
+    int n = snprintf(saida, tamanho, "gaussiano=%g,%g;normaliza=0,1,%g;binAdapt=%d,%g;bin=%g;"
+                     "dilata=%d;normaliza2=0,1,%g;bin2=%g;abertura=%d;erode=%d;rotula=1,1,1",
+                     p->sigma, p->sigma, p->descartados, p->janela, p->limiarAdapt, p->limiar1,
+                     p->dilata, p->descartados, p->limiar2, p->abertura, p->abertura);
+    if(p->gaussiano != GAUSSIANO_DIRETO && n >= 0 && (size_t) n < tamanho)
+        snprintf(saida + n, tamanho - n, ";metodo=%s", nomesGaussiano[p->gaussiano]);
+}
+
+//Kernel circular com a largura dada (impar, ate MAX_KERNEL), e o centro dele.
+Imagem *kernelCircular(int largura, Coordenada *centro) {
+    pthread_mutex_lock(&mutexKernels);
+    if(kernels[largura] == NULL)
+        kernels[largura] = criaKernelCircular(largura);
+    Imagem *kernel = kernels[largura];
+    pthread_mutex_unlock(&mutexKernels);
+
+    *centro = criaCoordenada(largura/2, largura/2);
+    return kernel;
+}
+
+//Relatorio de precisao dos metodos do filtro gaussiano para uma imagem: para
+//cada sigma da lista (separada por virgulas), compara cada metodo com a
+//convolucao direta (a usada por padrao) e escreve uma linha JSON com o maior
+//erro e o erro medio (na escala [0,1] dos pixels), a fracao dos pixels que
+//mudariam se a imagem fosse quantizada em 8 bits, e os tempos. Sigmas que a
+//convolucao direta nao aceita para essa imagem (kernel maior que o dobro da
+//imagem) sao pulados.
+void relatorioGaussiano(char *caminho, const char *sigmas) {
+    char copia[MAX_PARAMETROS], *salva;
+    Imagem *img = abreImagem(caminho, 1);
+
+    if(img == NULL) {
+        imprimeResultado(caminho, NULL);
+        return;
+    }
+    Imagem *direta = criaImagem(img->largura, img->altura, 1);
+    Imagem *outra = criaImagem(img->largura, img->altura, 1);
+    Imagem *buffer = criaImagem(img->largura, img->altura, 1);
+    int menor = img->largura < img->altura ? img->largura : img->altura;
+
+    snprintf(copia, sizeof(copia), "%s", sigmas);
+    for(char *item = strtok_r(copia, ",", &salva); item != NULL; item = strtok_r(NULL, ",", &salva)) {
+        float sigma = atof(item);
+        if(sigma < 0.5f || _filtroGaussianoNCoef(sigma) >= menor*2)
+            continue;
+
+        double t = agora();
+        filtroGaussianoMetodo(img, direta, sigma, sigma, GAUSSIANO_DIRETO, buffer);
+        double tDireto = agora() - t;
+
+        for(int metodo = 0; metodo < N_GAUSSIANO; metodo += 1) {
+            if(metodo == GAUSSIANO_DIRETO)
+                continue;
+            t = agora();
+            filtroGaussianoMetodo(img, outra, sigma, sigma, metodo, buffer);
+            t = agora() - t;
+
+            double erroMax = 0, erroSoma = 0;
+            long mudam = 0;
+            for(int y = 0; y < img->altura; y += 1)
+                for(int x = 0; x < img->largura; x += 1) {
+                    float a = direta->dados[0][y][x], b = outra->dados[0][y][x];
+                    double erro = fabs(a - b);
+                    erroSoma += erro;
+                    if(erro > erroMax)
+                        erroMax = erro;
+                    if((int) (a*255 + 0.5f) != (int) (b*255 + 0.5f))
+                        mudam += 1;
+                }
+
+            double nPixels = (double) img->largura * img->altura;
+            printf("{\"arquivo\": \"%s\", \"sigma\": %g, \"metodo\": \"%s\", \"erro_max\": %.6f, "
+                   "\"erro_medio\": %.6f, \"mudam_8bits\": %.4f, \"tempo_ms\": %.3f, \"tempo_direto_ms\": %.3f}\n",
+                   caminho, sigma, nomesGaussiano[metodo], erroMax, erroSoma / nPixels,
+                   mudam / nPixels, t, tDireto);
+        }
+    }
+    fflush(stdout);
+
+    destroiImagem(img);
+    destroiImagem(direta);
+    destroiImagem(outra);
+    destroiImagem(buffer);
+}
+
+//Pega a proxima imagem do lote: da leitura antecipada ou, se ela nao for
+//usada (pre == NULL, no processamento em fluxo), so o caminho. Se o
+//resultado da imagem estiver no cache, ele vem em guardado (que deve ser
+//liberado com free), e a imagem nao e lida.
+int proximaImagem(Lote *lote, Preleitura *pre, char *caminho, Imagem **original, Resultado **guardado) {
+    if(pre != NULL)
+        return preleituraProxima(pre, caminho, MAX_CAMINHO, original, (void **) guardado);
+    *original = NULL;
+    if(!loteProximo(lote, caminho, MAX_CAMINHO))
+        return 0;
+    *guardado = usaCache ? consultaCache(caminho, NULL) : NULL;
+    return 1;
+}
+
+//Consulta do cache, feita antes de ler cada imagem (na thread da leitura
+//antecipada). O cache guarda a tabela de componentes, e as estatisticas sao
+//calculadas de novo a partir dela. dados sao os Parametros usados (NULL para
+//os globais). Retorna o resultado, alocado com malloc, ou NULL se ele nao
+//estiver no cache.
+void *consultaCache(const char *caminho, void *dados) {
+    char descricao[MAX_PARAMETROS];
+    ChaveCache chave;
+    size_t tamanho;
+
+    descreveParametros(dados != NULL ? (const Parametros *) dados : &parametros,
+                       descricao, sizeof(descricao));
+    if(!cacheChaveArquivo(caminho, descricao, &chave))
+        return NULL;
+    ComponenteConexo *tabela = cacheBusca(&chave, &tamanho);
+    if(tabela == NULL)
+        return NULL;
+
+    Resultado *r = calloc(1, sizeof(Resultado));
+    contaGraos(tabela, tamanho / sizeof(ComponenteConexo), r);
+    r->tabela = tabela;
+    r->cache = 1;
+    r->nomes = nomesTempos;
+    r->nTempos = 1; //So a leitura.
+    return r;
+}
+
+//Guarda a tabela de componentes de uma imagem, contada com os parametros
+//dados, no cache.
+void guardaResultado(const char *caminho, const Parametros *p, Resultado *r) {
+    char descricao[MAX_PARAMETROS];
+    ChaveCache chave;
+
+    if(!usaCache)
+        return;
+    descreveParametros(p, descricao, sizeof(descricao));
+    if(cacheChaveArquivo(caminho, descricao, &chave))
+        cacheGuarda(&chave, r->tabela, sizeof(ComponenteConexo) * r->componentes);
+}
+
+//Processa os quadros de uma fonte ("-" para a entrada padrao, ou um arquivo,
+//que pode ser um pipe com nome), um de cada vez, ate o fim dos dados. Cada
+//quadro e identificado pela fonte e pelo numero, como "-#3". Retorna o
+//numero de quadros processados.
+int processaQuadros(char *fonte, int largura, int altura) {
+    char nome[MAX_CAMINHO], prefixo[MAX_CAMINHO + 16];
+    int fd = strcmp(fonte, "-") == 0 ? 0 : open(fonte, O_RDONLY);
+    Resultado r;
+    int n = 0;
+
+    if(fd < 0) {
+        imprimeResultado(fonte, NULL);
+        return 0;
+    }
+
+    //Os arquivos das etapas usam o nome da fonte, sem extensao.
+    char *base = strrchr(fonte, '/');
+    snprintf(nome, sizeof(nome), "%s", fd == 0 ? "stdin" : base ? base + 1 : fonte);
+    char *ponto = strrchr(nome, '.');
+    if(ponto != NULL)
+        *ponto = 0;
+
+    Quadros *q = quadrosAbre(fd, largura, altura);
+    for(;;) {
+        double t = agora();
+        Imagem *original = quadrosProximo(q, 1);
+        if(original == NULL)
+            break;
+        r.tempos[0] = agora() - t;
+        n += 1;
+
+        snprintf(prefixo, sizeof(prefixo), "%s_%d_", nome, n);
+        processaImagem(original, prefixo, NULL, &parametros, &r);
         destroiImagem(original);
-        destroiImagem(entrada);
-        destroiImagem(saida);
-        destroiImagem(buffer);
+
+        snprintf(prefixo, sizeof(prefixo), "%s#%d", fonte, n);
+        imprimeResultado(prefixo, &r);
+        free(r.tabela);
+    }
+
+    quadrosFecha(q);
+    if(fd != 0)
+        close(fd);
+    return n;
+}
+
+//Processa os quadros de 8 bits de um anel em memoria compartilhada, ate o
+//produtor terminar. Cada quadro chega como uma visao da memoria do anel, sem
+//copia; a conversao para float (que as etapas usam) e a primeira etapa, e a
+//posicao volta para o produtor logo depois dela. No fim, mostra a vazao.
+//Retorna o numero de quadros processados.
+int processaAnel(char *nome) {
+    char prefixo[MAX_CAMINHO + 32];
+    uint64_t sequencia;
+    double inicio = agora(), bytes = 0;
+    Resultado r;
+    int n = 0;
+
+    Anel *anel = anelAbre(nome);
+    if(anel == NULL)
+        return 0;
+
+    for(;;) {
+        double t = agora();
+        ImagemU8 *quadro = anelProximo(anel, &sequencia);
+        if(quadro == NULL)
+            break;
+        Imagem *original = criaImagem(quadro->largura, quadro->altura, 1);
+        U8ParaImagem(quadro, original);
+        bytes += (double) quadro->largura * quadro->altura;
+        anelLibera(anel, quadro);
+        r.tempos[0] = agora() - t;
+        n += 1;
+
+        snprintf(prefixo, sizeof(prefixo), "%s_%llu_", nome[0] == '/' ? nome + 1 : nome,
+                 (unsigned long long) sequencia);
+        processaImagem(original, prefixo, NULL, &parametros, &r);
+        destroiImagem(original);
+
+        snprintf(prefixo, sizeof(prefixo), "%s#%llu", nome, (unsigned long long) sequencia);
+        imprimeResultado(prefixo, &r);
+        free(r.tabela);
+    }
+    anelFecha(anel);
+
+    double t = agora() - inicio;
+    fprintf(stderr, "Anel %s: %d quadros em %.1f ms: %.1f quadros/s, %.1f MB/s\n",
+            nome, n, t, n * 1000.0 / t, bytes / 1048576.0 * 1000.0 / t);
+    return n;
+}
+
+//Trata um pedido do modo residente. Os pedidos sao:
+//  conta <caminho>                        conta os graos de um arquivo;
+//  ajusta <parametros> <caminho>          conta os graos de um arquivo com
+//                                         outros parametros (no formato de
+//                                         -P, sem espacos); com -M, so as
+//                                         etapas que mudaram sao refeitas;
+//  quadro <nome> <largura> <altura>       conta os graos de um quadro de 8
+//                                         bits na memoria compartilhada com
+//                                         esse nome (shm_open), linha por
+//                                         linha, sem preenchimento;
+//  fim                                    fecha a conexao.
+//A resposta e a mesma linha JSON do processamento em lote. Os tempos sao so
+//os do processamento: nada e criado ou calculado de novo a cada pedido.
+int trataPedido(const char *pedido, char *resposta, size_t tamanho, void *dados) {
+    char comando[16], nome[MAX_CAMINHO], prefixo[MAX_CAMINHO + 2], texto[MAX_PARAMETROS];
+    Parametros p = parametros;
+    ChaveCache chave;
+    int largura, altura, arquivo;
+    Imagem *original;
+    Resultado r;
+    (void) dados;
+
+    if(sscanf(pedido, "%15s", comando) != 1) {
+        snprintf(resposta, tamanho, "{\"erro\": \"pedido\"}");
+        return 1;
+    }
+    if(strcmp(comando, "fim") == 0)
+        return 0;
+
+    double t = agora();
+    arquivo = strcmp(comando, "conta") == 0 || strcmp(comando, "ajusta") == 0;
+    if(strcmp(comando, "ajusta") == 0 &&
+       (sscanf(pedido, "%*s %255s %1023[^\n]", texto, nome) != 2 || !leParametros(texto, &p))) {
+        snprintf(resposta, tamanho, "{\"erro\": \"parametros\"}");
+        return 1;
+    }
+    if(arquivo && (strcmp(comando, "ajusta") == 0 || sscanf(pedido, "%*s %1023[^\n]", nome) == 1)) {
+        Resultado *guardado = usaCache ? consultaCache(nome, &p) : NULL;
+        if(guardado != NULL) {
+            guardado->tempos[0] = agora() - t;
+            formataResultado(resposta, tamanho, nome, guardado);
+            free(guardado->tabela);
+            free(guardado);
+            return 1;
+        }
+        original = abreImagem(nome, 1);
+    }
+    else if(strcmp(comando, "quadro") == 0 &&
+            sscanf(pedido, "%*s %1023s %d %d", nome, &largura, &altura) == 3)
+        original = abreQuadroCompartilhado(nome, largura, altura);
+    else {
+        snprintf(resposta, tamanho, "{\"erro\": \"pedido\"}");
+        return 1;
+    }
+    if(original == NULL) {
+        formataResultado(resposta, tamanho, nome, NULL);
+        return 1;
+    }
+    r.tempos[0] = agora() - t;
+
+    //Os arquivos das etapas (se alguma for salva) usam o nome da imagem.
+    char *base = strrchr(nome, '/');
+    snprintf(prefixo, sizeof(prefixo), "%s_", base ? base + 1 : nome);
+
+    sem_wait(&vagas);
+    int ok = processaImagem(original, prefixo, arquivo ? chaveEntrada(nome, &chave) : NULL, &p, &r);
+    sem_post(&vagas);
+    destroiImagem(original);
+    if(arquivo && ok)
+        guardaResultado(nome, &p, &r);
+
+    formataResultado(resposta, tamanho, nome, &r);
+    free(r.tabela);
+    return 1;
+}
+
+//Le um quadro de 8 bits de uma memoria compartilhada criada pelo cliente,
+//convertendo para float. Retorna NULL se a memoria nao existe ou e pequena
+//demais para as dimensoes dadas.
+Imagem *abreQuadroCompartilhado(const char *nome, int largura, int altura) {
+    struct stat info;
+    int fd = shm_open(nome, O_RDONLY, 0);
+    if(fd < 0)
+        return NULL;
+    if(largura <= 0 || altura <= 0 || fstat(fd, &info) != 0 ||
+       (size_t) info.st_size < (size_t) largura * altura) {
+        close(fd);
+        return NULL;
+    }
+
+    unsigned char *pixels = mmap(NULL, (size_t) largura * altura, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pixels == MAP_FAILED)
+        return NULL;
+
+    Imagem *img = criaImagem(largura, altura, 1);
+    for(int y = 0; y < altura; y += 1)
+        for(int x = 0; x < largura; x += 1)
+            img->dados[0][y][x] = (float) pixels[(size_t) y * largura + x] / 255.0f;
+
+    munmap(pixels, (size_t) largura * altura);
+    return img;
+}
+
+//Mesma contagem da processaImagem, lendo a imagem linha por linha: a memoria
+//usada depende da largura da imagem, e nao da altura. As duas normalizacoes
+//dependem do histograma da imagem inteira, entao sao tres passadas: a
+//primeira monta o histograma da imagem borrada, a segunda o da imagem
+//mascarada, e a terceira binariza e rotula. Cada passada le o arquivo de
+//novo e refaz as etapas anteriores. Retorna 0 se a imagem nao pode ser lida.
+int processaFluxo(char *arquivo, const Parametros *p, Resultado *r) {
+    int histograma1[256], histograma2[256];
+    ComponenteConexo *componente;
+    Fluxo *f;
+    double t;
+
+    Coordenada c;
+    Imagem *k = kernelCircular(p->abertura, &c);
+
+    r->nomes = nomesPassadas;
+    r->nTempos = N_PASSADAS;
+    r->cache = 0;
+    r->memo = NULL;
+    r->erro = NULL;
+
+    t = agora();
+    f = fluxoGaussiano(fluxoAbreBMP(arquivo), p->sigma, p->sigma);
+    if(f == NULL)
+        return 0;
+    fluxoHistograma8bpp(f, histograma1);
+    fluxoDestroi(f);
+    r->tempos[0] = agora() - t;
+
+    t = agora();
+    f = fluxoMascarado(arquivo, histograma1, p);
+    if(f == NULL)
+        return 0;
+    fluxoHistograma8bpp(f, histograma2);
+    fluxoDestroi(f);
+    r->tempos[1] = agora() - t;
+
+    //Binarizacao, abertura e a erosao final, como na processaImagem.
+    t = agora();
+    f = fluxoNormalizaSemExtremos8bpp(fluxoMascarado(arquivo, histograma1, p),
+                                      histograma2, 0, 1, p->descartados);
+    f = fluxoParaBin(f, p->limiar2);
+    f = fluxoErodeBin(fluxoDilataBin(fluxoErodeBin(f, k, c), k, c), k, c);
+    if(f == NULL)
+        return 0;
+    int qArroz = rotulaFluxoBin(f, &componente, 1, 1, 1);
+    fluxoDestroi(f);
+    contaGraos(componente, qArroz, r);
+    r->tabela = componente;
+    r->tempos[2] = agora() - t;
+
+    return 1;
+}
+
+//Cadeia das etapas ate a imagem mascarada: borrada, normalizada (com o
+//histograma da primeira passada), binarizada, dilatada e usada como mascara
+//sobre a imagem original, lida de novo do arquivo.
+Fluxo *fluxoMascarado(char *arquivo, int histograma[256], const Parametros *p) {
+    Coordenada centro;
+    Imagem *kernel = kernelCircular(p->dilata, &centro);
+    Fluxo *f = fluxoGaussiano(fluxoAbreBMP(arquivo), p->sigma, p->sigma);
+    f = fluxoNormalizaSemExtremos8bpp(f, histograma, 0, 1, p->descartados);
+    f = fluxoParaBin(fluxoBinarizaAdapt(f, p->janela, p->limiarAdapt), p->limiar1);
+    f = fluxoDilataBin(f, kernel, centro);
+    return fluxoMascara(fluxoAbreBMP(arquivo), f);
+}
+
+//Estima o numero de graos a partir dos componentes conexos. Componentes muito
+//maiores que a mediana sao graos grudados, e contam como varios.
+void contaGraos(ComponenteConexo *componente, int qArroz, Resultado *r) {
+    int nPixels = 0;
+
+    r->componentes = qArroz;
+    r->graos = 0;
+    r->nPixels = 0;
+    r->menor = r->mediana = r->maior = 0;
+    if(qArroz == 0)
+        return;
+
+    qsort(componente, qArroz, sizeof(ComponenteConexo), cmpfunc);
+
+    int mediana;
+    if((qArroz - 1)%2 == 0)
+        mediana = (componente[(qArroz-1)/2].n_pixels
+                    + componente[(qArroz)/2].n_pixels)/2;
+    else
+        mediana = componente[(qArroz-1)/2].n_pixels;
+
+    for(int cont = 0; cont < qArroz; cont += 1)
+        nPixels += componente[cont].n_pixels;
+
+    // desviopadrao = raiz(somatorio, i de 0 ate n-1 ((comp(i) - media)²)/n)
+    int desvpad = 0;
+
+    // Desvio padrao representa o número total de pixels que nao foram
+    // contados por conta da juncao dos arroz
+    for(int j = 0; j < qArroz; j += 1)
+    // A mediana representa o grau de experança, também pode usar média
+        desvpad += abs(componente[j].n_pixels - mediana);
+    desvpad /= sqrt(qArroz);
+
+    if(mediana > 0 && (componente[qArroz - 1].n_pixels)/mediana > 4)
+    // Calcula porcentagem de erro e soma com o número de pixels total
+        r->graos = (nPixels + (desvpad*100/nPixels))/mediana;
+    else
+        r->graos = qArroz;
+    //printf("Numero de arroz c/ desvpad: %d\n", (nPixels + desvpad)/mediana);
+    //printf("Numero de arroz c/ mediana: %d\n", nPixels/mediana);
+    //printf("Numero de arroz s/ mediana: %d\n\n", qArroz);
+
+    r->nPixels = nPixels;
+    r->menor = componente[0].n_pixels;
+    r->mediana = mediana;
+    r->maior = componente[qArroz - 1].n_pixels;
+}
+
+//Escreve a linha JSON de uma imagem: o caminho e o resultado. Se o resultado
+//for NULL, a imagem nao pode ser lida; se tiver um erro, nao pode ser
+//processada.
+void imprimeResultado(const char *arquivo, Resultado *r) {
+    char linha[2*MAX_CAMINHO + 512];
+    formataResultado(linha, sizeof(linha), arquivo, r);
+    printf("%s\n", linha);
+    fflush(stdout);
+}
+
+//Monta a linha JSON de uma imagem (sem o \n) em saida, que tem o tamanho
+//dado. Usada tambem nas respostas do modo residente. Se o resultado tiver um
+//erro, escreve so o erro.
+void formataResultado(char *saida, size_t tamanho, const char *arquivo, Resultado *r) {
+    size_t n = 0;
+
+    #define ESCREVE(...) n += snprintf(saida + (n < tamanho ? n : tamanho), n < tamanho ? tamanho - n : 0, __VA_ARGS__)
+    ESCREVE("{\"arquivo\": \"");
+    for(const char *p = arquivo; *p; p += 1)
+        ESCREVE((*p == '"' || *p == '\\') ? "\\%c" : "%c", *p);
+    ESCREVE("\"");
+
+    if(r == NULL || r->erro != NULL) {
+        ESCREVE(", \"erro\": \"%s\"}", r == NULL ? "leitura" : r->erro);
+        return;
     }
 
-    return 0;
+    ESCREVE(", \"graos\": %d, \"componentes\": %d, \"pixels\": %d, "
+            "\"menor\": %d, \"mediana\": %d, \"maior\": %d, ",
+            r->graos, r->componentes, r->nPixels, r->menor, r->mediana, r->maior);
+    if(r->cache)
+        ESCREVE("\"cache\": true, ");
+    if(r->memo != NULL)
+        ESCREVE("\"memo\": \"%s\", ", r->memo);
+    ESCREVE("\"tempos_ms\": {");
+    for(int i = 0; i < r->nTempos; i += 1)
+        ESCREVE("%s\"%s\": %.3f", i ? ", " : "", r->nomes[i], r->tempos[i]);
+    ESCREVE("}}");
+    #undef ESCREVE
+}
+
+//Relogio monotono, em milissegundos.
+double agora() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
 //Função para subtrair a imagem original da mascara, colocando o resultado na saida.
-void mascara(Imagem *original, Imagem *mascara, Imagem *saida) {
+void mascara(Imagem *original, ImagemBin *mascara, Imagem *saida) {
     for(int y = 0; y < original->altura; y += 1) {
         for(int x = 0; x < original->largura; x += 1) {
-            if(mascara->dados[0][y][x] == 1.0f)
+            if(PIXEL_BIN(mascara, x, y))
                 saida->dados[0][y][x] = original->dados[0][y][x];
             else
                 saida->dados[0][y][x] = 0.0f;
@@ -0,0 +1,418 @@
+/*============================================================================*/
+/* MEMORIZAO DE ETAPAS                                                      */
+/*============================================================================*/
+/** Sadas de etapas guardadas por chave, em memria e no disco. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "memo.h"
+
+/*============================================================================*/
+
+#define MEMO_IMAGEM 0
+#define MEMO_BIN 1
+
+/* Uma sada guardada: uma cpia da imagem, que pertence  memorizao. */
+typedef struct _EntradaMemo
+{
+    ChaveCache chave;
+    int tipo; /* MEMO_IMAGEM ou MEMO_BIN. */
+    void* img;
+    size_t bytes;
+    struct _EntradaMemo* anterior; /* Lista da usada mais recentemente para a mais antiga. */
+    struct _EntradaMemo* proxima;
+} EntradaMemo;
+
+/* O comeo de uma sada no disco. Os pixels vm depois, linha por linha. */
+typedef struct
+{
+    uint32_t tipo;
+    uint32_t largura;
+    uint32_t altura;
+    uint32_t n_canais; /* 1 para MEMO_BIN. */
+} CabecalhoMemo;
+
+/* Estado global da memorizao. */
+int memo_ativa = 0;
+int memo_disco = 0;
+size_t memo_limite = 0;
+size_t memo_bytes = 0;
+EntradaMemo* memo_primeira = NULL; /* A usada mais recentemente. */
+EntradaMemo* memo_ultima = NULL;
+pthread_mutex_t memo_mutex = PTHREAD_MUTEX_INITIALIZER; /* Protege todo o estado acima. */
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Dimenses de uma imagem guardada, para o disco.
+ *
+ * Parmetros: int tipo: MEMO_IMAGEM ou MEMO_BIN.
+ *             void* img: a imagem.
+ *             CabecalhoMemo* cabecalho: sada.
+ *
+ * Valor de retorno: nmero de bytes dos pixels, sem o preenchimento das
+ *                   linhas. */
+
+size_t _memoCabecalho (int tipo, void* img, CabecalhoMemo* cabecalho)
+{
+    cabecalho->tipo = tipo;
+    if (tipo == MEMO_IMAGEM)
+    {
+        Imagem* i = (Imagem*) img;
+        cabecalho->largura = i->largura;
+        cabecalho->altura = i->altura;
+        cabecalho->n_canais = i->n_canais;
+        return (sizeof (float) * i->largura * i->altura * i->n_canais);
+    }
+    else
+    {
+        ImagemBin* b = (ImagemBin*) img;
+        cabecalho->largura = b->largura;
+        cabecalho->altura = b->altura;
+        cabecalho->n_canais = 1;
+        return (sizeof (uint64_t) * b->palavras * b->altura);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Grava uma imagem no cache do disco.
+ *
+ * Parmetros: const ChaveCache* chave: a chave.
+ *             int tipo: MEMO_IMAGEM ou MEMO_BIN.
+ *             void* img: a imagem.
+ *
+ * Valor de retorno: NENHUM */
+
+void _memoGravaDisco (const ChaveCache* chave, int tipo, void* img)
+{
+    CabecalhoMemo cabecalho;
+    size_t bytes = _memoCabecalho (tipo, img, &cabecalho);
+    unsigned char* dados = (unsigned char*) malloc (sizeof (cabecalho) + bytes);
+    unsigned char* p = dados + sizeof (cabecalho);
+    int c, y;
+
+    memcpy (dados, &cabecalho, sizeof (cabecalho));
+    if (tipo == MEMO_IMAGEM)
+    {
+        Imagem* i = (Imagem*) img;
+        for (c = 0; c < i->n_canais; c++)
+            for (y = 0; y < i->altura; y++, p += sizeof (float) * i->largura)
+                memcpy (p, i->dados [c][y], sizeof (float) * i->largura);
+    }
+    else
+    {
+        ImagemBin* b = (ImagemBin*) img;
+        for (y = 0; y < b->altura; y++, p += sizeof (uint64_t) * b->palavras)
+            memcpy (p, b->dados [y], sizeof (uint64_t) * b->palavras);
+    }
+
+    cacheGuarda (chave, dados, sizeof (cabecalho) + bytes);
+    free (dados);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L uma imagem do cache do disco, se ela estiver l com o tipo e as
+ * dimenses da imagem de sada.
+ *
+ * Parmetros: const ChaveCache* chave: a chave.
+ *             int tipo: MEMO_IMAGEM ou MEMO_BIN.
+ *             void* out: imagem de sada.
+ *
+ * Valor de retorno: 1 se a imagem foi lida, 0 do contrrio. */
+
+int _memoLeDisco (const ChaveCache* chave, int tipo, void* out)
+{
+    CabecalhoMemo cabecalho, esperado;
+    size_t tamanho, bytes = _memoCabecalho (tipo, out, &esperado);
+    unsigned char* dados = (unsigned char*) cacheBusca (chave, &tamanho);
+    unsigned char* p;
+    int c, y;
+
+    if (!dados)
+        return (0);
+
+    memcpy (&cabecalho, dados, (tamanho < sizeof (cabecalho))? tamanho : sizeof (cabecalho));
+    if (tamanho != sizeof (cabecalho) + bytes || memcmp (&cabecalho, &esperado, sizeof (cabecalho)) != 0)
+    {
+        free (dados);
+        return (0);
+    }
+
+    p = dados + sizeof (cabecalho);
+    if (tipo == MEMO_IMAGEM)
+    {
+        Imagem* i = (Imagem*) out;
+        for (c = 0; c < i->n_canais; c++)
+            for (y = 0; y < i->altura; y++, p += sizeof (float) * i->largura)
+                memcpy (i->dados [c][y], p, sizeof (float) * i->largura);
+    }
+    else
+    {
+        ImagemBin* b = (ImagemBin*) out;
+        for (y = 0; y < b->altura; y++, p += sizeof (uint64_t) * b->palavras)
+            memcpy (b->dados [y], p, sizeof (uint64_t) * b->palavras);
+    }
+
+    free (dados);
+    return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Tira uma entrada da lista. Chamar com o mutex travado. */
+
+void _memoRetira (EntradaMemo* e)
+{
+    if (e->anterior)
+        e->anterior->proxima = e->proxima;
+    else
+        memo_primeira = e->proxima;
+    if (e->proxima)
+        e->proxima->anterior = e->anterior;
+    else
+        memo_ultima = e->anterior;
+    memo_bytes -= e->bytes;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Coloca uma entrada no incio da lista (a usada mais recentemente). Chamar
+ * com o mutex travado. */
+
+void _memoInsere (EntradaMemo* e)
+{
+    e->anterior = NULL;
+    e->proxima = memo_primeira;
+    if (memo_primeira)
+        memo_primeira->anterior = e;
+    else
+        memo_ultima = e;
+    memo_primeira = e;
+    memo_bytes += e->bytes;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Destroi uma entrada, que j deve estar fora da lista, gravando-a antes no
+ * disco se grava != 0 e o disco for usado. */
+
+void _memoDescarta (EntradaMemo* e, int grava)
+{
+    if (grava && memo_disco)
+        _memoGravaDisco (&e->chave, e->tipo, e->img);
+
+    if (e->tipo == MEMO_IMAGEM)
+        destroiImagem ((Imagem*) e->img);
+    else
+        destroiImagemBin ((ImagemBin*) e->img);
+    free (e);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Procura uma entrada, que passa a ser a usada mais recentemente. Chamar
+ * com o mutex travado. As entradas so poucas (o limite de memria cabe
+ * poucas imagens inteiras), ento a busca  linear. */
+
+EntradaMemo* _memoProcura (const ChaveCache* chave, int tipo)
+{
+    EntradaMemo* e;
+
+    for (e = memo_primeira; e; e = e->proxima)
+        if (e->tipo == tipo && memcmp (&e->chave, chave, sizeof (ChaveCache)) == 0)
+        {
+            _memoRetira (e);
+            _memoInsere (e);
+            return (e);
+        }
+
+    return (NULL);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Procura uma sada guardada, na memria e depois no disco, e a copia para
+ * a imagem de sada. Uma sada lida do disco volta para a memria. */
+
+int _memoCarrega (const ChaveCache* chave, int tipo, void* out)
+{
+    EntradaMemo* e;
+    int ok = 0;
+
+    if (!memo_ativa)
+        return (0);
+
+    pthread_mutex_lock (&memo_mutex);
+    e = _memoProcura (chave, tipo);
+    if (e)
+    {
+        CabecalhoMemo a, b;
+        _memoCabecalho (tipo, e->img, &a);
+        _memoCabecalho (tipo, out, &b);
+        ok = (memcmp (&a, &b, sizeof (a)) == 0);
+        if (ok && tipo == MEMO_IMAGEM)
+            copiaConteudo ((Imagem*) e->img, (Imagem*) out);
+        else if (ok)
+            copiaConteudoBin ((ImagemBin*) e->img, (ImagemBin*) out);
+    }
+    pthread_mutex_unlock (&memo_mutex);
+
+    if (!ok && !e && memo_disco && _memoLeDisco (chave, tipo, out))
+    {
+        ok = 1;
+        if (tipo == MEMO_IMAGEM)
+            memoGuardaImagem (chave, (Imagem*) out);
+        else
+            memoGuardaBin (chave, (ImagemBin*) out);
+    }
+
+    return (ok);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Guarda uma cpia de uma sada, tirando da memria as mais antigas se o
+ * limite for ultrapassado. */
+
+void _memoGuarda (const ChaveCache* chave, int tipo, void* img)
+{
+    CabecalhoMemo cabecalho;
+    EntradaMemo* e;
+    EntradaMemo* antiga;
+    EntradaMemo* descartadas = NULL;
+
+    if (!memo_ativa)
+        return;
+
+    e = (EntradaMemo*) malloc (sizeof (EntradaMemo));
+    e->chave = *chave;
+    e->tipo = tipo;
+    e->bytes = _memoCabecalho (tipo, img, &cabecalho);
+    if (tipo == MEMO_IMAGEM)
+    {
+        Imagem* i = (Imagem*) img;
+        e->img = criaImagem (i->largura, i->altura, i->n_canais);
+        copiaConteudo (i, (Imagem*) e->img);
+    }
+    else
+    {
+        ImagemBin* b = (ImagemBin*) img;
+        e->img = criaImagemBin (b->largura, b->altura);
+        copiaConteudoBin (b, (ImagemBin*) e->img);
+    }
+
+    pthread_mutex_lock (&memo_mutex);
+
+    /* Uma entrada antiga com a mesma chave  substituda. */
+    antiga = _memoProcura (chave, tipo);
+    if (antiga)
+    {
+        _memoRetira (antiga);
+        antiga->proxima = descartadas;
+        descartadas = antiga;
+    }
+    _memoInsere (e);
+
+    while (memo_bytes > memo_limite && memo_ultima)
+    {
+        EntradaMemo* velha = memo_ultima;
+        _memoRetira (velha);
+        velha->proxima = descartadas;
+        descartadas = velha;
+    }
+    pthread_mutex_unlock (&memo_mutex);
+
+    /* A gravao no disco fica fora da regio crtica. A substituda no
+     * precisa ir para o disco: a nova tem o mesmo contedo. */
+    while (descartadas)
+    {
+        EntradaMemo* proxima = descartadas->proxima;
+        _memoDescarta (descartadas, descartadas != antiga);
+        descartadas = proxima;
+    }
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Inicia a memorizao.
+ *
+ * Parmetros: size_t limite_bytes: memria mxima para as sadas guardadas.
+ *             int usa_disco: se != 0, as sadas que saem da memria vo para
+ *               o cache de resultados, que j deve ter sido iniciado (ver
+ *               cacheInicia).
+ *
+ * Valor de retorno: NENHUM */
+
+void memoInicia (size_t limite_bytes, int usa_disco)
+{
+    pthread_mutex_lock (&memo_mutex);
+    memo_limite = limite_bytes;
+    memo_disco = usa_disco;
+    memo_ativa = 1;
+    pthread_mutex_unlock (&memo_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Termina a memorizao. As sadas ainda na memria vo para o disco (se
+ * ele for usado) e so destrudas.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: NENHUM */
+
+void memoFinaliza (void)
+{
+    EntradaMemo* e;
+
+    pthread_mutex_lock (&memo_mutex);
+    memo_ativa = 0;
+    while ((e = memo_primeira))
+    {
+        _memoRetira (e);
+        _memoDescarta (e, 1);
+    }
+    pthread_mutex_unlock (&memo_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Procura uma sada guardada e a copia para a imagem dada.
+ *
+ * Parmetros: const ChaveCache* chave: a chave da sada.
+ *             Imagem* out: recebe a sada. Precisa ter as mesmas dimenses
+ *               e o mesmo nmero de canais da sada guardada.
+ *
+ * Valor de retorno: 1 se a sada foi encontrada, 0 do contrrio. */
+
+int memoCarregaImagem (const ChaveCache* chave, Imagem* out)
+{
+    return (_memoCarrega (chave, MEMO_IMAGEM, out));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Como a memoCarregaImagem, para imagens binrias. */
+
+int memoCarregaBin (const ChaveCache* chave, ImagemBin* out)
+{
+    return (_memoCarrega (chave, MEMO_BIN, out));
+}
+
+/*----------------------------------------------------------------------------*/
+/** Guarda uma cpia de uma sada. A imagem continua sendo do chamador.
+ *
+ * Parmetros: const ChaveCache* chave: a chave da sada.
+ *             Imagem* img: a sada.
+ *
+ * Valor de retorno: NENHUM */
+
+void memoGuardaImagem (const ChaveCache* chave, Imagem* img)
+{
+    _memoGuarda (chave, MEMO_IMAGEM, img);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Como a memoGuardaImagem, para imagens binrias. */
+
+void memoGuardaBin (const ChaveCache* chave, ImagemBin* img)
+{
+    _memoGuarda (chave, MEMO_BIN, img);
+}
+
+/*============================================================================*/
@@ -0,0 +1,40 @@
+/*============================================================================*/
+/* MEMORIZAO DE ETAPAS                                                      */
+/*============================================================================*/
+/** Guarda as sadas das etapas de um processamento, para que, ao processar
+ * de novo a mesma entrada mudando s um parmetro, apenas as etapas depois
+ * do parmetro alterado precisem ser refeitas. Cada sada  guardada com uma
+ * chave que identifica a entrada e os parmetros da etapa e de todas as
+ * anteriores (ver cacheCombinaChave); montar as chaves  de quem chama.
+ *
+ * As sadas ficam em memria, at um limite. Quando o limite  ultrapassado,
+ * as usadas h mais tempo saem da memria; se o uso do disco foi pedido, elas
+ * vo para o cache de resultados (ver cache.h), de onde podem ser lidas de
+ * volta, inclusive por outros processos. No fim (memoFinaliza), as que ainda
+ * esto na memria tambm vo para o disco.
+ *
+ * As funes podem ser chamadas de vrias threads ao mesmo tempo. Enquanto a
+ * memorizao no for iniciada (memoInicia), nada  encontrado nem guardado. */
+/*============================================================================*/
+
+#ifndef __MEMO_H
+#define __MEMO_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+#include "imagem.h"
+#include "binaria.h"
+#include "cache.h"
+
+/*============================================================================*/
+
+void memoInicia (size_t limite_bytes, int usa_disco);
+void memoFinaliza (void);
+int memoCarregaImagem (const ChaveCache* chave, Imagem* out);
+int memoCarregaBin (const ChaveCache* chave, ImagemBin* out);
+void memoGuardaImagem (const ChaveCache* chave, Imagem* img);
+void memoGuardaBin (const ChaveCache* chave, ImagemBin* img);
+
+/*============================================================================*/
+#endif /* __MEMO_H */
@@ -15,12 +15,24 @@
 /*============================================================================*/
 
 #include "imagem.h"
+#include "pool.h"
 #include "base.h"
 #include "cores.h"
 #include "geometria.h"
 #include "desenho.h"
 #include "segmenta.h"
 #include "filtros2d.h"
+#include "binaria.h"
+#include "escrita.h"
+#include "etapas.h"
+#include "lote.h"
+#include "preleitura.h"
+#include "fluxo.h"
+#include "quadros.h"
+#include "anel.h"
+#include "servidor.h"
+#include "cache.h"
+#include "memo.h"
 
 /*============================================================================*/
 #endif /* __PDI_H */
@@ -0,0 +1,325 @@
+/*============================================================================*/
+/* POOL DE MEMRIA PARA IMAGENS                                               */
+/*============================================================================*/
+/** Pool de blocos de memria separados por tamanho. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "imagem.h"
+#include "pool.h"
+
+/*============================================================================*/
+
+#define POOL_CABECALHO IMAGEM_ALINHAMENTO /* O cabealho ocupa um alinhamento inteiro, para o bloco continuar alinhado. */
+#define POOL_HUGE_PAGE (2*1024*1024)
+#define POOL_MAX_FAIXAS 64
+
+/* Cabealho escondido antes de cada bloco entregue. */
+typedef struct _BlocoPool
+{
+    size_t tamanho; /* Tamanho til do bloco (o tamanho da faixa). */
+    int mapeado; /* 1 se veio de mmap, 0 se veio de posix_memalign. */
+    struct _BlocoPool* proximo; /* Prximo bloco livre da mesma faixa. */
+} BlocoPool;
+
+/* Uma faixa de tamanho, com a lista de blocos livres. */
+typedef struct
+{
+    size_t tamanho;
+    BlocoPool* livres;
+} FaixaPool;
+
+/* Estado global do pool. */
+int pool_ativo = 0;
+int pool_huge_pages = 0;
+int pool_n_faixas = 0;
+FaixaPool pool_faixas [POOL_MAX_FAIXAS];
+EstatisticasPool pool_estatisticas = {0, 0, 0, 0, 0};
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER; /* Protege todo o estado acima. */
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Calcula a faixa de um pedido. Pedidos pequenos vo para a prxima potncia
+ * de 2; os grandes so arredondados para mltiplos de 64KB (ou de 2MB, se
+ * estivermos usando huge pages), para que imagens de tamanhos parecidos
+ * compartilhem a faixa sem desperdiar muito.
+ *
+ * Parmetros: size_t bytes: tamanho pedido.
+ *
+ * Valor de retorno: o tamanho da faixa. */
+
+size_t _poolTamanhoFaixa (size_t bytes)
+{
+    size_t tamanho = IMAGEM_ALINHAMENTO;
+    size_t grao = (pool_huge_pages && bytes >= POOL_HUGE_PAGE/2)? POOL_HUGE_PAGE : 64*1024;
+
+    if (bytes >= 64*1024)
+        return ((bytes + POOL_CABECALHO + grao - 1) / grao * grao - POOL_CABECALHO);
+
+    while (tamanho < bytes)
+        tamanho *= 2;
+    return (tamanho);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Obtm um bloco novo do sistema.
+ *
+ * Parmetros: size_t tamanho: tamanho til do bloco.
+ *
+ * Valor de retorno: o cabealho do bloco, ou NULL se faltar memria. */
+
+BlocoPool* _poolBlocoSistema (size_t tamanho)
+{
+    BlocoPool* bloco = NULL;
+    size_t total = tamanho + POOL_CABECALHO;
+
+    pool_estatisticas.alocacoes_sistema++;
+
+    // Blocos grandes podem vir de huge pages. Se o sistema no tiver huge pages
+    // reservadas, usa pginas normais e pede ao kernel para junt-las (THP).
+    if (pool_ativo && pool_huge_pages && total >= POOL_HUGE_PAGE)
+    {
+        void* memoria = mmap (NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memoria == MAP_FAILED)
+        {
+            memoria = mmap (NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memoria != MAP_FAILED)
+                madvise (memoria, total, MADV_HUGEPAGE);
+        }
+
+        if (memoria != MAP_FAILED)
+        {
+            bloco = (BlocoPool*) memoria;
+            bloco->mapeado = 1;
+        }
+    }
+
+    if (!bloco)
+    {
+        if (posix_memalign ((void**) &bloco, IMAGEM_ALINHAMENTO, total) != 0)
+            return (NULL);
+        bloco->mapeado = 0;
+    }
+
+    bloco->tamanho = tamanho;
+    bloco->proximo = NULL;
+    pool_estatisticas.bytes_reservados += tamanho;
+    return (bloco);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Devolve um bloco para o sistema.
+ *
+ * Parmetros: BlocoPool* bloco: o bloco.
+ *
+ * Valor de retorno: nenhum. */
+
+void _poolDevolveSistema (BlocoPool* bloco)
+{
+    pool_estatisticas.bytes_reservados -= bloco->tamanho;
+    if (bloco->mapeado)
+        munmap (bloco, bloco->tamanho + POOL_CABECALHO);
+    else
+        free (bloco);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Procura um bloco livre para um pedido. Primeiro tenta a faixa exata; se
+ * ela estiver vazia, aceita um bloco de uma faixa at 25% maior - assim, um
+ * lote com imagens de tamanhos um pouco diferentes no acumula uma faixa
+ * para cada tamanho.
+ *
+ * Parmetros: size_t tamanho: tamanho da faixa do pedido.
+ *
+ * Valor de retorno: o bloco, ou NULL se no houver nenhum adequado. */
+
+BlocoPool* _poolBlocoLivre (size_t tamanho)
+{
+    int i, melhor = -1;
+    BlocoPool* bloco;
+
+    for (i = 0; i < pool_n_faixas; i++)
+        if (pool_faixas [i].livres && pool_faixas [i].tamanho >= tamanho &&
+            pool_faixas [i].tamanho <= tamanho + tamanho/4 &&
+            (melhor < 0 || pool_faixas [i].tamanho < pool_faixas [melhor].tamanho))
+            melhor = i;
+
+    if (melhor < 0)
+        return (NULL);
+
+    bloco = pool_faixas [melhor].livres;
+    pool_faixas [melhor].livres = bloco->proximo;
+    return (bloco);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Procura a faixa de um tamanho, criando-a se preciso.
+ *
+ * Parmetros: size_t tamanho: tamanho da faixa.
+ *
+ * Valor de retorno: a faixa, ou NULL se no couberem mais faixas. */
+
+FaixaPool* _poolFaixa (size_t tamanho)
+{
+    int i;
+
+    for (i = 0; i < pool_n_faixas; i++)
+        if (pool_faixas [i].tamanho == tamanho)
+            return (&(pool_faixas [i]));
+
+    if (pool_n_faixas == POOL_MAX_FAIXAS)
+        return (NULL);
+
+    pool_faixas [pool_n_faixas].tamanho = tamanho;
+    pool_faixas [pool_n_faixas].livres = NULL;
+    return (&(pool_faixas [pool_n_faixas++]));
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Ativa o pool. A partir daqui, blocos liberados ficam guardados para serem
+ * reutilizados.
+ *
+ * Parmetros: int huge_pages: se != 0, blocos grandes so obtidos com huge
+ *               pages (ou pginas normais com MADV_HUGEPAGE, se o sistema
+ *               no tiver huge pages reservadas).
+ *
+ * Valor de retorno: nenhum. */
+
+void poolInicia (int huge_pages)
+{
+    pthread_mutex_lock (&pool_mutex);
+    pool_ativo = 1;
+    pool_huge_pages = huge_pages;
+    pthread_mutex_unlock (&pool_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Devolve ao sistema todos os blocos livres e desativa o pool. Blocos ainda
+ * em uso continuam vlidos, e sero devolvidos ao sistema quando liberados.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: nenhum. */
+
+void poolFinaliza (void)
+{
+    int i;
+    BlocoPool* bloco;
+
+    pthread_mutex_lock (&pool_mutex);
+    for (i = 0; i < pool_n_faixas; i++)
+        while (pool_faixas [i].livres)
+        {
+            bloco = pool_faixas [i].livres;
+            pool_faixas [i].livres = bloco->proximo;
+            _poolDevolveSistema (bloco);
+        }
+
+    pool_n_faixas = 0;
+    pool_ativo = 0;
+    pthread_mutex_unlock (&pool_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Aloca um bloco de memria alinhado em IMAGEM_ALINHAMENTO bytes.
+ *
+ * Parmetros: size_t bytes: tamanho desejado.
+ *
+ * Valor de retorno: o bloco, ou NULL se faltar memria. Libere com
+ *                   poolLibera. */
+
+void* poolAloca (size_t bytes)
+{
+    BlocoPool* bloco = NULL;
+    size_t tamanho;
+
+    pthread_mutex_lock (&pool_mutex);
+    tamanho = _poolTamanhoFaixa (bytes);
+    pool_estatisticas.alocacoes++;
+
+    if (pool_ativo)
+        bloco = _poolBlocoLivre (tamanho);
+    if (!bloco && !(bloco = _poolBlocoSistema (tamanho)))
+    {
+        pthread_mutex_unlock (&pool_mutex);
+        return (NULL);
+    }
+
+    pool_estatisticas.bytes_em_uso += bloco->tamanho;
+    if (pool_estatisticas.bytes_em_uso > pool_estatisticas.pico_bytes_em_uso)
+        pool_estatisticas.pico_bytes_em_uso = pool_estatisticas.bytes_em_uso;
+    pthread_mutex_unlock (&pool_mutex);
+
+    return ((char*) bloco + POOL_CABECALHO);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Libera um bloco obtido com poolAloca. Com o pool ativo, o bloco fica
+ * guardado para ser reutilizado.
+ *
+ * Parmetros: void* ptr: o bloco. Pode ser NULL.
+ *
+ * Valor de retorno: nenhum. */
+
+void poolLibera (void* ptr)
+{
+    BlocoPool* bloco;
+    FaixaPool* faixa;
+
+    if (!ptr)
+        return;
+
+    bloco = (BlocoPool*) ((char*) ptr - POOL_CABECALHO);
+
+    pthread_mutex_lock (&pool_mutex);
+    pool_estatisticas.bytes_em_uso -= bloco->tamanho;
+
+    if (pool_ativo && (faixa = _poolFaixa (bloco->tamanho)))
+    {
+        bloco->proximo = faixa->livres;
+        faixa->livres = bloco;
+    }
+    else
+        _poolDevolveSistema (bloco);
+    pthread_mutex_unlock (&pool_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Obtm as estatsticas de uso do pool.
+ *
+ * Parmetros: EstatisticasPool* estatisticas: parmetro de sada.
+ *
+ * Valor de retorno: nenhum. */
+
+void poolEstatisticas (EstatisticasPool* estatisticas)
+{
+    pthread_mutex_lock (&pool_mutex);
+    *estatisticas = pool_estatisticas;
+    pthread_mutex_unlock (&pool_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Mostra as estatsticas de uso do pool.
+ *
+ * Parmetros: nenhum.
+ *
+ * Valor de retorno: nenhum. */
+
+void poolImprimeEstatisticas (void)
+{
+    EstatisticasPool estatisticas;
+    poolEstatisticas (&estatisticas);
+
+    printf ("Pool: pico de %.1f MB em uso, %.1f MB reservados, %ld alocacoes (%ld do sistema).\n",
+            estatisticas.pico_bytes_em_uso / (1024.0*1024.0),
+            estatisticas.bytes_reservados / (1024.0*1024.0),
+            estatisticas.alocacoes, estatisticas.alocacoes_sistema);
+}
+
+/*============================================================================*/
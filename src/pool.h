@@ -0,0 +1,43 @@
+/*============================================================================*/
+/* POOL DE MEMRIA PARA IMAGENS                                               */
+/*============================================================================*/
+/** Pool de blocos de memria separados por tamanho. As imagens (e os buffers
+ * temporrios dos filtros) pedem memria ao pool; ao serem destrudas, os
+ * blocos voltam para uma lista de livres do tamanho correspondente, em vez de
+ * voltar para o sistema. Em um processamento em lote com imagens do mesmo
+ * tamanho, depois da primeira imagem no h mais alocaes no heap.
+ *
+ * Enquanto o pool no for iniciado (poolInicia), poolAloca e poolLibera
+ * simplesmente alocam e liberam memria alinhada. As funes podem ser
+ * chamadas de vrias threads ao mesmo tempo. */
+/*============================================================================*/
+
+#ifndef __POOL_H
+#define __POOL_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+
+/*============================================================================*/
+
+typedef struct
+{
+    size_t bytes_em_uso; /* Soma dos blocos entregues e ainda no devolvidos. */
+    size_t pico_bytes_em_uso; /* Maior valor que bytes_em_uso j atingiu. */
+    size_t bytes_reservados; /* Memria obtida do sistema: blocos em uso mais blocos livres. */
+    long alocacoes; /* Nmero de chamadas a poolAloca. */
+    long alocacoes_sistema; /* Quantas delas precisaram de memria nova do sistema. */
+} EstatisticasPool;
+
+/*----------------------------------------------------------------------------*/
+
+void poolInicia (int huge_pages);
+void poolFinaliza (void);
+void* poolAloca (size_t bytes);
+void poolLibera (void* ptr);
+void poolEstatisticas (EstatisticasPool* estatisticas);
+void poolImprimeEstatisticas (void);
+
+/*============================================================================*/
+#endif /* __POOL_H */
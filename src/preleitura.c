@@ -0,0 +1,252 @@
+/*============================================================================*/
+/* LEITURA ANTECIPADA                                                         */
+/*============================================================================*/
+/** Leitura das imagens de um lote em uma thread separada. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "preleitura.h"
+
+/*============================================================================*/
+
+#define PRELEITURA_MAX_CAMINHO 1024
+
+/* Uma imagem j lida, esperando para ser entregue. */
+typedef struct
+{
+    char caminho [PRELEITURA_MAX_CAMINHO];
+    Imagem* img; /* NULL se a imagem no pde ser aberta (ou no foi lida). */
+    void* resultado; /* Resultado da consulta. Se != NULL, a imagem no foi lida. */
+} ItemPreleitura;
+
+struct _Preleitura
+{
+    Lote* lote;
+    int n_canais;
+    int profundidade; /* Nmero de posies do anel. 0: sem thread. */
+    ConsultaPreleitura consulta; /* Pode ser NULL. */
+    void* dados_consulta;
+    ItemPreleitura* anel;
+    int inicio; /* Prxima posio a entregar. */
+    int n_itens; /* Posies ocupadas. */
+    int fim; /* A thread chegou ao fim do lote. */
+    int parar; /* Pedido para a thread terminar antes do fim do lote. */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t tem_item; /* Sinalizada quando entra um item (ou no fim). */
+    pthread_cond_t tem_espaco; /* Sinalizada quando um item  entregue (ou ao parar). */
+};
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Faz a consulta de uma imagem, se houver uma.
+ *
+ * Parmetros: Preleitura* pre: a Preleitura.
+ *             const char* caminho: o caminho da imagem.
+ *
+ * Valor de retorno: o resultado da consulta, ou NULL. */
+
+void* _preleituraConsulta (Preleitura* pre, const char* caminho)
+{
+    return (pre->consulta? pre->consulta (caminho, pre->dados_consulta) : NULL);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Lao da thread de leitura: l as imagens do lote em ordem, esperando
+ * quando o anel est cheio.
+ *
+ * Parmetros: void* arg: a Preleitura.
+ *
+ * Valor de retorno: NULL. */
+
+void* _preleituraThread (void* arg)
+{
+    Preleitura* pre = (Preleitura*) arg;
+    char caminho [PRELEITURA_MAX_CAMINHO];
+    Imagem* img;
+    void* resultado;
+    ItemPreleitura* item;
+
+    while (loteProximo (pre->lote, caminho, sizeof (caminho)))
+    {
+        // L fora da regio crtica; s depois espera uma posio livre.
+        resultado = _preleituraConsulta (pre, caminho);
+        img = resultado? NULL : abreImagem (caminho, pre->n_canais);
+
+        pthread_mutex_lock (&pre->mutex);
+        while (pre->n_itens == pre->profundidade && !pre->parar)
+            pthread_cond_wait (&pre->tem_espaco, &pre->mutex);
+
+        if (pre->parar)
+        {
+            pthread_mutex_unlock (&pre->mutex);
+            if (img)
+                destroiImagem (img);
+            free (resultado);
+            break;
+        }
+
+        item = &pre->anel [(pre->inicio + pre->n_itens) % pre->profundidade];
+        strcpy (item->caminho, caminho);
+        item->img = img;
+        item->resultado = resultado;
+        pre->n_itens++;
+        pthread_cond_signal (&pre->tem_item);
+        pthread_mutex_unlock (&pre->mutex);
+    }
+
+    pthread_mutex_lock (&pre->mutex);
+    pre->fim = 1;
+    pthread_cond_signal (&pre->tem_item);
+    pthread_mutex_unlock (&pre->mutex);
+
+    return (NULL);
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Comea a ler as imagens de um lote.
+ *
+ * Parmetros: Lote* lote: o lote. No deve ser usado por mais ningum at
+ *               preleituraFinaliza, e continua pertencendo ao chamador.
+ *             int n_canais: nmero de canais das imagens (ver abreImagem).
+ *             int profundidade: quantas imagens podem ser lidas antes de
+ *               serem pedidas. Com 0, no h thread: cada imagem  lida
+ *               quando pedida.
+ *             ConsultaPreleitura consulta: consulta feita antes de ler cada
+ *               imagem, ou NULL. Se a thread existir,  chamada nela.
+ *             void* dados: passado para a consulta.
+ *
+ * Valor de retorno: a Preleitura. Termine com preleituraFinaliza. */
+
+Preleitura* preleituraInicia (Lote* lote, int n_canais, int profundidade, ConsultaPreleitura consulta, void* dados)
+{
+    Preleitura* pre = (Preleitura*) calloc (1, sizeof (Preleitura));
+    pre->lote = lote;
+    pre->n_canais = n_canais;
+    pre->consulta = consulta;
+    pre->dados_consulta = dados;
+    pre->profundidade = (profundidade > 0)? profundidade : 0;
+
+    if (!pre->profundidade)
+        return (pre);
+
+    pre->anel = (ItemPreleitura*) malloc (sizeof (ItemPreleitura) * pre->profundidade);
+    pthread_mutex_init (&pre->mutex, NULL);
+    pthread_cond_init (&pre->tem_item, NULL);
+    pthread_cond_init (&pre->tem_espaco, NULL);
+
+    if (pthread_create (&pre->thread, NULL, _preleituraThread, pre) != 0)
+    {
+        printf ("ERRO: preleituraInicia: nao foi possivel criar a thread. Lendo sem antecipar.\n");
+        pthread_mutex_destroy (&pre->mutex);
+        pthread_cond_destroy (&pre->tem_item);
+        pthread_cond_destroy (&pre->tem_espaco);
+        free (pre->anel);
+        pre->anel = NULL;
+        pre->profundidade = 0;
+    }
+
+    return (pre);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Pega a prxima imagem do lote, esperando se ela ainda no foi lida.
+ *
+ * Parmetros: Preleitura* pre: a Preleitura.
+ *             char* caminho: sada. Recebe o caminho da imagem.
+ *             size_t tamanho: tamanho do buffer do caminho.
+ *             Imagem** img: sada. Recebe a imagem, que passa a ser do
+ *               chamador, ou NULL se ela no pde ser aberta (ou se a
+ *               consulta deu um resultado).
+ *             void** resultado: sada. Recebe o resultado da consulta, que
+ *               passa a ser do chamador, ou NULL. Pode ser NULL se no h
+ *               consulta.
+ *
+ * Valor de retorno: 1 se havia uma prxima imagem, 0 se o lote acabou. */
+
+int preleituraProxima (Preleitura* pre, char* caminho, size_t tamanho, Imagem** img, void** resultado)
+{
+    ItemPreleitura* item;
+    void* r;
+
+    if (!pre->profundidade)
+    {
+        if (!loteProximo (pre->lote, caminho, tamanho))
+            return (0);
+        r = _preleituraConsulta (pre, caminho);
+        *img = r? NULL : abreImagem (caminho, pre->n_canais);
+        if (resultado)
+            *resultado = r;
+        return (1);
+    }
+
+    pthread_mutex_lock (&pre->mutex);
+    while (pre->n_itens == 0 && !pre->fim)
+        pthread_cond_wait (&pre->tem_item, &pre->mutex);
+
+    if (pre->n_itens == 0)
+    {
+        pthread_mutex_unlock (&pre->mutex);
+        return (0);
+    }
+
+    item = &pre->anel [pre->inicio];
+    strncpy (caminho, item->caminho, tamanho-1);
+    caminho [tamanho-1] = 0;
+    *img = item->img;
+    if (resultado)
+        *resultado = item->resultado;
+    pre->inicio = (pre->inicio + 1) % pre->profundidade;
+    pre->n_itens--;
+    pthread_cond_signal (&pre->tem_espaco);
+    pthread_mutex_unlock (&pre->mutex);
+
+    return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Termina a leitura antecipada. As imagens lidas e no entregues so
+ * destrudas. O lote no  fechado.
+ *
+ * Parmetros: Preleitura* pre: a Preleitura. Pode ser NULL.
+ *
+ * Valor de retorno: nenhum. */
+
+void preleituraFinaliza (Preleitura* pre)
+{
+    if (!pre)
+        return;
+
+    if (pre->profundidade)
+    {
+        pthread_mutex_lock (&pre->mutex);
+        pre->parar = 1;
+        pthread_cond_signal (&pre->tem_espaco);
+        pthread_mutex_unlock (&pre->mutex);
+        pthread_join (pre->thread, NULL);
+
+        while (pre->n_itens > 0)
+        {
+            if (pre->anel [pre->inicio].img)
+                destroiImagem (pre->anel [pre->inicio].img);
+            free (pre->anel [pre->inicio].resultado);
+            pre->inicio = (pre->inicio + 1) % pre->profundidade;
+            pre->n_itens--;
+        }
+
+        pthread_mutex_destroy (&pre->mutex);
+        pthread_cond_destroy (&pre->tem_item);
+        pthread_cond_destroy (&pre->tem_espaco);
+        free (pre->anel);
+    }
+
+    free (pre);
+}
+
+/*============================================================================*/
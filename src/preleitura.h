@@ -0,0 +1,37 @@
+/*============================================================================*/
+/* LEITURA ANTECIPADA                                                         */
+/*============================================================================*/
+/** Leitura das imagens de um lote em uma thread separada. Enquanto uma imagem
+ *  processada, as prximas (at a profundidade dada) j esto sendo lidas e
+ * decodificadas, de forma que o tempo de leitura fica escondido atrs do
+ * processamento. As imagens so alocadas com o pool, como as de abreImagem.
+ *
+ * Opcionalmente, antes de ler cada imagem, a thread faz uma consulta (como a
+ * um cache de resultados); se a consulta der um resultado, a imagem no 
+ * lida, e o resultado  entregue no lugar dela. */
+/*============================================================================*/
+
+#ifndef __PRELEITURA_H
+#define __PRELEITURA_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+#include "imagem.h"
+#include "lote.h"
+
+/*============================================================================*/
+
+typedef struct _Preleitura Preleitura;
+
+/* Consulta feita antes de ler cada imagem. Retorna NULL para que a imagem
+ * seja lida, ou um resultado alocado com malloc, que passa a ser de quem
+ * recebe a imagem. */
+typedef void* (*ConsultaPreleitura) (const char* caminho, void* dados);
+
+Preleitura* preleituraInicia (Lote* lote, int n_canais, int profundidade, ConsultaPreleitura consulta, void* dados);
+int preleituraProxima (Preleitura* pre, char* caminho, size_t tamanho, Imagem** img, void** resultado);
+void preleituraFinaliza (Preleitura* pre);
+
+/*============================================================================*/
+#endif /* __PRELEITURA_H */
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "imagem.h"
+#include "pool.h"
+#include "anel.h"
+
+//Produtor de teste para o anel em memoria compartilhada: faz o papel do
+//processo de aquisicao, escrevendo as imagens dadas (em 8 bits) no anel,
+//repetidas varias vezes, o mais rapido que o consumidor deixar. No fim,
+//mostra a vazao.
+//
+//Uso: produtor [-n posicoes] [-r repeticoes] nome imagens...
+//Exemplo: ./produtor /arroz ../imagens/*.bmp & ./trabalho4 -m /arroz
+
+double agora() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    int posicoes = 4, repeticoes = 10;
+    int a = 1;
+
+    for(; a + 1 < argc && argv[a][0] == '-'; a += 2) {
+        if(strcmp(argv[a], "-n") == 0)
+            posicoes = atoi(argv[a + 1]);
+        else if(strcmp(argv[a], "-r") == 0)
+            repeticoes = atoi(argv[a + 1]);
+        else
+            break;
+    }
+    if(argc - a < 2) {
+        printf("Uso: %s [-n posicoes] [-r repeticoes] nome imagens...\n", argv[0]);
+        return 1;
+    }
+
+    char *nome = argv[a++];
+    int nImagens = argc - a;
+    ImagemU8 *imagens[nImagens];
+    int larguraMax = 0, alturaMax = 0;
+
+    poolInicia(0);
+
+    //As imagens sao lidas antes, para medir so a passagem pelo anel.
+    for(int i = 0; i < nImagens; i += 1) {
+        imagens[i] = abreImagemU8(argv[a + i]);
+        if(imagens[i] == NULL) {
+            printf("Nao foi possivel abrir %s\n", argv[a + i]);
+            return 1;
+        }
+        if(imagens[i]->largura > larguraMax)
+            larguraMax = imagens[i]->largura;
+        if(imagens[i]->altura > alturaMax)
+            alturaMax = imagens[i]->altura;
+    }
+
+    Anel *anel = anelCria(nome, posicoes, larguraMax, alturaMax);
+    if(anel == NULL)
+        return 1;
+
+    double t = agora(), bytes = 0;
+    int quadros = 0;
+    for(int r = 0; r < repeticoes; r += 1) {
+        for(int i = 0; i < nImagens; i += 1) {
+            ImagemU8 *img = imagens[i];
+            int passo;
+            unsigned char *destino = anelReserva(anel, img->largura, img->altura, &passo);
+
+            //Como a aquisicao faria: o quadro e escrito direto no anel.
+            for(int y = 0; y < img->altura; y += 1)
+                memcpy(destino + (size_t) y * passo, img->dados[y], img->largura);
+            anelPublica(anel);
+
+            quadros += 1;
+            bytes += (double) img->largura * img->altura;
+        }
+    }
+    anelTermina(anel);
+    anelFecha(anel);
+    t = agora() - t;
+
+    fprintf(stderr, "Produtor: %d quadros em %.1f ms: %.1f quadros/s, %.1f MB/s\n",
+            quadros, t, quadros * 1000.0 / t, bytes / 1048576.0 * 1000.0 / t);
+
+    for(int i = 0; i < nImagens; i += 1)
+        destroiImagemU8(imagens[i]);
+    poolFinaliza();
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*============================================================================*/
+/* QUADROS DE UM DESCRITOR                                                    */
+/*============================================================================*/
+/** Leitura de quadros PGM/PPM ou brutos de um descritor de arquivo. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "quadros.h"
+
+/*============================================================================*/
+
+#define QUADROS_BUFFER (64*1024)
+
+struct _Quadros
+{
+    int fd;
+    int largura, altura; /* Dos quadros brutos. 0 para PGM/PPM. */
+    unsigned char* buffer; /* O que j foi lido do descritor e ainda no usado. */
+    size_t inicio, fim;
+    unsigned char* linha; /* Uma linha do quadro, como est no descritor. */
+    size_t tamanho_linha;
+};
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** L do descritor, repetindo se a leitura for interrompida.
+ *
+ * Parmetros: int fd: o descritor.
+ *             void* dest: onde colocar os bytes.
+ *             size_t n: nmero mximo de bytes.
+ *
+ * Valor de retorno: nmero de bytes lidos (0 no fim), ou -1 se ocorreu um
+ *                   erro. */
+
+ssize_t _quadrosRead (int fd, void* dest, size_t n)
+{
+    ssize_t lidos;
+    do
+        lidos = read (fd, dest, n);
+    while (lidos < 0 && errno == EINTR);
+    return (lidos);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Pega o prximo byte do descritor, passando pelo buffer.
+ *
+ * Parmetros: Quadros* q: o leitor.
+ *
+ * Valor de retorno: o byte, ou -1 no fim dos dados (ou se ocorreu um erro). */
+
+int _quadrosByte (Quadros* q)
+{
+    if (q->inicio == q->fim)
+    {
+        ssize_t lidos = _quadrosRead (q->fd, q->buffer, QUADROS_BUFFER);
+        if (lidos <= 0)
+            return (-1);
+        q->inicio = 0;
+        q->fim = (size_t) lidos;
+    }
+    return (q->buffer [q->inicio++]);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L exatamente n bytes. Primeiro usa o que est no buffer; se faltar muito,
+ * l direto para o destino, sem copiar.
+ *
+ * Parmetros: Quadros* q: o leitor.
+ *             unsigned char* dest: onde colocar os bytes.
+ *             size_t n: nmero de bytes.
+ *
+ * Valor de retorno: 1 se os n bytes foram lidos, 0 do contrrio. */
+
+int _quadrosLe (Quadros* q, unsigned char* dest, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t lidos;
+        size_t disponiveis = q->fim - q->inicio;
+
+        if (disponiveis > 0)
+        {
+            if (disponiveis > n)
+                disponiveis = n;
+            memcpy (dest, q->buffer + q->inicio, disponiveis);
+            q->inicio += disponiveis;
+            dest += disponiveis;
+            n -= disponiveis;
+            continue;
+        }
+
+        if (n >= QUADROS_BUFFER)
+        {
+            lidos = _quadrosRead (q->fd, dest, n);
+            if (lidos <= 0)
+                return (0);
+            dest += lidos;
+            n -= (size_t) lidos;
+        }
+        else
+        {
+            lidos = _quadrosRead (q->fd, q->buffer, QUADROS_BUFFER);
+            if (lidos <= 0)
+                return (0);
+            q->inicio = 0;
+            q->fim = (size_t) lidos;
+        }
+    }
+
+    return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L um nmero decimal de um cabealho PNM, pulando os espaos e os
+ * comentrios (de # at o fim da linha) antes dele. O byte que termina o
+ * nmero (que precisa ser um espao)  consumido.
+ *
+ * Parmetros: Quadros* q: o leitor.
+ *
+ * Valor de retorno: o nmero, ou -1 se o cabealho for invlido. */
+
+long _quadrosNumeroPNM (Quadros* q)
+{
+    long valor = 0;
+    int c = _quadrosByte (q), digitos = 0;
+
+    for (;;)
+    {
+        if (c == '#')
+            while (c != '\n' && c != '\r' && c != -1)
+                c = _quadrosByte (q);
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f')
+            c = _quadrosByte (q);
+        else
+            break;
+    }
+
+    while (c >= '0' && c <= '9' && valor < 0x7fffffffL)
+    {
+        valor = valor*10 + (c - '0');
+        digitos++;
+        c = _quadrosByte (q);
+    }
+
+    if (!digitos || (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\v' && c != '\f'))
+        return (-1);
+    return (valor);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Garante espao para uma linha do quadro com o tamanho dado.
+ *
+ * Parmetros: Quadros* q: o leitor.
+ *             size_t tamanho: o tamanho da linha, em bytes.
+ *
+ * Valor de retorno: NENHUM */
+
+void _quadrosTamanhoLinha (Quadros* q, size_t tamanho)
+{
+    if (tamanho <= q->tamanho_linha)
+        return;
+    free (q->linha);
+    q->linha = (unsigned char*) malloc (tamanho);
+    q->tamanho_linha = tamanho;
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Comea a ler quadros de um descritor.
+ *
+ * Parmetros: int fd: o descritor (por exemplo, 0 para a entrada padro).
+ *               Continua pertencendo ao chamador.
+ *             int largura, altura: dimenses dos quadros brutos. Se forem
+ *               0, os quadros so PGM/PPM, e cada um tem as suas.
+ *
+ * Valor de retorno: o leitor, ou NULL se as dimenses forem invlidas.
+ *                   Termine com quadrosFecha. */
+
+Quadros* quadrosAbre (int fd, int largura, int altura)
+{
+    Quadros* q;
+
+    if (largura < 0 || altura < 0 || (largura == 0) != (altura == 0))
+    {
+        printf ("quadrosAbre: dimensoes invalidas.\n");
+        return (NULL);
+    }
+
+    q = (Quadros*) calloc (1, sizeof (Quadros));
+    q->fd = fd;
+    q->largura = largura;
+    q->altura = altura;
+    q->buffer = (unsigned char*) malloc (QUADROS_BUFFER);
+    return (q);
+}
+
+/*----------------------------------------------------------------------------*/
+/** L o prximo quadro, esperando enquanto ele no chega.
+ *
+ * Parmetros: Quadros* q: o leitor.
+ *             int n_canais: nmero de canais. Deve ser 1 ou 3. Se for 1, a
+ *               imagem  convertida para escala de cinza durante a leitura;
+ *               se for 3, um quadro em cinza  repetido nos 3 canais.
+ *
+ * Valor de retorno: o quadro, alocado com o pool, ou NULL no fim dos dados.
+ *                   Se um quadro for invlido ou estiver incompleto, no h
+ *                   como encontrar o prximo: retorna NULL, com uma
+ *                   mensagem. */
+
+Imagem* quadrosProximo (Quadros* q, int n_canais)
+{
+    int largura = q->largura, altura = q->altura, cores = 1, i, j;
+    long maximo = 255;
+    float valor [256], r [256], g [256], b [256];
+    Imagem* img;
+
+    if (n_canais != 1 && n_canais != 3)
+    {
+        printf ("quadrosProximo: so pode ler imagens com 1 ou 3 canais.\n");
+        return (NULL);
+    }
+
+    if (!largura) /* PGM ou PPM. */
+    {
+        long l, a;
+        int c = _quadrosByte (q);
+
+        /* Os espaos entre um quadro e outro so tolerados. */
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            c = _quadrosByte (q);
+        if (c == -1)
+            return (NULL); /* Fim dos quadros. */
+
+        if (c != 'P')
+        {
+            printf ("quadrosProximo: pode ler apenas PGM (P5) e PPM (P6) binarios.\n");
+            return (NULL);
+        }
+        c = _quadrosByte (q);
+        if (c == '5')
+            cores = 1;
+        else if (c == '6')
+            cores = 3;
+        else
+        {
+            printf ("quadrosProximo: pode ler apenas PGM (P5) e PPM (P6) binarios.\n");
+            return (NULL);
+        }
+
+        l = _quadrosNumeroPNM (q);
+        a = (l > 0)? _quadrosNumeroPNM (q) : -1;
+        maximo = (a > 0)? _quadrosNumeroPNM (q) : -1;
+        if (l <= 0 || a <= 0 || l > 0x7fffffffL / 3 || a > 0x7fffffffL)
+        {
+            printf ("quadrosProximo: erro lendo header.\n");
+            return (NULL);
+        }
+        if (maximo < 1 || maximo > 255)
+        {
+            printf ("quadrosProximo: suporta apenas amostras de 8 bits.\n");
+            return (NULL);
+        }
+        largura = (int) l;
+        altura = (int) a;
+    }
+    else
+    {
+        /* Nos quadros brutos, o fim  quando no vem nem o primeiro byte. */
+        int c = _quadrosByte (q);
+        if (c == -1)
+            return (NULL);
+        q->inicio--;
+    }
+
+    /* Tabelas com os valores possveis, com as mesmas contas da leitura dos
+      BMPs (com mximo 255, o resultado  o mesmo). */
+    for (i = 0; i < 256; i++)
+    {
+        valor [i] = (float) i / (float) maximo;
+        r [i] = valor [i] * 0.299f;
+        g [i] = valor [i] * 0.587f;
+        b [i] = valor [i] * 0.114f;
+    }
+
+    img = criaImagem (largura, altura, n_canais);
+    if (!img)
+        return (NULL);
+
+    _quadrosTamanhoLinha (q, (size_t) largura * cores);
+    for (i = 0; i < altura; i++)
+    {
+        const unsigned char* lin = q->linha;
+
+        if (!_quadrosLe (q, q->linha, (size_t) largura * cores))
+        {
+            printf ("quadrosProximo: quadro incompleto.\n");
+            destroiImagem (img);
+            return (NULL);
+        }
+
+        if (cores == 1)
+        {
+            for (j = 0; j < largura; j++)
+                img->dados [0][i][j] = valor [lin [j]];
+            if (n_canais == 3)
+            {
+                memcpy (img->dados [1][i], img->dados [0][i], sizeof (float) * largura);
+                memcpy (img->dados [2][i], img->dados [0][i], sizeof (float) * largura);
+            }
+        }
+        else if (n_canais == 1)
+        {
+            for (j = 0; j < largura; j++)
+                img->dados [0][i][j] = r [lin [3*j]] + g [lin [3*j+1]] + b [lin [3*j+2]];
+        }
+        else
+        {
+            for (j = 0; j < largura; j++)
+            {
+                img->dados [0][i][j] = valor [lin [3*j]];
+                img->dados [1][i][j] = valor [lin [3*j+1]];
+                img->dados [2][i][j] = valor [lin [3*j+2]];
+            }
+        }
+    }
+
+    return (img);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Termina a leitura de quadros. O descritor no  fechado.
+ *
+ * Parmetros: Quadros* q: o leitor. Pode ser NULL.
+ *
+ * Valor de retorno: nenhum. */
+
+void quadrosFecha (Quadros* q)
+{
+    if (!q)
+        return;
+    free (q->buffer);
+    free (q->linha);
+    free (q);
+}
+
+/*============================================================================*/
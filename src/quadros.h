@@ -0,0 +1,34 @@
+/*============================================================================*/
+/* QUADROS DE UM DESCRITOR                                                    */
+/*============================================================================*/
+/** Leitura de imagens de um descritor de arquivo (a entrada padro, um pipe
+ * ou um arquivo), como uma sequncia contnua de quadros, sem passar pelo
+ * disco. Os formatos aceitos so:
+ *
+ * - PGM e PPM binrios (P5 e P6), com at 255 nveis por amostra. Os quadros
+ *   vm um depois do outro, cada um com o seu cabealho;
+ * - quadros brutos, sem cabealho: 1 byte de cinza por pixel, linha por
+ *   linha, de cima para baixo, com as dimenses dadas na abertura.
+ *
+ * A leitura nunca passa do fim do quadro atual, ento o prximo quadro pode
+ * ainda no ter sido escrito. As imagens so alocadas com o pool, como as de
+ * abreImagem, e a converso para escala de cinza  a mesma dos BMPs. */
+/*============================================================================*/
+
+#ifndef __QUADROS_H
+#define __QUADROS_H
+
+/*============================================================================*/
+
+#include "imagem.h"
+
+/*============================================================================*/
+
+typedef struct _Quadros Quadros;
+
+Quadros* quadrosAbre (int fd, int largura, int altura);
+Imagem* quadrosProximo (Quadros* q, int n_canais);
+void quadrosFecha (Quadros* q);
+
+/*============================================================================*/
+#endif /* __QUADROS_H */
@@ -8,9 +8,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "base.h"
 #include "filtros2d.h"
 #include "segmenta.h"
+#include "pool.h"
 
 /*============================================================================*/
 /* CLASSIFICAO DE PIXELS                                                    */
@@ -20,7 +22,7 @@
  * Parmetros: Imagem* in: imagem de entrada. Se tiver mais que 1 canal,
  *               binariza cada canal independentemente.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *             float threshold: limiar.
  *
  * Valor de retorno: nenhum (usa a imagem de sada). */
@@ -36,8 +38,12 @@ void binariza (Imagem* in, Imagem* out, float threshold)
     int channel, row, col;
     for (channel = 0; channel < in->n_canais; channel++)
         for (row = 0; row < in->altura; row++)
+        {
+            const float* lin_in = in->dados [channel][row];
+            float* lin_out = out->dados [channel][row];
             for (col = 0; col < in->largura; col++)
-                out->dados [channel][row][col] = (in->dados [channel][row][col] > threshold)? 1 : 0;
+                lin_out [col] = (lin_in [col] > threshold)? 1 : 0;
+        }
 }
 
 /*----------------------------------------------------------------------------*/
@@ -47,7 +53,7 @@ void binariza (Imagem* in, Imagem* out, float threshold)
  * Parmetros: Imagem* in: imagem de entrada. Se tiver mais que 1 canal,
  *               processa cada canal independentemente.
  *             Imagem* out: imagem de sada. Deve ter o mesmo tamanho da
- *               imagem de entrada.
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
  *             int largura: largura/altura da janela para a mdia.
  *             float threshold: limiar.
  *             Imagem* buffer: uma imagem com o mesmo tamanho da imagem de
@@ -73,14 +79,24 @@ void binarizaAdapt (Imagem* in, Imagem* out, int largura, float threshold, Image
 
     int channel, row, col;
 
-    // Primeiro calcula as mdias.
-    blur (in, out, largura, largura, buffer);
+    // Primeiro calcula as mdias. Se a sada for a prpria entrada, as mdias
+    // vo para uma imagem temporria, para no perder a entrada.
+    Imagem* medias = (in == out)? criaImagem (in->largura, in->altura, in->n_canais) : out;
+    blur (in, medias, largura, largura, buffer);
 
     // Agora compara cada pixel com a mdia local.
     for (channel = 0; channel < in->n_canais; channel++)
         for (row = 0; row < in->altura; row++)
+        {
+            const float* lin_in = in->dados [channel][row];
+            const float* lin_media = medias->dados [channel][row];
+            float* lin_out = out->dados [channel][row];
             for (col = 0; col < in->largura; col++)
-                out->dados [channel][row][col] = (in->dados [channel][row][col] - out->dados [channel][row][col] > threshold)? 1 : 0;
+                lin_out [col] = (lin_in [col] - lin_media [col] > threshold)? 1 : 0;
+        }
+
+    if (medias != out)
+        destroiImagem (medias);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -139,6 +155,138 @@ float thresholdOtsu (Imagem* img)
     return (((float) melhor_limiar) / 255.0f);
 }
 
+/*----------------------------------------------------------------------------*/
+/** Binarizao simples por limiarizao, para imagens de 8 bits.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *             float threshold: limiar, no intervalo [0,1] (como na binariza).
+ *
+ * Valor de retorno: nenhum (usa a imagem de sada). Os pixels acima do limiar
+ *                   ficam com 255, os outros com 0. */
+
+void binarizaU8 (ImagemU8* in, ImagemU8* out, float threshold)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: binarizaU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    // O mesmo teste da binariza, v/255 > threshold, mas feito uma vez para cada valor possvel.
+    unsigned char tabela [256];
+    int i, row, col;
+    for (i = 0; i < 256; i++)
+        tabela [i] = (i/255.0f > threshold)? 255 : 0;
+
+    for (row = 0; row < in->altura; row++)
+    {
+        const unsigned char* lin_in = in->dados [row];
+        unsigned char* lin_out = out->dados [row];
+        for (col = 0; col < in->largura; col++)
+            lin_out [col] = tabela [lin_in [col]];
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Limiarizao adaptativa para imagens de 8 bits. Faz o mesmo que a
+ * binarizaAdapt, mas as somas da janela so inteiras e exatas: mantemos a
+ * soma de cada coluna dentro da janela vertical, e deslizamos a janela
+ * horizontal sobre essas somas. No precisa de uma imagem integral.
+ *
+ * Parmetros: ImagemU8* in: imagem de entrada.
+ *             ImagemU8* out: imagem de sada. Deve ter o mesmo tamanho da
+ *               imagem de entrada. Pode ser a prpria imagem de entrada.
+ *             int largura: largura/altura da janela para a mdia.
+ *             float threshold: limiar, no intervalo [0,1].
+ *
+ * Valor de retorno: nenhum (a imagem de sada  usada). */
+
+void binarizaAdaptU8 (ImagemU8* in, ImagemU8* out, int largura, float threshold)
+{
+    if (in->largura != out->largura || in->altura != out->altura)
+    {
+        printf ("ERRO: binarizaAdaptU8: as imagens precisam ter o mesmo tamanho.\n");
+        exit (1);
+    }
+
+    if (largura % 2 == 0)
+    {
+        printf ("ERRO: binarizaAdaptU8: a janela deve ter largura e altura impares.\n");
+        exit (1);
+    }
+
+    int row, col, i, n_linhas, n_colunas;
+    int h = largura/2;
+    long long soma, area;
+    double limiar = threshold * 255.0;
+    int* colunas = poolAloca (sizeof (int) * in->largura); // Soma de cada coluna, nas linhas da janela.
+    memset (colunas, 0, sizeof (int) * in->largura);
+
+    // Se a sada for a prpria entrada, as h+1 linhas originais mais recentes
+    // (a linha atual e as que ainda vo sair da janela) ficam guardadas em um anel.
+    int n_anel = (in == out)? h+1 : 0;
+    unsigned char* anel = (n_anel)? poolAloca ((size_t) in->largura * n_anel) : NULL;
+    const unsigned char* lin_in;
+
+    for (row = 0; row < in->altura; row++)
+    {
+        // Atualiza as somas das colunas: entra a linha de baixo, sai a de cima.
+        if (row == 0)
+        {
+            for (i = 0; i <= MIN (h, in->altura-1); i++)
+                for (col = 0; col < in->largura; col++)
+                    colunas [col] += in->dados [i][col];
+        }
+        else
+        {
+            if (row+h < in->altura)
+                for (col = 0; col < in->largura; col++)
+                    colunas [col] += in->dados [row+h][col];
+            if (row-h-1 >= 0)
+            {
+                lin_in = (n_anel)? anel + (size_t) ((row-h-1) % n_anel) * in->largura : in->dados [row-h-1];
+                for (col = 0; col < in->largura; col++)
+                    colunas [col] -= lin_in [col];
+            }
+        }
+
+        lin_in = in->dados [row];
+        if (n_anel)
+        {
+            memcpy (anel + (size_t) (row % n_anel) * in->largura, in->dados [row], in->largura);
+            lin_in = anel + (size_t) (row % n_anel) * in->largura;
+        }
+        n_linhas = MIN (in->altura-1, row+h) - MAX (0, row-h) + 1;
+
+        // Desliza a janela na horizontal.
+        soma = 0;
+        for (col = 0; col <= MIN (h, in->largura-1); col++)
+            soma += colunas [col];
+
+        for (col = 0; col < in->largura; col++)
+        {
+            if (col > 0)
+            {
+                if (col+h < in->largura)
+                    soma += colunas [col+h];
+                if (col-h-1 >= 0)
+                    soma -= colunas [col-h-1];
+            }
+            n_colunas = MIN (in->largura-1, col+h) - MAX (0, col-h) + 1;
+            area = (long long) n_linhas * n_colunas;
+
+            // in - soma/area > threshold, sem divises.
+            out->dados [row][col] = ((double) (lin_in [col] * area - soma) > limiar * area)? 255 : 0;
+        }
+    }
+
+    poolLibera (colunas);
+    if (n_anel)
+        poolLibera (anel);
+}
+
 /*============================================================================*/
 /* ROTULAGEM                                                                  */
 /*============================================================================*/
@@ -174,7 +322,7 @@ int rotulaFloodFill (Imagem* img, ComponenteConexo** componentes, int largura_mi
     *componentes = malloc (sizeof (ComponenteConexo) * n);
 
     // Aloca a pilha (para flood fill com pilha).
-    Coordenada* pilha = malloc (sizeof (Coordenada) * n);
+    Coordenada* pilha = poolAloca (sizeof (Coordenada) * n);
 
     // Rotula.
     n = 0;
@@ -206,7 +354,7 @@ int rotulaFloodFill (Imagem* img, ComponenteConexo** componentes, int largura_mi
     }
 
     // Descarta a pilha.
-	free (pilha);
+	poolLibera (pilha);
 
     // Reduz o nmero de componentes ao necessrio.
     *componentes = realloc (*componentes, sizeof (ComponenteConexo) * n);
@@ -437,5 +585,266 @@ int rotulaUnionFind (Imagem* img, ComponenteConexo** componentes, int largura_mi
     return (n_mantidos);
 }
 
+/*----------------------------------------------------------------------------*/
+/** Rotulagem usando flood fill, para imagens de 8 bits. Como uma imagem de 8
+ * bits no comporta muitos rtulos, os objetos so marcados com os valores
+ * [1,254], reiniciando do 1 quando necessrio. O campo label de cada
+ * componente recebe o valor usado na imagem.
+ *
+ * Parmetros: ImagemU8* img: imagem de entrada E sada.
+ *             ComponenteConexo** componentes: um ponteiro para um vetor de
+ *               sada. Supomos que o ponteiro inicialmente  invlido. Ele ir
+ *               apontar para um vetor que ser alocado dentro desta funo.
+ *               Lembre-se de desalocar o vetor criado!
+ *             int largura_min: descarta componentes com largura menor que esta.
+ *             int altura_min: descarta componentes com altura menor que esta.
+ *             int n_pixels_min: descarta componentes com menos pixels que isso.
+ *
+ * Valor de retorno: o nmero de componentes conexos encontrados. */
+
+#define ROTULO_U8_NAO_MARCADO 255
+
+int rotulaFloodFillU8 (ImagemU8* img, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min)
+{
+    int row, col, n;
+
+    // Marca todos os objetos com o valor reservado.
+    n = 0;
+    for (row = 0; row < img->altura; row++)
+        for (col = 0; col < img->largura; col++)
+            if (img->dados [row][col] > 0)
+            {
+                img->dados [row][col] = ROTULO_U8_NAO_MARCADO;
+                n++;
+            }
+
+    *componentes = malloc (sizeof (ComponenteConexo) * n);
+    Coordenada* pilha = poolAloca (sizeof (Coordenada) * n);
+
+    // Rotula.
+    n = 0;
+    int label = 1;
+    for (row = 0; row < img->altura; row++)
+    {
+        for (col = 0; col < img->largura; col++)
+        {
+            if (img->dados [row][col] == ROTULO_U8_NAO_MARCADO)
+            {
+                ComponenteConexo* c = &((*componentes) [n]);
+                c->label = (float) label;
+                c->roi = criaRetangulo (row, row, col, col);
+                c->n_pixels = 0;
+
+                pilha [0] = criaCoordenada (col,row);
+                floodFillU8 (img, pilha, c);
+
+                if (c->n_pixels >= n_pixels_min &&
+                    c->roi.d - c->roi.e + 1 >= largura_min &&
+                    c->roi.b - c->roi.c + 1 >= altura_min)
+                    n++;
+
+                label = (label % (ROTULO_U8_NAO_MARCADO-1)) + 1;
+            }
+        }
+    }
+
+    poolLibera (pilha);
+
+    *componentes = realloc (*componentes, sizeof (ComponenteConexo) * n);
+    return (n);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Flood fill com pilha, para imagens de 8 bits. Inunda os pixels com o valor
+ * ROTULO_U8_NAO_MARCADO.
+ *
+ * Parmetros: ImagemU8* img: imagem a se inundar.
+ *             Coordenada* pilha: buffer de memria a se usar. Consideramos que
+ *               a primeira posio contm o ponto inicial da inundao.
+ *             ComponenteConexo* componente: dados sobre o blob inundado. O
+ *               valor usado na inundao  o label do componente.
+ *
+ * Valor de retorno: nenhum. */
+
+void floodFillU8 (ImagemU8* img, Coordenada* pilha, ComponenteConexo* componente)
+{
+    int n_pilha = 1;
+    unsigned char label = (unsigned char) componente->label;
+
+    img->dados [pilha [0].y][pilha [0].x] = label;
+
+    while (n_pilha)
+    {
+        Coordenada c = pilha [--n_pilha];
+        componente->n_pixels++;
+
+        if (c.y < componente->roi.c)
+            componente->roi.c = c.y;
+        if (c.y > componente->roi.b)
+            componente->roi.b = c.y;
+        if (c.x < componente->roi.e)
+            componente->roi.e = c.x;
+        if (c.x > componente->roi.d)
+            componente->roi.d = c.x;
+
+        if (c.x > 0 && img->dados [c.y][c.x-1] == ROTULO_U8_NAO_MARCADO)
+        {
+            img->dados [c.y][c.x-1] = label;
+            pilha [n_pilha++] = criaCoordenada (c.x-1, c.y);
+        }
+        if (c.x < img->largura-1 && img->dados [c.y][c.x+1] == ROTULO_U8_NAO_MARCADO)
+        {
+            img->dados [c.y][c.x+1] = label;
+            pilha [n_pilha++] = criaCoordenada (c.x+1, c.y);
+        }
+        if (c.y > 0 && img->dados [c.y-1][c.x] == ROTULO_U8_NAO_MARCADO)
+        {
+            img->dados [c.y-1][c.x] = label;
+            pilha [n_pilha++] = criaCoordenada (c.x, c.y-1);
+        }
+        if (c.y < img->altura-1 && img->dados [c.y+1][c.x] == ROTULO_U8_NAO_MARCADO)
+        {
+            img->dados [c.y+1][c.x] = label;
+            pilha [n_pilha++] = criaCoordenada (c.x, c.y+1);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** Rotulagem com union find para imagens de 8 bits. Uma imagem de 8 bits no
+ * comporta os rtulos provisrios, ento guardamos apenas os rtulos da linha
+ * anterior e da linha atual, e acumulamos os dados de cada componente
+ * (nmero de pixels e retngulo) na prpria union find: quando duas classes
+ * se juntam, os dados vo para a raiz. Assim, uma passada basta, e a imagem
+ * de entrada no  alterada. Os componentes saem na mesma ordem da
+ * rotulaUnionFind, e o label de cada um  o nmero da sua classe.
+ *
+ * Parmetros: ImagemU8* img: imagem de entrada. Pixels > 0 so objetos.
+ *             ComponenteConexo** componentes: um ponteiro para um vetor de
+ *               sada. Supomos que o ponteiro inicialmente  invlido. Ele ir
+ *               apontar para um vetor que ser alocado dentro desta funo.
+ *               Lembre-se de desalocar o vetor criado!
+ *             int largura_min: descarta componentes com largura menor que esta.
+ *             int altura_min: descarta componentes com altura menor que esta.
+ *             int n_pixels_min: descarta componentes com menos pixels que isso.
+ *
+ * Valor de retorno: o nmero de componentes conexos encontrados. */
+
+// Funo auxiliar: junta duas classes, levando os dados do componente para a nova raiz.
+void _rotulaUnionU8 (int* equivalencias, ComponenteConexo* dados, int classe1, int classe2)
+{
+    int raiz1 = rotulaFind (equivalencias, classe1);
+    int raiz2 = rotulaFind (equivalencias, classe2);
+
+    if (raiz1 == raiz2)
+        return;
+
+    if (raiz2 < raiz1)
+    {
+        int tmp = raiz1;
+        raiz1 = raiz2;
+        raiz2 = tmp;
+    }
+
+    equivalencias [raiz2] = raiz1;
+    dados [raiz1].n_pixels += dados [raiz2].n_pixels;
+    dados [raiz1].roi.c = MIN (dados [raiz1].roi.c, dados [raiz2].roi.c);
+    dados [raiz1].roi.b = MAX (dados [raiz1].roi.b, dados [raiz2].roi.b);
+    dados [raiz1].roi.e = MIN (dados [raiz1].roi.e, dados [raiz2].roi.e);
+    dados [raiz1].roi.d = MAX (dados [raiz1].roi.d, dados [raiz2].roi.d);
+}
+
+int rotulaUnionFindU8 (ImagemU8* img, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min)
+{
+    int i, j, n;
+    int* anterior = poolAloca (sizeof (int) * img->largura); // Rtulos da linha anterior (0 = fundo).
+    int* atual = poolAloca (sizeof (int) * img->largura);
+    memset (anterior, 0, sizeof (int) * img->largura);
+    int* tmp;
+
+    // A lista de equivalncias e os dados crescem conforme surgem novas classes.
+    int capacidade = 256;
+    int n_classes = 1;
+    int* equivalencias = malloc (sizeof (int) * capacidade);
+    ComponenteConexo* dados = malloc (sizeof (ComponenteConexo) * capacidade);
+    equivalencias [0] = 0;
+
+    for (i = 0; i < img->altura; i++)
+    {
+        for (j = 0; j < img->largura; j++)
+        {
+            if (img->dados [i][j] == 0)
+            {
+                atual [j] = 0;
+                continue;
+            }
+
+            int label_cima = anterior [j];
+            int label_esquerda = (j > 0)? atual [j-1] : 0;
+            int label;
+
+            if (!label_cima && !label_esquerda) // Nova classe.
+            {
+                if (n_classes == capacidade)
+                {
+                    capacidade *= 2;
+                    equivalencias = realloc (equivalencias, sizeof (int) * capacidade);
+                    dados = realloc (dados, sizeof (ComponenteConexo) * capacidade);
+                }
+                label = n_classes++;
+                equivalencias [label] = 0;
+                dados [label].n_pixels = 0;
+                dados [label].roi = criaRetangulo (i, i, j, j);
+            }
+            else if (label_cima && label_esquerda)
+            {
+                label = MIN (label_cima, label_esquerda);
+                if (label_cima != label_esquerda)
+                    _rotulaUnionU8 (equivalencias, dados, label_cima, label_esquerda);
+            }
+            else
+                label = (label_cima)? label_cima : label_esquerda;
+
+            atual [j] = label;
+
+            // Atualiza os dados na raiz.
+            ComponenteConexo* c = &(dados [rotulaFind (equivalencias, label)]);
+            c->n_pixels++;
+            if (i > c->roi.b)
+                c->roi.b = i;
+            if (j < c->roi.e)
+                c->roi.e = j;
+            if (j > c->roi.d)
+                c->roi.d = j;
+        }
+
+        tmp = anterior;
+        anterior = atual;
+        atual = tmp;
+    }
+
+    // As razes so os componentes. Descarta os pequenos demais.
+    n = 0;
+    for (i = 1; i < n_classes; i++)
+        if (equivalencias [i] == 0)
+        {
+            ComponenteConexo* c = &(dados [i]);
+            if (c->n_pixels >= n_pixels_min &&
+                c->roi.d - c->roi.e + 1 >= largura_min &&
+                c->roi.b - c->roi.c + 1 >= altura_min)
+            {
+                c->label = (float) i;
+                dados [n++] = *c;
+            }
+        }
+
+    *componentes = realloc (dados, sizeof (ComponenteConexo) * MAX (n, 1));
+
+    free (equivalencias);
+    poolLibera (anterior);
+    poolLibera (atual);
+    return (n);
+}
+
 
 /*============================================================================*/
@@ -34,5 +34,18 @@ int rotulaFloodFill (Imagem* img, ComponenteConexo** componentes, int largura_mi
 void floodFill (Imagem* img, Coordenada* pilha, ComponenteConexo* componente);
 int rotulaUnionFind (Imagem* img, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min);
 
+/* Verses para imagens de 8 bits. Imagens binrias usam os valores 0 e 255. */
+void binarizaU8 (ImagemU8* in, ImagemU8* out, float threshold);
+void binarizaAdaptU8 (ImagemU8* in, ImagemU8* out, int largura, float threshold);
+int rotulaFloodFillU8 (ImagemU8* img, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min);
+void floodFillU8 (ImagemU8* img, Coordenada* pilha, ComponenteConexo* componente);
+int rotulaUnionFindU8 (ImagemU8* img, ComponenteConexo** componentes, int largura_min, int altura_min, int n_pixels_min);
+
+/* Union-find usado pelas rotulagens, para quem rotula de outra forma (ver
+ * fluxo.h). Classes comeam em 1; equivalencias [classe] == 0 indica uma
+ * raiz. A _rotulaUnionU8 tambm junta os dados dos componentes na raiz. */
+int rotulaFind (int* equivalencias, int classe);
+void _rotulaUnionU8 (int* equivalencias, ComponenteConexo* dados, int classe1, int classe2);
+
 /*============================================================================*/
 #endif /* __IMAGEM_H */
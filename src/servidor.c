@@ -0,0 +1,287 @@
+/*============================================================================*/
+/* SERVIDOR LOCAL                                                             */
+/*============================================================================*/
+/** Servidor de pedidos em linhas de texto, em um socket Unix. */
+/*============================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "servidor.h"
+
+/*============================================================================*/
+
+/* Uma conexo, atendida por uma thread. */
+typedef struct _ConexaoServidor
+{
+    int fd;
+    TrataPedido trata;
+    void* dados;
+    struct _ConexaoServidor* anterior; /* Na lista das conexes abertas. */
+    struct _ConexaoServidor* proxima;
+} ConexaoServidor;
+
+#define SERVIDOR_ESPERA_ACCEPT 100000 /* Espera depois de um accept sem recursos, em microssegundos. */
+
+volatile sig_atomic_t servidor_terminar = 0;
+
+/* As conexes abertas, para que o servidor possa fech-las e esperar que
+ * terminem antes de retornar. */
+ConexaoServidor* servidor_conexoes = NULL;
+pthread_mutex_t servidor_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t servidor_fechou = PTHREAD_COND_INITIALIZER;
+
+/*============================================================================*/
+/* FUNES INTERNAS                                                           */
+/*============================================================================*/
+/** Tratador de SIGINT e SIGTERM: pede para o servidor parar de aceitar
+ * conexes. */
+
+void _servidorSinal (int sinal)
+{
+    (void) sinal;
+    servidor_terminar = 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/** Envia todos os bytes dados, repetindo enquanto o envio for parcial.
+ *
+ * Parmetros: int fd: o socket.
+ *             const char* buffer: os bytes.
+ *             size_t n: nmero de bytes.
+ *
+ * Valor de retorno: 1 se tudo foi enviado, 0 do contrrio. */
+
+int _servidorEnvia (int fd, const char* buffer, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t enviados = send (fd, buffer, n, MSG_NOSIGNAL);
+        if (enviados < 0 && errno == EINTR)
+            continue;
+        if (enviados <= 0)
+            return (0);
+        buffer += enviados;
+        n -= (size_t) enviados;
+    }
+    return (1);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Tira uma conexo da lista das abertas, avisando o servidor.
+ *
+ * Parmetros: ConexaoServidor* conexao: a conexo.
+ *
+ * Valor de retorno: nenhum. */
+
+void _servidorRemove (ConexaoServidor* conexao)
+{
+    pthread_mutex_lock (&servidor_mutex);
+    if (conexao->anterior)
+        conexao->anterior->proxima = conexao->proxima;
+    else
+        servidor_conexoes = conexao->proxima;
+    if (conexao->proxima)
+        conexao->proxima->anterior = conexao->anterior;
+    pthread_cond_broadcast (&servidor_fechou);
+    pthread_mutex_unlock (&servidor_mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+/** Lao de uma conexo: l as linhas, trata cada uma e envia as respostas,
+ * at o cliente fechar a conexo (ou o servidor parar de receber os pedidos
+ * dela, quando termina).
+ *
+ * Parmetros: void* arg: a ConexaoServidor, que  liberada no fim.
+ *
+ * Valor de retorno: NULL. */
+
+void* _servidorConexao (void* arg)
+{
+    ConexaoServidor* conexao = (ConexaoServidor*) arg;
+    char* entrada = (char*) malloc (SERVIDOR_MAX_LINHA);
+    char* resposta = (char*) malloc (SERVIDOR_MAX_LINHA + 1);
+    size_t n = 0; /* Bytes em entrada. */
+    int continuar = 1;
+
+    while (continuar)
+    {
+        char* fim = memchr (entrada, '\n', n);
+        ssize_t lidos;
+
+        if (fim)
+        {
+            size_t tamanho_linha = (size_t) (fim - entrada) + 1;
+
+            *fim = 0;
+            if (fim > entrada && fim [-1] == '\r')
+                fim [-1] = 0;
+
+            resposta [0] = 0;
+            continuar = conexao->trata (entrada, resposta, SERVIDOR_MAX_LINHA, conexao->dados);
+            strcat (resposta, "\n");
+            if (!_servidorEnvia (conexao->fd, resposta, strlen (resposta)))
+                break;
+
+            memmove (entrada, entrada + tamanho_linha, n - tamanho_linha);
+            n -= tamanho_linha;
+            continue;
+        }
+
+        if (n == SERVIDOR_MAX_LINHA)
+        {
+            const char* erro = "{\"erro\": \"pedido longo demais\"}\n";
+            _servidorEnvia (conexao->fd, erro, strlen (erro));
+            break;
+        }
+
+        lidos = recv (conexao->fd, entrada + n, SERVIDOR_MAX_LINHA - n, 0);
+        if (lidos < 0 && errno == EINTR)
+            continue;
+        if (lidos <= 0)
+            break;
+        n += (size_t) lidos;
+    }
+
+    /* Depois de sair da lista, a conexo no  mais usada pelo servidor. */
+    _servidorRemove (conexao);
+    close (conexao->fd);
+    free (entrada);
+    free (resposta);
+    free (conexao);
+    return (NULL);
+}
+
+/*============================================================================*/
+/* FUNES DO MDULO                                                          */
+/*============================================================================*/
+/** Atende pedidos em um socket Unix at receber SIGINT ou SIGTERM. Um socket
+ * antigo no mesmo caminho  substitudo, e o socket  removido no fim. Ao
+ * parar, o servidor deixa de receber pedidos nas conexes abertas, e espera
+ * os pedidos em andamento terminarem (e as respostas serem enviadas): quando
+ * ele retorna, trata no est mais sendo chamada.
+ *
+ * Parmetros: const char* caminho: caminho do socket.
+ *             TrataPedido trata: funo que trata cada pedido.  chamada de
+ *               vrias threads ao mesmo tempo.
+ *             void* dados: passado para trata.
+ *
+ * Valor de retorno: 1 se o servidor parou normalmente, 0 se no foi possvel
+ *                   abrir o socket ou se o accept falhou de forma que no
+ *                   se resolve esperando. */
+
+int servidorExecuta (const char* caminho, TrataPedido trata, void* dados)
+{
+    struct sockaddr_un endereco;
+    struct sigaction acao;
+    sigset_t sinais, anteriores;
+    ConexaoServidor* aberta;
+    int fd, ok = 1;
+
+    if (strlen (caminho) >= sizeof (endereco.sun_path))
+    {
+        printf ("servidorExecuta: caminho do socket longo demais.\n");
+        return (0);
+    }
+
+    memset (&endereco, 0, sizeof (endereco));
+    endereco.sun_family = AF_UNIX;
+    strcpy (endereco.sun_path, caminho);
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    unlink (caminho);
+    if (fd < 0 || bind (fd, (struct sockaddr*) &endereco, sizeof (endereco)) != 0 || listen (fd, 64) != 0)
+    {
+        printf ("servidorExecuta: nao foi possivel abrir o socket %s.\n", caminho);
+        if (fd >= 0)
+            close (fd);
+        return (0);
+    }
+
+    /* Sem SA_RESTART, para que o accept seja interrompido pelos sinais. */
+    memset (&acao, 0, sizeof (acao));
+    acao.sa_handler = _servidorSinal;
+    sigemptyset (&acao.sa_mask);
+    sigaction (SIGINT, &acao, NULL);
+    sigaction (SIGTERM, &acao, NULL);
+
+    /* As threads das conexes no recebem esses sinais: s a principal. */
+    sigemptyset (&sinais);
+    sigaddset (&sinais, SIGINT);
+    sigaddset (&sinais, SIGTERM);
+
+    while (!servidor_terminar)
+    {
+        ConexaoServidor* conexao;
+        pthread_t thread;
+        int cliente = accept (fd, NULL, NULL);
+
+        if (cliente < 0)
+        {
+            /* Interrompido por um sinal, ou o cliente desistiu: tenta de novo. */
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            /* Sem descritores ou memria: espera alguma conexo fechar, em vez
+             * de tentar de novo sem parar. */
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                usleep (SERVIDOR_ESPERA_ACCEPT);
+                continue;
+            }
+
+            /* Qualquer outro erro no passa com o tempo: o servidor para. */
+            printf ("ERRO: servidorExecuta: accept: %s.\n", strerror (errno));
+            ok = 0;
+            break;
+        }
+
+        conexao = (ConexaoServidor*) malloc (sizeof (ConexaoServidor));
+        conexao->fd = cliente;
+        conexao->trata = trata;
+        conexao->dados = dados;
+
+        pthread_mutex_lock (&servidor_mutex);
+        conexao->anterior = NULL;
+        conexao->proxima = servidor_conexoes;
+        if (servidor_conexoes)
+            servidor_conexoes->anterior = conexao;
+        servidor_conexoes = conexao;
+        pthread_mutex_unlock (&servidor_mutex);
+
+        pthread_sigmask (SIG_BLOCK, &sinais, &anteriores);
+        if (pthread_create (&thread, NULL, _servidorConexao, conexao) != 0)
+        {
+            pthread_sigmask (SIG_SETMASK, &anteriores, NULL);
+            printf ("ERRO: servidorExecuta: nao foi possivel criar a thread.\n");
+            _servidorRemove (conexao);
+            close (cliente);
+            free (conexao);
+            continue;
+        }
+        pthread_sigmask (SIG_SETMASK, &anteriores, NULL);
+        pthread_detach (thread);
+    }
+
+    close (fd);
+    unlink (caminho);
+
+    /* Os clientes no conseguem mais enviar pedidos: cada conexo termina
+     * depois de responder o pedido em andamento (e os que j chegaram). */
+    pthread_mutex_lock (&servidor_mutex);
+    for (aberta = servidor_conexoes; aberta; aberta = aberta->proxima)
+        shutdown (aberta->fd, SHUT_RD);
+    while (servidor_conexoes)
+        pthread_cond_wait (&servidor_fechou, &servidor_mutex);
+    pthread_mutex_unlock (&servidor_mutex);
+
+    return (ok);
+}
+
+/*============================================================================*/
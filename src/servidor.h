@@ -0,0 +1,32 @@
+/*============================================================================*/
+/* SERVIDOR LOCAL                                                             */
+/*============================================================================*/
+/** Servidor em um socket Unix, para um processo que fica residente e atende
+ * pedidos de outros processos da mesma mquina. O protocolo  de linhas de
+ * texto: cada linha recebida  um pedido, e a resposta (tambm uma linha) 
+ * enviada antes de ler o prximo pedido da mesma conexo.
+ *
+ * Cada cliente  atendido em uma thread prpria, ento vrios clientes podem
+ * ter pedidos em andamento ao mesmo tempo. O tratamento dos pedidos  de
+ * quem chama, e deve poder ser chamado de vrias threads. */
+/*============================================================================*/
+
+#ifndef __SERVIDOR_H
+#define __SERVIDOR_H
+
+/*============================================================================*/
+
+#include <stddef.h>
+
+/*============================================================================*/
+
+#define SERVIDOR_MAX_LINHA 4096 /* Tamanho mximo de um pedido e de uma resposta. */
+
+/* Trata um pedido (a linha, sem o \n), escrevendo a resposta (sem o \n) em
+ * resposta, que tem o tamanho dado. Retorna 0 para fechar a conexo. */
+typedef int (*TrataPedido) (const char* pedido, char* resposta, size_t tamanho, void* dados);
+
+int servidorExecuta (const char* caminho, TrataPedido trata, void* dados);
+
+/*============================================================================*/
+#endif /* __SERVIDOR_H */
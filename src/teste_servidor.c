@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "imagem.h"
+#include "pool.h"
+
+//Teste do modo residente: um pedido com uma imagem pequena demais para os
+//filtros deve receber um erro, e o servidor deve continuar atendendo. Sobe
+//o ./trabalho4 -d em um socket temporario, pede a contagem de uma imagem de
+//5x5 e depois a de ../imagens/60.bmp (em outra conexao), e no fim para o
+//servidor com SIGTERM, que deve sair normalmente e remover o socket.
+//
+//Uso: make teste (ou ./teste_servidor, com o trabalho4 ja compilado)
+
+//Conecta ao socket, tentando de novo ate o servidor subir. Retorna -1 se nao
+//conseguir.
+int conecta(const char *caminho, int tentativas) {
+    struct sockaddr_un endereco;
+    memset(&endereco, 0, sizeof(endereco));
+    endereco.sun_family = AF_UNIX;
+    snprintf(endereco.sun_path, sizeof(endereco.sun_path), "%s", caminho);
+
+    for(int i = 0; i < tentativas; i += 1) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && connect(fd, (struct sockaddr *) &endereco, sizeof(endereco)) == 0)
+            return fd;
+        if(fd >= 0)
+            close(fd);
+        usleep(50000);
+    }
+    return -1;
+}
+
+//Envia um pedido e le a resposta (uma linha). Retorna 0 se a conexao caiu.
+int pede(int fd, const char *pedido, char *resposta, size_t tamanho) {
+    size_t n = 0;
+    if(write(fd, pedido, strlen(pedido)) != (ssize_t) strlen(pedido))
+        return 0;
+    while(n + 1 < tamanho) {
+        ssize_t lidos = read(fd, resposta + n, 1);
+        if(lidos <= 0)
+            return 0;
+        if(resposta[n] == '\n')
+            break;
+        n += 1;
+    }
+    resposta[n] = 0;
+    return 1;
+}
+
+int main() {
+    char socket_[64], imagem[64], pedido[128], resposta[4096];
+    int falhas = 0, fd, estado;
+
+    snprintf(socket_, sizeof(socket_), "/tmp/trabalho4_teste_%d.sock", (int) getpid());
+    snprintf(imagem, sizeof(imagem), "/tmp/trabalho4_teste_%d.bmp", (int) getpid());
+
+    //A imagem pequena: 5x5, menor que o kernel do filtro gaussiano padrao.
+    poolInicia(0);
+    Imagem *img = criaImagem(5, 5, 3);
+    for(int c = 0; c < 3; c += 1)
+        for(int y = 0; y < 5; y += 1)
+            for(int x = 0; x < 5; x += 1)
+                img->dados[c][y][x] = (x + y) / 8.0f;
+    if(!salvaImagem(img, imagem)) {
+        printf("FALHOU: nao foi possivel criar %s\n", imagem);
+        return 1;
+    }
+    destroiImagem(img);
+
+    pid_t servidor = fork();
+    if(servidor == 0) {
+        execl("./trabalho4", "trabalho4", "-d", socket_, (char *) NULL);
+        _exit(127);
+    }
+
+    //Primeiro pedido: a imagem pequena deve receber um erro.
+    fd = conecta(socket_, 100);
+    if(fd < 0) {
+        printf("FALHOU: o servidor nao subiu\n");
+        falhas += 1;
+    }
+    else {
+        snprintf(pedido, sizeof(pedido), "conta %s\n", imagem);
+        if(!pede(fd, pedido, resposta, sizeof(resposta)) || strstr(resposta, "\"erro\": \"tamanho\"") == NULL) {
+            printf("FALHOU: imagem pequena: %s\n", resposta);
+            falhas += 1;
+        }
+        close(fd);
+    }
+
+    //Segundo pedido, em outra conexao: o servidor continua de pe.
+    fd = conecta(socket_, 1);
+    if(fd < 0 || !pede(fd, "conta ../imagens/60.bmp\n", resposta, sizeof(resposta)) ||
+       strstr(resposta, "\"graos\": 60") == NULL) {
+        printf("FALHOU: pedido depois da imagem pequena: %s\n", fd < 0 ? "conexao recusada" : resposta);
+        falhas += 1;
+    }
+    if(fd >= 0)
+        close(fd);
+
+    //O servidor para normalmente e remove o socket.
+    kill(servidor, SIGTERM);
+    waitpid(servidor, &estado, 0);
+    if(!WIFEXITED(estado) || WEXITSTATUS(estado) != 0 || access(socket_, F_OK) == 0) {
+        printf("FALHOU: o servidor nao terminou normalmente\n");
+        falhas += 1;
+        unlink(socket_);
+    }
+
+    unlink(imagem);
+    poolFinaliza();
+    printf(falhas ? "teste_servidor: %d falha(s)\n" : "teste_servidor: ok\n", falhas);
+    return falhas ? 1 : 0;
+}